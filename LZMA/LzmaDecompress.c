@@ -16,6 +16,7 @@ WITHWARRANTIES OR REPRESENTATIONS OF ANY KIND, EITHER EXPRESS OR IMPLIED.
 #include "SDK/C/7zVersion.h"
 
 #include <stdlib.h>
+#include <string.h>
 
 UINT64
 	EFIAPI
@@ -157,3 +158,146 @@ INT32
 	}
 }
 
+
+// Initial size of the output buffer for bounded decompression
+#define LZMA_BOUNDED_INITIAL_SIZE 0x10000
+
+/*
+Decompresses a Lzma compressed source buffer without trusting the size
+stored in its header.
+
+@param  Source             The source buffer containing the compressed data.
+@param  SourceSize         The size of source buffer.
+@param  MaxDestinationSize The maximum allowed size of decompressed data.
+@param  Destination        Receives a pointer to the decompressed data, allocated with malloc().
+@param  DestinationSize    Receives the size of the decompressed data.
+
+@retval  ERR_SUCCESS                 Decompression completed successfully.
+@retval  ERR_INVALID_PARAMETER       The source buffer is corrupted.
+@retval  ERR_OUT_OF_MEMORY           Memory allocation failed.
+@retval  ERR_MEMORY_BUDGET_EXCEEDED  Decompressed data exceeds MaxDestinationSize.
+*/
+INT32
+	EFIAPI
+	LzmaDecompressBounded (
+	CONST VOID  *Source,
+	UINT32       SourceSize,
+	UINT32       MaxDestinationSize,
+	VOID       **Destination,
+	UINT32      *DestinationSize
+	)
+{
+	CLzmaDec          Decoder;
+	SRes              LzmaResult;
+	ELzmaStatus       Status;
+	Byte              Props[LZMA_PROPS_SIZE];
+	UINT64            DeclaredSize;
+	UINT32            DictionarySize;
+	UINT32            Limit;
+	CONST Byte*       Input;
+	SizeT             InputLeft;
+	Byte*             Output;
+	Byte*             NewOutput;
+	UINT32            OutputSize;
+	UINT32            OutputCapacity;
+	UINT32            Index;
+	INT32             Result;
+
+	if (!Source || !Destination || !DestinationSize || SourceSize < LZMA_HEADER_SIZE)
+		return ERR_INVALID_PARAMETER;
+
+	*Destination = NULL;
+	*DestinationSize = 0;
+
+	// Declared size of (UINT64)-1 means that the size is unknown and the stream has an end marker
+	DeclaredSize = GetDecodedSizeOfBuf((UINT8*)Source);
+	if (DeclaredSize != (UINT64)-1 && DeclaredSize > MaxDestinationSize)
+		return ERR_MEMORY_BUDGET_EXCEEDED;
+	Limit = (DeclaredSize == (UINT64)-1) ? MaxDestinationSize : (UINT32)DeclaredSize;
+
+	// Dictionary larger than the whole output is never needed, clamp it to the limit
+	memcpy(Props, Source, LZMA_PROPS_SIZE);
+	DictionarySize = 0;
+	for (Index = 0; Index < 4; Index++)
+		DictionarySize |= (UINT32)Props[1 + Index] << (8 * Index);
+	if (DictionarySize > Limit) {
+		DictionarySize = Limit;
+		for (Index = 0; Index < 4; Index++)
+			Props[1 + Index] = (Byte)(DictionarySize >> (8 * Index));
+	}
+
+	LzmaDec_Construct(&Decoder);
+	LzmaResult = LzmaDec_Allocate(&Decoder, Props, LZMA_PROPS_SIZE, &SzAllocForLzma);
+	if (LzmaResult == SZ_ERROR_MEM)
+		return ERR_OUT_OF_MEMORY;
+	if (LzmaResult != SZ_OK)
+		return ERR_INVALID_PARAMETER;
+	LzmaDec_Init(&Decoder);
+
+	Input = (CONST Byte*)Source + LZMA_HEADER_SIZE;
+	InputLeft = (SizeT)(SourceSize - LZMA_HEADER_SIZE);
+	Output = NULL;
+	OutputSize = 0;
+	OutputCapacity = 0;
+	Result = ERR_SUCCESS;
+
+	for (;;) {
+		SizeT InputChunk;
+		SizeT OutputChunk;
+
+		// Grow output buffer
+		if (OutputSize == OutputCapacity) {
+			UINT32 NewCapacity;
+			if (OutputCapacity >= Limit) {
+				// Declared size reached, or budget exhausted while the stream continues
+				Result = (DeclaredSize == (UINT64)-1) ? ERR_MEMORY_BUDGET_EXCEEDED : ERR_SUCCESS;
+				break;
+			}
+			NewCapacity = OutputCapacity ? OutputCapacity : LZMA_BOUNDED_INITIAL_SIZE;
+			if (OutputCapacity && NewCapacity <= Limit - OutputCapacity)
+				NewCapacity = OutputCapacity * 2;
+			else if (OutputCapacity)
+				NewCapacity = Limit;
+			if (NewCapacity > Limit)
+				NewCapacity = Limit;
+			NewOutput = (Byte*)realloc(Output, NewCapacity ? NewCapacity : 1);
+			if (!NewOutput) {
+				Result = ERR_OUT_OF_MEMORY;
+				break;
+			}
+			Output = NewOutput;
+			OutputCapacity = NewCapacity;
+		}
+
+		InputChunk = InputLeft;
+		OutputChunk = OutputCapacity - OutputSize;
+		LzmaResult = LzmaDec_DecodeToBuf(&Decoder, Output + OutputSize, &OutputChunk, Input, &InputChunk,
+			(OutputCapacity == Limit && DeclaredSize != (UINT64)-1) ? LZMA_FINISH_END : LZMA_FINISH_ANY, &Status);
+		Input += InputChunk;
+		InputLeft -= InputChunk;
+		OutputSize += (UINT32)OutputChunk;
+
+		if (LzmaResult != SZ_OK) {
+			Result = ERR_INVALID_PARAMETER;
+			break;
+		}
+		if (Status == LZMA_STATUS_FINISHED_WITH_MARK)
+			break;
+		if (Status == LZMA_STATUS_NEEDS_MORE_INPUT || (InputChunk == 0 && OutputChunk == 0)) {
+			// Stream is truncated
+			Result = ERR_INVALID_PARAMETER;
+			break;
+		}
+	}
+
+	LzmaDec_Free(&Decoder, &SzAllocForLzma);
+
+	if (Result != ERR_SUCCESS) {
+		free(Output);
+		return Result;
+	}
+
+	*Destination = Output;
+	*DestinationSize = OutputSize;
+	return ERR_SUCCESS;
+}
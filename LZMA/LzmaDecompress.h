@@ -92,6 +92,40 @@ LzmaDecompress (
   VOID    *Destination
   );
 
+/*
+  Decompresses a Lzma compressed source buffer without trusting the size
+  stored in its header.
+
+  Decoding is done in chunks with LzmaDec_DecodeToBuf and the output buffer
+  is grown incrementally, so memory usage follows the real amount of
+  decompressed data instead of the value declared in the header.
+  The dictionary is never allocated larger than MaxDestinationSize.
+  If the decompressed data would exceed MaxDestinationSize, decoding stops
+  and ERR_MEMORY_BUDGET_EXCEEDED is returned.
+
+  @param  Source             The source buffer containing the compressed data.
+  @param  SourceSize         The size of source buffer.
+  @param  MaxDestinationSize The maximum allowed size of decompressed data.
+  @param  Destination        Receives a pointer to the decompressed data.
+                             The buffer is allocated with malloc() and must be
+                             released by the caller with free().
+  @param  DestinationSize    Receives the size of the decompressed data.
+
+  @retval  ERR_SUCCESS                 Decompression completed successfully.
+  @retval  ERR_INVALID_PARAMETER       The source buffer is corrupted.
+  @retval  ERR_OUT_OF_MEMORY           Memory allocation failed.
+  @retval  ERR_MEMORY_BUDGET_EXCEEDED  Decompressed data exceeds MaxDestinationSize.
+*/
+INT32
+EFIAPI
+LzmaDecompressBounded (
+  const VOID  *Source,
+  UINT32       SourceSize,
+  UINT32       MaxDestinationSize,
+  VOID       **Destination,
+  UINT32      *DestinationSize
+  );
+
 #ifdef __cplusplus
 }
 #endif
@@ -11,6 +11,8 @@ WITHOUT WARRANTIES OR REPRESENTATIONS OF ANY KIND, EITHER EXPRESS OR IMPLIED.
 
 */
 
+#include <QUuid>
+
 #include "../ffs.h"
 #include "ffsutil.h"
 #include "util.h"
@@ -19,6 +21,8 @@ WITHOUT WARRANTIES OR REPRESENTATIONS OF ANY KIND, EITHER EXPRESS OR IMPLIED.
 FFSUtil::FFSUtil(void)
 {
     ffsEngine = new FfsEngine();
+    // Recompress sections only when injected files don't fit into a volume
+    ffsEngine->setCompressionOptimization(true);
 }
 
 FFSUtil::~FFSUtil(void)
@@ -54,6 +58,10 @@ UINT8 FFSUtil::reconstructImageFile(QByteArray & out) {
     return ffsEngine->reconstructImageFile(out);
 }
 
+UINT8 FFSUtil::reconstructImageFile(ImageBuilder & out) {
+    return ffsEngine->reconstructImageFile(out);
+}
+
 UINT8 FFSUtil::getRootIndex(QModelIndex &result) {
     result = ffsEngine->treeModel()->index(0,0);
     return ERR_SUCCESS;
@@ -67,6 +75,26 @@ UINT8 FFSUtil::findFileByGUID(const QModelIndex index, const QString guid, QMode
         return ERR_INVALID_SECTION;
     }
 
+    // Look GUID up in the index instead of walking the tree
+    QUuid uuid = QUuid(guid);
+    if (!uuid.isNull()) {
+        QModelIndexList found;
+        ffsEngine->findItemsByGuid(QByteArray((const char*)&uuid.data1, sizeof(EFI_GUID)), found);
+        for (int i = 0; i < found.size(); i++) {
+            if (ffsEngine->treeModel()->nameString(found.at(i)).compare(guid))
+                continue;
+            // Item must be inside of the searched subtree
+            QModelIndex parent = found.at(i);
+            while (parent.isValid() && parent != index)
+                parent = parent.parent();
+            if (parent.isValid()) {
+                result = found.at(i);
+                return ERR_SUCCESS;
+            }
+        }
+        return ERR_ITEM_NOT_FOUND;
+    }
+
     if(!ffsEngine->treeModel()->nameString(index).compare(guid)) {
         result = index;
         return ERR_SUCCESS;
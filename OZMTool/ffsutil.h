@@ -30,6 +30,7 @@ public:
     UINT8 decompress(QByteArray & compressed, UINT8 compressionType, QByteArray & decompressedData, UINT8 *algorithm);
     UINT8 remove(QModelIndex & index);
     UINT8 reconstructImageFile(QByteArray & out);
+    UINT8 reconstructImageFile(ImageBuilder & out);
 
     UINT8 getRootIndex(QModelIndex & result);
     UINT8 findFileByGUID(const QModelIndex index, const QString guid, QModelIndex & result);
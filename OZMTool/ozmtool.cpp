@@ -107,7 +107,8 @@ UINT8 OZMTool::DSDTExtract(QString inputfile, QString outputdir)
 UINT8 OZMTool::DSDTInject(QString inputfile, QString dsdtfile, QString outputfile)
 {
     UINT8 ret;
-    QByteArray buf, dsdtbuf, out;
+    QByteArray buf, dsdtbuf;
+    ImageBuilder out;
 
     FFSUtil *fu = new FFSUtil();
 
@@ -165,7 +166,7 @@ UINT8 OZMTool::OZMUpdate(QString inputfile, QString recentBios, QString outputfi
     QByteArray oldBIOS;
     QByteArray newBIOS;
     QByteArray ffsbuf;
-    QByteArray out;
+    ImageBuilder out;
     QModelIndex volumeIdx;
 
     FFSUtil *oFU = new FFSUtil();
@@ -28,6 +28,11 @@ SOURCES  += ozmtool_main.cpp \
  ../descriptor.cpp \
  ../ffs.cpp \
  ../ffsengine.cpp \
+ ../bytepattern.cpp \
+ ../dumpwriter.cpp \
+ ../imagebuilder.cpp \
+ ../patchprogram.cpp \
+ ../patternset.cpp \
  ../treeitem.cpp \
  ../treemodel.cpp \
  ../LZMA/LzmaCompress.c \
@@ -53,6 +58,11 @@ HEADERS  += ozmtool.h \
  ../peimage.h \
  ../types.h \
  ../ffsengine.h \
+ ../bytepattern.h \
+ ../dumpwriter.h \
+ ../imagebuilder.h \
+ ../patchprogram.h \
+ ../patternset.h \
  ../treeitem.h \
  ../treemodel.h \
  ../peimage.h \
@@ -65,6 +65,16 @@ UINT8 fileWrite(QString path, QByteArray & buf)
     return ERR_SUCCESS;
 }
 
+UINT8 fileWrite(QString path, ImageBuilder & image)
+{
+    QFileInfo fileInfo(path);
+
+    if (fileInfo.exists())
+        printf("Warning: File already exists! Overwriting it...\n");
+
+    return image.write(path);
+}
+
 BOOLEAN fileExists(QString path)
 {
     QFileInfo fileInfo = QFileInfo(path);
@@ -21,6 +21,7 @@ WITHOUT WARRANTIES OR REPRESENTATIONS OF ANY KIND, EITHER EXPRESS OR IMPLIED.
 /* Generic stuff */
 UINT8 fileOpen(QString path, QByteArray & buf);
 UINT8 fileWrite(QString path, QByteArray & buf);
+UINT8 fileWrite(QString path, ImageBuilder & image);
 BOOLEAN fileExists(QString path);
 UINT8 dirCreate(QString path);
 BOOLEAN dirExists(QString path);
@@ -34,6 +34,34 @@ Decompressor. Algorithm Ported from OPSD code (Decomp.asm)
 #endif
 #define BAD_TABLE - 1
 
+//
+// Widths of first-level lookup tables used by Decode.
+// Each entry holds both the symbol and its code length, so a single lookup
+// is enough for all codes not longer than the table width.
+// Tables are rebuilt for every block, and typical blocks are small, so wider
+// character/length table costs more to build than it saves.
+//
+#define CFASTBIT  12
+#define PFASTBIT  10
+
+//
+// Lookup table entry: bits 0-15 hold a symbol, bits 16-23 hold its code length.
+// If FAST_SLOW is set, bits 0-15 hold a tree node to continue walking from.
+//
+#define FAST_SLOW           0x80000000U
+#define FAST_ENTRY(Sym, Len) ((UINT32)(Sym) | ((UINT32)(Len) << 16))
+#define FAST_SYMBOL(Entry)   ((UINT16)((Entry) & 0xFFFF))
+#define FAST_LENGTH(Entry)   ((UINT16)(((Entry) >> 16) & 0xFF))
+
+//
+// The BITBUFSIZ bits of the stream every decoding step looks at
+//
+#define BITBUF(Sd) ((UINT32)((Sd)->mBitBuf >> (64 - BITBUFSIZ)))
+
+#ifndef OFFSET_OF
+#define OFFSET_OF(TYPE, Field) ((UINT32)(size_t)&(((TYPE *)0)->Field))
+#endif
+
 //
 // C: Char&Len Set; P: Position Set; T: exTra Set
 //
@@ -55,9 +83,8 @@ typedef struct {
     UINT32  mOutBuf;
     UINT32  mInBuf;
 
-    UINT16  mBitCount;
-    UINT32  mBitBuf;
-    UINT32  mSubBitBuf;
+    UINT16  mBitCount;  // Number of valid bits in mBitBuf
+    UINT64  mBitBuf;    // Next bits of the stream, MSB-aligned
     UINT16  mBlockSize;
     UINT32  mCompSize;
     UINT32  mOrigSize;
@@ -77,57 +104,101 @@ typedef struct {
     // For Tiano de/compression algorithm, mPBit = 5
     //
     UINT8   mPBit;
+
+    //
+    // First-level lookup tables, rebuilt for every block.
+    // They must be the last fields, because they are not initialized by Decompress.
+    //
+    UINT32  mCFast[1U << CFASTBIT];
+    UINT32  mPFast[1U << PFASTBIT];
 } SCRATCH_DATA;
 
 STATIC
 VOID
-FillBuf(
-IN  SCRATCH_DATA  *Sd,
-IN  UINT16        NumOfBits
+FillBitBuf(
+IN  SCRATCH_DATA  *Sd
 )
 /*++
 
 Routine Description:
 
-Shift mBitBuf NumOfBits left. Read in NumOfBits of bits from source.
+Refill mBitBuf from source, a whole word at a time when possible.
+Past the end of source zero bits are read.
 
 Arguments:
 
 Sd        - The global scratch data
-NumOfBits  - The number of bits to shift and read.
 
 Returns: (VOID)
 
 --*/
 {
-    Sd->mBitBuf = (UINT32)(Sd->mBitBuf << NumOfBits);
-
-    while (NumOfBits > Sd->mBitCount) {
-
-        Sd->mBitBuf |= (UINT32)(Sd->mSubBitBuf << (NumOfBits = (UINT16)(NumOfBits - Sd->mBitCount)));
+    UINT8   *Src;
+    UINT64  Word;
+    UINT16  Bytes;
+
+    if (Sd->mCompSize >= 8) {
+        Src = Sd->mSrcBase + Sd->mInBuf;
+        Word = ((UINT64)Src[0] << 56) | ((UINT64)Src[1] << 48) | ((UINT64)Src[2] << 40) | ((UINT64)Src[3] << 32)
+             | ((UINT64)Src[4] << 24) | ((UINT64)Src[5] << 16) | ((UINT64)Src[6] << 8) | (UINT64)Src[7];
+        Bytes = (UINT16)((64 - Sd->mBitCount) >> 3);
+        if (Bytes < 8) {
+            Word &= ~(UINT64)0 << (64 - 8 * Bytes);
+        }
+        Sd->mBitBuf |= Word >> Sd->mBitCount;
+        Sd->mBitCount = (UINT16)(Sd->mBitCount + 8 * Bytes);
+        Sd->mInBuf += Bytes;
+        Sd->mCompSize -= Bytes;
+        return;
+    }
 
+    while (Sd->mBitCount <= 56) {
         if (Sd->mCompSize > 0) {
-            //
-            // Get 1 byte into SubBitBuf
-            //
             Sd->mCompSize--;
-            Sd->mSubBitBuf = 0;
-            Sd->mSubBitBuf = Sd->mSrcBase[Sd->mInBuf++];
-            Sd->mBitCount = 8;
-
+            Sd->mBitBuf |= (UINT64)Sd->mSrcBase[Sd->mInBuf++] << (56 - Sd->mBitCount);
         }
-        else {
-            //
-            // No more bits from the source, just pad zero bit.
-            //
-            Sd->mSubBitBuf = 0;
-            Sd->mBitCount = 8;
+        //
+        // No more bits from the source, zero bits are already there
+        //
+        Sd->mBitCount = (UINT16)(Sd->mBitCount + 8);
+    }
+}
 
-        }
+STATIC
+VOID
+FillBuf(
+IN  SCRATCH_DATA  *Sd,
+IN  UINT16        NumOfBits
+)
+/*++
+
+Routine Description:
+
+Shift mBitBuf NumOfBits left. Read in NumOfBits of bits from source.
+
+Arguments:
+
+Sd        - The global scratch data
+NumOfBits  - The number of bits to shift and read, not greater than BITBUFSIZ.
+
+Returns: (VOID)
+
+--*/
+{
+    //
+    // Corrupted code lengths may ask for more bits than mBitBuf holds at once
+    //
+    while (NumOfBits > BITBUFSIZ) {
+        FillBuf(Sd, BITBUFSIZ);
+        NumOfBits = (UINT16)(NumOfBits - BITBUFSIZ);
     }
 
+    Sd->mBitBuf <<= NumOfBits;
     Sd->mBitCount = (UINT16)(Sd->mBitCount - NumOfBits);
-    Sd->mBitBuf |= Sd->mSubBitBuf >> Sd->mBitCount;
+
+    if (Sd->mBitCount < BITBUFSIZ) {
+        FillBitBuf(Sd);
+    }
 }
 
 STATIC
@@ -157,7 +228,7 @@ The bits that are popped out.
 {
     UINT32  OutBits;
 
-    OutBits = (UINT32)(Sd->mBitBuf >> (BITBUFSIZ - NumOfBits));
+    OutBits = (UINT32)(BITBUF(Sd) >> (BITBUFSIZ - NumOfBits));
 
     FillBuf(Sd, NumOfBits);
 
@@ -330,58 +401,74 @@ BAD_TABLE - The table is corrupted.
 }
 
 STATIC
-UINT32
-DecodeP(
-IN  SCRATCH_DATA  *Sd
+VOID
+MakeFastTable(
+IN  SCRATCH_DATA  *Sd,
+IN  UINT16        NumOfChar,
+IN  UINT8         *BitLen,
+IN  UINT16        *Table,
+IN  UINT16        TableBits,
+IN  UINT16        FastBits,
+OUT UINT32        *Fast
 )
 /*++
 
 Routine Description:
 
-Decodes a position value.
+Creates wider first-level lookup table from the mapping table made by MakeTable.
+Each entry is the result of the same table lookup and tree walk that is done
+for the corresponding FastBits-wide prefix, together with the code length,
+so the decoded symbols are exactly the same as without this table.
+Prefixes that can not be resolved within FastBits are marked with FAST_SLOW.
 
 Arguments:
 
-Sd      - the global scratch data
-
-Returns:
+Sd        - The global scratch data
+NumOfChar - Number of symbols in the symbol set
+BitLen    - Code length array
+Table     - The mapping table
+TableBits - The width of the mapping table
+FastBits  - The width of the lookup table
+Fast      - The lookup table
 
-The position value decoded.
+Returns: (VOID)
 
 --*/
 {
-    UINT16  Val;
+    UINT32  Index;
     UINT32  Mask;
-    UINT32  Pos;
+    UINT16  Val;
+    UINT16  ExtraBits;
 
-    Val = Sd->mPTTable[Sd->mBitBuf >> (BITBUFSIZ - 8)];
+    ExtraBits = (UINT16)(FastBits - TableBits);
 
-    if (Val >= MAXNP) {
-        Mask = 1U << (BITBUFSIZ - 1 - 8);
+    for (Index = 0; Index < (1U << FastBits); Index++) {
+        Val = Table[Index >> ExtraBits];
+        Mask = 1U << ExtraBits;
 
-        do {
+        while (Val >= NumOfChar && (Mask >>= 1) != 0) {
+            //
+            // Tree nodes are never out of mRight and mLeft, but the stream is not trusted here
+            //
+            if (Val >= sizeof(Sd->mRight) / sizeof(UINT16)) {
+                break;
+            }
 
-            if (Sd->mBitBuf & Mask) {
+            if (Index & Mask) {
                 Val = Sd->mRight[Val];
             }
             else {
                 Val = Sd->mLeft[Val];
             }
+        }
 
-            Mask >>= 1;
-        } while (Val >= MAXNP);
-    }
-    //
-    // Advance what we have read
-    //
-    FillBuf(Sd, Sd->mPTLen[Val]);
-
-    Pos = Val;
-    if (Val > 1) {
-        Pos = (UINT32)((1U << (Val - 1)) + GetBits(Sd, (UINT16)(Val - 1)));
+        if (Val < NumOfChar) {
+            Fast[Index] = FAST_ENTRY(Val, BitLen[Val]);
+        }
+        else {
+            Fast[Index] = FAST_SLOW;
+        }
     }
-
-    return Pos;
 }
 
 STATIC
@@ -444,11 +531,11 @@ BAD_TABLE - Table is corrupted.
 
     while (Index < Number) {
 
-        CharC = (UINT16)(Sd->mBitBuf >> (BITBUFSIZ - 3));
+        CharC = (UINT16)(BITBUF(Sd) >> (BITBUFSIZ - 3));
 
         if (CharC == 7) {
             Mask = 1U << (BITBUFSIZ - 1 - 3);
-            while (Mask & Sd->mBitBuf) {
+            while (Mask & BITBUF(Sd)) {
                 Mask >>= 1;
                 CharC += 1;
             }
@@ -522,13 +609,13 @@ Returns: (VOID)
     Index = 0;
     while (Index < Number) {
 
-        CharC = Sd->mPTTable[Sd->mBitBuf >> (BITBUFSIZ - 8)];
+        CharC = Sd->mPTTable[BITBUF(Sd) >> (BITBUFSIZ - 8)];
         if (CharC >= NT) {
             Mask = 1U << (BITBUFSIZ - 1 - 8);
 
             do {
 
-                if (Mask & Sd->mBitBuf) {
+                if (Mask & BITBUF(Sd)) {
                     CharC = Sd->mRight[CharC];
                 }
                 else {
@@ -579,14 +666,14 @@ Returns: (VOID)
 
 STATIC
 UINT16
-DecodeC(
-SCRATCH_DATA  *Sd
+ReadBlockHeader(
+IN  SCRATCH_DATA  *Sd
 )
 /*++
 
 Routine Description:
 
-Decode a character/length value.
+Reads block size and code length tables of a new block and builds lookup tables.
 
 Arguments:
 
@@ -594,56 +681,48 @@ Sd    - The global scratch data.
 
 Returns:
 
-The value decoded.
+0         - OK.
+BAD_TABLE - The table is corrupted.
 
 --*/
 {
-    UINT16  Index2;
-    UINT32  Mask;
-
-    if (Sd->mBlockSize == 0) {
-        //
-        // Starting a new block
-        //
-        Sd->mBlockSize = (UINT16)GetBits(Sd, 16);
-        Sd->mBadTableFlag = ReadPTLen(Sd, NT, TBIT, 3);
-        if (Sd->mBadTableFlag != 0) {
-            return 0;
-        }
-
-        ReadCLen(Sd);
-
-        Sd->mBadTableFlag = ReadPTLen(Sd, MAXNP, Sd->mPBit, (UINT16)(-1));
-        if (Sd->mBadTableFlag != 0) {
-            return 0;
-        }
+    Sd->mBlockSize = (UINT16)GetBits(Sd, 16);
+    Sd->mBadTableFlag = ReadPTLen(Sd, NT, TBIT, 3);
+    if (Sd->mBadTableFlag != 0) {
+        return Sd->mBadTableFlag;
     }
 
-    Sd->mBlockSize--;
-    Index2 = Sd->mCTable[Sd->mBitBuf >> (BITBUFSIZ - 12)];
-
-    if (Index2 >= NC) {
-        Mask = 1U << (BITBUFSIZ - 1 - 12);
-
-        do {
-            if (Sd->mBitBuf & Mask) {
-                Index2 = Sd->mRight[Index2];
-            }
-            else {
-                Index2 = Sd->mLeft[Index2];
-            }
+    ReadCLen(Sd);
 
-            Mask >>= 1;
-        } while (Index2 >= NC);
+    Sd->mBadTableFlag = ReadPTLen(Sd, MAXNP, Sd->mPBit, (UINT16)(-1));
+    if (Sd->mBadTableFlag != 0) {
+        return Sd->mBadTableFlag;
     }
-    //
-    // Advance what we have read
-    //
-    FillBuf(Sd, Sd->mCLen[Index2]);
 
-    return Index2;
+    MakeFastTable(Sd, NC, Sd->mCLen, Sd->mCTable, 12, CFASTBIT, Sd->mCFast);
+    MakeFastTable(Sd, MAXNP, Sd->mPTLen, Sd->mPTTable, 8, PFASTBIT, Sd->mPFast);
+
+    return 0;
 }
 
+//
+// Bit window helpers for Decode, which keeps mBitBuf and mBitCount in local variables
+//
+#define DECODE_PEEK(NumOfBits) ((UINT32)(BitBuf >> (64 - (NumOfBits))))
+
+#define DECODE_DROP(NumOfBits) \
+    do { \
+        BitBuf <<= (NumOfBits); \
+        BitCount -= (NumOfBits); \
+        if (BitCount < BITBUFSIZ) { \
+            Sd->mBitBuf = BitBuf; \
+            Sd->mBitCount = (UINT16)BitCount; \
+            FillBitBuf(Sd); \
+            BitBuf = Sd->mBitBuf; \
+            BitCount = Sd->mBitCount; \
+        } \
+    } while (0)
+
 STATIC
 VOID
 Decode(
@@ -655,6 +734,10 @@ Routine Description:
 
 Decode the source data and put the resulting data into the destination buffer.
 
+Character/length and position values are decoded inline. Almost all of them
+are resolved by a single lookup in mCFast and mPFast, the rest are decoded
+by walking the Huffman tree exactly as before.
+
 Arguments:
 
 Sd            - The global scratch data
@@ -663,55 +746,162 @@ Returns: (VOID)
 
 --*/
 {
-    UINT16  BytesRemain;
-    UINT32  DataIdx;
+    UINT64  BitBuf;
+    UINT32  BitCount;
+    UINT8   *Dst;
+    UINT32  OutBuf;
+    UINT32  OrigSize;
+    UINT16  BlockSize;
+    UINT32  Entry;
+    UINT32  Mask;
     UINT16  CharC;
+    UINT16  Val;
+    UINT32  Pos;
+    UINT32  DataIdx;
+    UINT32  BytesRemain;
 
-    BytesRemain = (UINT16)(-1);
-
-    DataIdx = 0;
+    Dst = Sd->mDstBase;
+    OutBuf = Sd->mOutBuf;
+    OrigSize = Sd->mOrigSize;
+    BlockSize = Sd->mBlockSize;
+    BitBuf = Sd->mBitBuf;
+    BitCount = Sd->mBitCount;
 
     for (;;) {
-        CharC = DecodeC(Sd);
-        if (Sd->mBadTableFlag != 0) {
-            return;
-        }
-
-        if (CharC < 256) {
+        if (BlockSize == 0) {
             //
-            // Process an Original character
+            // Starting a new block
             //
-            if (Sd->mOutBuf >= Sd->mOrigSize) {
-                return;
+            Sd->mBitBuf = BitBuf;
+            Sd->mBitCount = (UINT16)BitCount;
+            if (ReadBlockHeader(Sd) != 0) {
+                break;
             }
-            else {
-                Sd->mDstBase[Sd->mOutBuf++] = (UINT8)CharC;
+            BitBuf = Sd->mBitBuf;
+            BitCount = Sd->mBitCount;
+            BlockSize = Sd->mBlockSize;
+        }
+
+        //
+        // Decode a character/length value
+        //
+        BlockSize--;
+        Entry = Sd->mCFast[DECODE_PEEK(CFASTBIT)];
+
+        if (Entry & FAST_SLOW) {
+            CharC = Sd->mCTable[DECODE_PEEK(12)];
+
+            if (CharC >= NC) {
+                Mask = 1U << (BITBUFSIZ - 1 - 12);
+
+                do {
+                    if (DECODE_PEEK(BITBUFSIZ) & Mask) {
+                        CharC = Sd->mRight[CharC];
+                    }
+                    else {
+                        CharC = Sd->mLeft[CharC];
+                    }
+
+                    Mask >>= 1;
+                } while (CharC >= NC);
             }
 
+            DECODE_DROP(Sd->mCLen[CharC]);
         }
         else {
+            CharC = FAST_SYMBOL(Entry);
+            DECODE_DROP(FAST_LENGTH(Entry));
+        }
+
+        //
+        // Decompressed data is complete
+        //
+        if (OutBuf >= OrigSize) {
+            break;
+        }
+
+        if (CharC < 256) {
             //
-            // Process a Pointer
+            // Process an Original character
             //
-            CharC = (UINT16)(CharC - (UINT8_MAX + 1 - THRESHOLD));
+            Dst[OutBuf++] = (UINT8)CharC;
+            continue;
+        }
 
-            BytesRemain = CharC;
+        //
+        // Process a Pointer, decode a position value first
+        //
+        BytesRemain = (UINT32)(CharC - (UINT8_MAX + 1 - THRESHOLD));
+        Entry = Sd->mPFast[DECODE_PEEK(PFASTBIT)];
 
-            DataIdx = Sd->mOutBuf - DecodeP(Sd) - 1;
+        if (Entry & FAST_SLOW) {
+            Val = Sd->mPTTable[DECODE_PEEK(8)];
 
-            BytesRemain--;
-            while ((INT16)(BytesRemain) >= 0) {
-                Sd->mDstBase[Sd->mOutBuf++] = Sd->mDstBase[DataIdx++];
-                if (Sd->mOutBuf >= Sd->mOrigSize) {
-                    return;
-                }
+            if (Val >= MAXNP) {
+                Mask = 1U << (BITBUFSIZ - 1 - 8);
+
+                do {
+                    if (DECODE_PEEK(BITBUFSIZ) & Mask) {
+                        Val = Sd->mRight[Val];
+                    }
+                    else {
+                        Val = Sd->mLeft[Val];
+                    }
 
-                BytesRemain--;
+                    Mask >>= 1;
+                } while (Val >= MAXNP);
             }
+
+            DECODE_DROP(Sd->mPTLen[Val]);
+        }
+        else {
+            Val = FAST_SYMBOL(Entry);
+            DECODE_DROP(FAST_LENGTH(Entry));
+        }
+
+        Pos = Val;
+        if (Val > 1) {
+            Pos = (UINT32)((1U << (Val - 1)) + DECODE_PEEK(Val - 1));
+            DECODE_DROP(Val - 1);
+        }
+
+        if (Pos >= OutBuf) {
+            //
+            // Pointer is out of decompressed data, the source is corrupted
+            //
+            Sd->mBadTableFlag = (UINT16)BAD_TABLE;
+            break;
+        }
+        DataIdx = OutBuf - Pos - 1;
+
+        //
+        // Copy the match, overlapping matches must be copied byte by byte
+        //
+        if (BytesRemain > OrigSize - OutBuf) {
+            BytesRemain = OrigSize - OutBuf;
+        }
+        if (OutBuf - DataIdx >= BytesRemain) {
+            memcpy(Dst + OutBuf, Dst + DataIdx, BytesRemain);
+            OutBuf += BytesRemain;
+        }
+        else {
+            while (BytesRemain-- > 0) {
+                Dst[OutBuf++] = Dst[DataIdx++];
+            }
+        }
+
+        if (OutBuf >= OrigSize) {
+            break;
         }
     }
+
+    Sd->mOutBuf = OutBuf;
+    Sd->mBlockSize = BlockSize;
+    Sd->mBitBuf = BitBuf;
+    Sd->mBitCount = (UINT16)BitCount;
 }
 
+
 EFI_STATUS
 GetInfo(
 IN      VOID    *Source,
@@ -829,7 +1019,7 @@ EFI_INVALID_PARAMETER - The source data is corrupted
 
     Src = Src + 8;
 
-    for (Index = 0; Index < sizeof(SCRATCH_DATA); Index++) {
+    for (Index = 0; Index < OFFSET_OF(SCRATCH_DATA, mCFast); Index++) {
         ((UINT8 *)Sd)[Index] = 0;
     }
     //
@@ -861,7 +1051,7 @@ EFI_INVALID_PARAMETER - The source data is corrupted
     //
     // Fill the first BITBUFSIZ bits
     //
-    FillBuf(Sd, BITBUFSIZ);
+    FillBitBuf(Sd);
 
     //
     // Decompress it
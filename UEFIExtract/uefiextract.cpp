@@ -24,7 +24,7 @@ UEFIExtract::~UEFIExtract()
     delete ffsEngine;
 }
 
-UINT8 UEFIExtract::extractAll(QString path)
+UINT8 UEFIExtract::extractAll(QString path, const UINT8 layout, const ItemFilter & filter)
 {
     QFileInfo fileInfo = QFileInfo(path);
 
@@ -40,12 +40,13 @@ UINT8 UEFIExtract::extractAll(QString path)
     QByteArray buffer = inputFile.readAll();
     inputFile.close();
 
+    ffsEngine->setParseFilter(filter);
     UINT8 result = ffsEngine->parseImageFile(buffer);
     if (result)
         return result;
 
     QModelIndex rootIndex = ffsEngine->treeModel()->index(0, 0);
-    result = ffsEngine->dump(rootIndex, fileInfo.fileName().append(".dump"));
+    result = ffsEngine->dump(rootIndex, fileInfo.fileName().append(".dump"), layout, filter);
     if (result)
         return result;
 
@@ -31,7 +31,8 @@ public:
     explicit UEFIExtract(QObject *parent = 0);
     ~UEFIExtract();
 
-    UINT8 extractAll(QString path);
+    // Items not selected by filter are not dumped, nor decompressed when possible
+    UINT8 extractAll(QString path, const UINT8 layout = DUMP_LAYOUT_TREE, const ItemFilter & filter = ItemFilter());
 
 private:
     FfsEngine* ffsEngine;
@@ -13,6 +13,7 @@ WITHOUT WARRANTIES OR REPRESENTATIONS OF ANY KIND, EITHER EXPRESS OR IMPLIED.
 #include <QCoreApplication>
 #include <QString>
 #include <QStringList>
+#include <QUuid>
 #include <iostream>
 #include "uefiextract.h"
 
@@ -25,11 +26,45 @@ int main(int argc, char *argv[])
 
     UEFIExtract w;
     UINT8 result = ERR_SUCCESS;
-    if (a.arguments().length() > 1) {
-        result = w.extractAll(a.arguments().at(1));
+    UINT32 argumentsCount = a.arguments().length();
+
+    // Options go before image file, filter values can be comma-separated lists
+    UINT8 layout = DUMP_LAYOUT_TREE;
+    ItemFilter filter;
+    bool valid = argumentsCount > 1 && !a.arguments().last().startsWith("-");
+    for (UINT32 i = 1; valid && i < argumentsCount - 1; i++) {
+        QString argument = a.arguments().at(i);
+        if (argument == "-d")
+            layout = DUMP_LAYOUT_DEDUPLICATED;
+        else if (argument == "-a")
+            layout = DUMP_LAYOUT_ARCHIVE;
+        else if ((argument == "-g" || argument == "-t" || argument == "-s" || argument == "-n") && i + 1 < argumentsCount - 1) {
+            QStringList values = a.arguments().at(++i).split(',');
+            for (int j = 0; valid && j < values.size(); j++) {
+                bool converted = true;
+                if (argument == "-g") {
+                    QUuid uuid = QUuid(values.at(j));
+                    converted = !uuid.isNull();
+                    filter.guids.append(QByteArray((const char*)&uuid.data1, sizeof(EFI_GUID)));
+                }
+                else if (argument == "-t")
+                    filter.fileTypes.append((UINT8)values.at(j).toUShort(&converted, 16));
+                else if (argument == "-s")
+                    filter.sectionTypes.append((UINT8)values.at(j).toUShort(&converted, 16));
+                else
+                    filter.names.append(values.at(j));
+                valid = converted;
+            }
+        }
+        else
+            valid = false;
+    }
+
+    if (valid) {
+        result = w.extractAll(a.arguments().last(), layout, filter);
         switch (result) {
         case ERR_DIR_ALREADY_EXIST:
-            std::cout << "Dump directory already exist, please remove it" << std::endl;
+            std::cout << "Dump directory or archive already exist, please remove it" << std::endl;
             break;
         case ERR_DIR_CREATE:
             std::cout << "Can't create directory" << std::endl;
@@ -37,12 +72,25 @@ int main(int argc, char *argv[])
         case ERR_FILE_OPEN:
             std::cout << "Can't create file" << std::endl;
             break;
+        case ERR_FILE_WRITE:
+            std::cout << "Can't write file" << std::endl;
+            break;
+        case ERR_ITEM_NOT_FOUND:
+            std::cout << "No items match the filter" << std::endl;
+            break;
         }
     }
     else {
         result = ERR_INVALID_PARAMETER;
         std::cout << "UEFIExtract 0.2.1" << std::endl << std::endl << 
-            "Usage: uefiextract imagefile\n" << std::endl;
+            "Usage: uefiextract [-d|-a] [-g guids] [-t file_types] [-s section_types] [-n names] imagefile" << std::endl << std::endl <<
+            "With -d every unique header and body is stored once in blobs directory of the dump,\n" <<
+            "files in item directories are hard links to them\n" <<
+            "With -a the dump is written to imagefile.dump.tar with table of contents in toc.txt\n" <<
+            "With -g, -t and -n only files with given GUIDs, hex types and names are dumped,\n" <<
+            "names are wildcards matched against file text or GUID\n" <<
+            "With -s only sections of given hex types are dumped from files matching other options\n" <<
+            "Lists are comma-separated, compressed sections of other files are not decompressed\n" << std::endl;
     }
         
     return result;
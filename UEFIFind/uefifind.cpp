@@ -0,0 +1,101 @@
+/* uefifind.cpp
+
+Copyright (c) 2014, Nikolaj Schlej. All rights reserved.
+This program and the accompanying materials
+are licensed and made available under the terms and conditions of the BSD License
+which accompanies this distribution.  The full text of the license may be found at
+http://opensource.org/licenses/bsd-license.php
+
+THE PROGRAM IS DISTRIBUTED UNDER THE BSD LICENSE ON AN "AS IS" BASIS,
+WITHOUT WARRANTIES OR REPRESENTATIONS OF ANY KIND, EITHER EXPRESS OR IMPLIED.
+
+*/
+
+#include <iostream>
+
+#include "uefifind.h"
+
+UEFIFind::UEFIFind(QObject *parent) :
+    QObject(parent)
+{
+    ffsEngine = new FfsEngine(this);
+    model = ffsEngine->treeModel();
+}
+
+UEFIFind::~UEFIFind()
+{
+    delete ffsEngine;
+}
+
+UINT8 UEFIFind::findFromFile(QString path, QString patternsPath, const UINT8 mode)
+{
+    PatternSet patterns;
+    UINT8 result = patterns.loadFromFile(patternsPath);
+    if (result)
+        return result;
+    if (patterns.isEmpty())
+        return ERR_INVALID_FILE;
+
+    QFileInfo fileInfo = QFileInfo(path);
+    if (!fileInfo.exists())
+        return ERR_FILE_OPEN;
+
+    QFile inputFile;
+    inputFile.setFileName(path);
+
+    if (!inputFile.open(QFile::ReadOnly))
+        return ERR_FILE_READ;
+
+    QByteArray buffer = inputFile.readAll();
+    inputFile.close();
+
+    result = ffsEngine->parseImageFile(buffer);
+    if (result)
+        return result;
+
+    // Search for all patterns at once
+    QVector<SearchResult> results;
+    result = ffsEngine->findPatterns(model->index(0, 0), patterns, mode, results);
+    if (result)
+        return result;
+    if (results.isEmpty())
+        return ERR_ITEM_NOT_FOUND;
+
+    // Report matches grouped by pattern
+    QVector<QVector<int> > byPattern(patterns.count());
+    for (int i = 0; i < results.size(); i++)
+        byPattern[results.at(i).pattern].append(i);
+
+    for (int i = 0; i < patterns.count(); i++) {
+        if (byPattern.at(i).isEmpty())
+            continue;
+
+        std::cout << patterns.name(i).toLatin1().constData() << " (" << patterns.hexPattern(i).constData() << "): "
+            << byPattern.at(i).size() << (byPattern.at(i).size() == 1 ? " match" : " matches") << std::endl;
+        for (int j = 0; j < byPattern.at(i).size(); j++) {
+            const SearchResult & found = results.at(byPattern.at(i).at(j));
+            QString line = tr("    %1 at %2-offset %3")
+                .arg(itemPath(found.index))
+                .arg(found.mode == SEARCH_MODE_BODY ? tr("body") : tr("header"))
+                .arg(found.offset, 8, 16, QChar('0'));
+
+            // Add location in image or in decompressed data
+            QString location = ffsEngine->provenanceString(found.index, found.itemOffset);
+            if (!location.isEmpty())
+                line += tr(", %1").arg(location);
+            std::cout << line.toLatin1().constData() << std::endl;
+        }
+    }
+
+    return ERR_SUCCESS;
+}
+
+QString UEFIFind::itemPath(const QModelIndex & index)
+{
+    QString path;
+    for (QModelIndex current = index; current.isValid(); current = current.parent()) {
+        QString name = model->textString(current).isEmpty() ? model->nameString(current) : model->textString(current);
+        path = path.isEmpty() ? name : name + " / " + path;
+    }
+    return path;
+}
@@ -0,0 +1,43 @@
+/* uefifind.h
+
+Copyright (c) 2014, Nikolaj Schlej. All rights reserved.
+This program and the accompanying materials
+are licensed and made available under the terms and conditions of the BSD License
+which accompanies this distribution.  The full text of the license may be found at
+http://opensource.org/licenses/bsd-license.php
+
+THE PROGRAM IS DISTRIBUTED UNDER THE BSD LICENSE ON AN "AS IS" BASIS,
+WITHOUT WARRANTIES OR REPRESENTATIONS OF ANY KIND, EITHER EXPRESS OR IMPLIED.
+
+*/
+
+#ifndef __UEFIFIND_H__
+#define __UEFIFIND_H__
+
+#include <QObject>
+#include <QByteArray>
+#include <QString>
+#include <QFileInfo>
+#include <QVector>
+
+#include "../basetypes.h"
+#include "../ffsengine.h"
+#include "../patternset.h"
+
+class UEFIFind : public QObject
+{
+    Q_OBJECT
+
+public:
+    explicit UEFIFind(QObject *parent = 0);
+    ~UEFIFind();
+
+    UINT8 findFromFile(QString path, QString patternsPath, const UINT8 mode);
+
+private:
+    QString itemPath(const QModelIndex & index);
+    FfsEngine* ffsEngine;
+    TreeModel* model;
+};
+
+#endif
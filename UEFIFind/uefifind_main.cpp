@@ -0,0 +1,77 @@
+/* uefifind_main.cpp
+
+Copyright (c) 2014, Nikolaj Schlej. All rights reserved.
+This program and the accompanying materials
+are licensed and made available under the terms and conditions of the BSD License
+which accompanies this distribution.  The full text of the license may be found at
+http://opensource.org/licenses/bsd-license.php
+
+THE PROGRAM IS DISTRIBUTED UNDER THE BSD LICENSE ON AN "AS IS" BASIS,
+WITHOUT WARRANTIES OR REPRESENTATIONS OF ANY KIND, EITHER EXPRESS OR IMPLIED.
+
+*/
+#include <QCoreApplication>
+#include <QString>
+#include <QStringList>
+#include <iostream>
+#include "uefifind.h"
+
+int main(int argc, char *argv[])
+{
+    QCoreApplication a(argc, argv);
+    a.setOrganizationName("CodeRush");
+    a.setOrganizationDomain("coderush.me");
+    a.setApplicationName("UEFIFind");
+
+    UEFIFind w;
+    UINT8 result = ERR_SUCCESS;
+    UINT32 argumentsCount = a.arguments().length();
+    UINT8 mode = SEARCH_MODE_ALL;
+
+    if (argumentsCount == 4) {
+        if (a.arguments().at(3) == QString("header"))
+            mode = SEARCH_MODE_HEADER;
+        else if (a.arguments().at(3) == QString("body"))
+            mode = SEARCH_MODE_BODY;
+        else if (a.arguments().at(3) != QString("all"))
+            argumentsCount = 0;
+    }
+
+    if (argumentsCount == 3 || argumentsCount == 4) {
+        result = w.findFromFile(a.arguments().at(1), a.arguments().at(2), mode);
+    }
+    else {
+        std::cout << "UEFIFind 0.1.0 - UEFI image file multi-pattern search utility" << std::endl << std::endl <<
+            "Usage: UEFIFind image_file patterns_file [header|body|all]" << std::endl << std::endl <<
+            "Patterns file has one hex pattern per line, optionally followed by its name." << std::endl <<
+            "Dots in patterns match any nibble, lines starting with # are ignored." << std::endl;
+        return ERR_SUCCESS;
+    }
+
+    switch (result) {
+    case ERR_SUCCESS:
+        break;
+    case ERR_ITEM_NOT_FOUND:
+        std::cout << "No patterns found" << std::endl;
+        break;
+    case ERR_INVALID_PARAMETER:
+        std::cout << "Function called with invalid parameter" << std::endl;
+        break;
+    case ERR_INVALID_SYMBOL:
+        std::cout << "Pattern format mismatch" << std::endl;
+        break;
+    case ERR_INVALID_FILE:
+        std::cout << "Patterns file not found, can't be read or has no patterns" << std::endl;
+        break;
+    case ERR_FILE_OPEN:
+        std::cout << "Input file not found" << std::endl;
+        break;
+    case ERR_FILE_READ:
+        std::cout << "Input file can't be read" << std::endl;
+        break;
+    default:
+        std::cout << "Error " << result << std::endl;
+    }
+
+    return result;
+}
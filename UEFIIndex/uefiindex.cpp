@@ -0,0 +1,702 @@
+/* uefiindex.cpp
+
+Copyright (c) 2014, Nikolaj Schlej. All rights reserved.
+This program and the accompanying materials
+are licensed and made available under the terms and conditions of the BSD License
+which accompanies this distribution.  The full text of the license may be found at
+http://opensource.org/licenses/bsd-license.php
+
+THE PROGRAM IS DISTRIBUTED UNDER THE BSD LICENSE ON AN "AS IS" BASIS,
+WITHOUT WARRANTIES OR REPRESENTATIONS OF ANY KIND, EITHER EXPRESS OR IMPLIED.
+
+*/
+
+#include <iostream>
+#include <string.h>
+
+#include <QCryptographicHash>
+#include <QDirIterator>
+#include <QFileInfo>
+#include <QtAlgorithms>
+
+#include "uefiindex.h"
+
+// Segment is written when this many trigram and payload pairs are collected, about 512 Mb of memory
+#define INDEX_SEGMENT_PAIRS 0x4000000
+
+// Postings are written to file in blocks of this size
+#define INDEX_WRITE_BLOCK_SIZE 0x100000
+
+// Index segment mapped to memory for lookups
+struct IndexSegment {
+    QFile grams;
+    QFile postings;
+    const INDEX_GRAM_RECORD* records;
+    UINT32 count;
+    const UINT8* data;
+    UINT64 size;
+};
+
+static UINT8 mapSegment(const QDir & indexDir, const UINT32 number, IndexSegment* segment)
+{
+    segment->grams.setFileName(indexDir.filePath(QString("grams.%1").arg(number)));
+    segment->postings.setFileName(indexDir.filePath(QString("postings.%1").arg(number)));
+    if (!segment->grams.open(QFile::ReadOnly) || !segment->postings.open(QFile::ReadOnly))
+        return ERR_FILE_OPEN;
+    segment->count = segment->grams.size() / sizeof(INDEX_GRAM_RECORD);
+    segment->size = segment->postings.size();
+    segment->records = (const INDEX_GRAM_RECORD*)(segment->count ? segment->grams.map(0, segment->grams.size()) : NULL);
+    segment->data = segment->size ? segment->postings.map(0, segment->size) : NULL;
+    if ((segment->count && !segment->records) || (segment->size && !segment->data))
+        return ERR_FILE_READ;
+    return ERR_SUCCESS;
+}
+
+static bool isCommittedSegment(const IndexSegment* segment, const UINT32 blobCount)
+{
+    // Segment is written completely before payloads of its postings are committed to blob table,
+    // so postings of an interrupted commit have payload numbers not in the table
+    if (!segment->count || segment->grams.size() % sizeof(INDEX_GRAM_RECORD))
+        return false;
+    for (UINT32 i = 0; i < segment->count; i++) {
+        // First payload number of every list is stored as is, later ones are larger
+        UINT64 position = segment->records[i].Offset;
+        UINT32 blob = 0;
+        for (UINT32 shift = 0; shift < 32; shift += 7) {
+            if (position >= segment->size)
+                return false;
+            UINT8 byte = segment->data[position++];
+            blob |= (UINT32)(byte & 0x7F) << shift;
+            if (!(byte & 0x80))
+                break;
+        }
+        if (blob >= blobCount)
+            return false;
+    }
+    return true;
+}
+
+UEFIIndex::UEFIIndex(QObject *parent) :
+    QObject(parent), blobsSize(0), imageCount(0), blobCount(0), segmentCount(0)
+{
+}
+
+UEFIIndex::~UEFIIndex()
+{
+}
+
+UINT8 UEFIIndex::addToIndex(QString indexPath, QStringList paths)
+{
+    UINT8 result = openIndex(indexPath);
+    if (result)
+        return result;
+
+    // Expand directories to image files in them
+    QStringList files;
+    for (int i = 0; i < paths.count(); i++) {
+        QFileInfo fileInfo(paths.at(i));
+        if (fileInfo.isDir()) {
+            QDirIterator it(paths.at(i), QDir::Files, QDirIterator::Subdirectories);
+            while (it.hasNext())
+                files.append(it.next());
+        }
+        else
+            files.append(paths.at(i));
+    }
+
+    for (int i = 0; i < files.count(); i++) {
+        QString path = QFileInfo(files.at(i)).absoluteFilePath();
+        if (imagePaths.contains(path)) {
+            std::cout << path.toLocal8Bit().constData() << ": already indexed" << std::endl;
+            continue;
+        }
+
+        UINT32 payloads = 0;
+        result = addImage(path, payloads);
+        // Write errors stop indexing, other errors only skip the image
+        if (result == ERR_FILE_WRITE) {
+            closeIndex();
+            return result;
+        }
+        if (result)
+            std::cout << path.toLocal8Bit().constData() << ": skipped, error " << (int)result << std::endl;
+        else
+            std::cout << path.toLocal8Bit().constData() << ": " << payloads << " payloads" << std::endl;
+    }
+
+    return closeIndex();
+}
+
+UINT8 UEFIIndex::openIndex(const QString & indexPath)
+{
+    if (!QDir().mkpath(indexPath))
+        return ERR_DIR_CREATE;
+    indexDir = QDir(indexPath);
+
+    // Read paths of already indexed images
+    imagePaths.clear();
+    imagesFile.setFileName(indexDir.filePath("images"));
+    if (imagesFile.exists()) {
+        if (!imagesFile.open(QFile::ReadOnly))
+            return ERR_FILE_OPEN;
+        QStringList list = QString::fromUtf8(imagesFile.readAll()).split('\n', QString::SkipEmptyParts);
+        imagesFile.close();
+        for (int i = 0; i < list.count(); i++)
+            imagePaths.insert(list.at(i));
+        imageCount = list.count();
+    }
+    else
+        imageCount = 0;
+
+    // Entries of an image are committed before its path, so entries of an interrupted commit are dropped
+    entriesFile.setFileName(indexDir.filePath("entries"));
+    if (entriesFile.exists()) {
+        if (!entriesFile.open(QFile::ReadWrite))
+            return ERR_FILE_OPEN;
+        UINT64 size = entriesFile.size();
+        const UINT8* entries = size ? entriesFile.map(0, size) : NULL;
+        if (size && !entries) {
+            entriesFile.close();
+            return ERR_FILE_READ;
+        }
+        UINT64 position = 0;
+        while (position + sizeof(INDEX_ENTRY_HEADER) <= size) {
+            const INDEX_ENTRY_HEADER* header = (const INDEX_ENTRY_HEADER*)(entries + position);
+            if (header->Image >= imageCount || position + sizeof(INDEX_ENTRY_HEADER) + header->StringsSize > size)
+                break;
+            position += sizeof(INDEX_ENTRY_HEADER) + header->StringsSize;
+        }
+        if (entries)
+            entriesFile.unmap((uchar*)entries);
+        bool truncated = (position == size || entriesFile.resize(position));
+        entriesFile.close();
+        if (!truncated)
+            return ERR_FILE_WRITE;
+    }
+
+    // Read hashes of already indexed payloads
+    blobHashes.clear();
+    blobCount = 0;
+    blobTableFile.setFileName(indexDir.filePath("blobtable"));
+    if (blobTableFile.exists()) {
+        if (!blobTableFile.open(QFile::ReadWrite))
+            return ERR_FILE_OPEN;
+        QByteArray table = blobTableFile.readAll();
+        if (!table.startsWith(INDEX_SIGNATURE)) {
+            blobTableFile.close();
+            return ERR_INVALID_FILE;
+        }
+
+        // Partially written record of an interrupted commit is dropped
+        const INDEX_BLOB_RECORD* records = (const INDEX_BLOB_RECORD*)(table.constData() + INDEX_SIGNATURE_SIZE);
+        blobCount = (table.size() - INDEX_SIGNATURE_SIZE) / sizeof(INDEX_BLOB_RECORD);
+        UINT64 tableSize = INDEX_SIGNATURE_SIZE + (UINT64)blobCount * sizeof(INDEX_BLOB_RECORD);
+        bool truncated = (tableSize == (UINT64)table.size() || blobTableFile.resize(tableSize));
+        blobTableFile.close();
+        if (!truncated)
+            return ERR_FILE_WRITE;
+        for (UINT32 i = 0; i < blobCount; i++)
+            blobHashes.insert(QByteArray((const char*)records[i].Sha1, sizeof(records[i].Sha1)), i);
+    }
+
+    blobsFile.setFileName(indexDir.filePath("blobs"));
+    if (!imagesFile.open(QFile::WriteOnly | QFile::Append)
+        || !blobTableFile.open(QFile::WriteOnly | QFile::Append)
+        || !blobsFile.open(QFile::WriteOnly | QFile::Append)
+        || !entriesFile.open(QFile::WriteOnly | QFile::Append)) {
+        closeIndex();
+        return ERR_FILE_OPEN;
+    }
+    if (!blobCount && blobTableFile.write(INDEX_SIGNATURE, INDEX_SIGNATURE_SIZE) != INDEX_SIGNATURE_SIZE) {
+        closeIndex();
+        return ERR_FILE_WRITE;
+    }
+    blobsSize = blobsFile.size();
+
+    // New segment is added after existing ones
+    segmentCount = 0;
+    while (QFile::exists(indexDir.filePath(QString("grams.%1").arg(segmentCount))))
+        segmentCount++;
+
+    // Only the last segment can be left by an interrupted commit, its payload numbers are given out again
+    if (segmentCount) {
+        IndexSegment* segment = new IndexSegment;
+        UINT8 result = mapSegment(indexDir, segmentCount - 1, segment);
+        bool committed = (!result && isCommittedSegment(segment, blobCount));
+        delete segment;
+        if (result) {
+            closeIndex();
+            return result;
+        }
+        if (!committed) {
+            segmentCount--;
+            if (!QFile::remove(indexDir.filePath(QString("grams.%1").arg(segmentCount)))
+                || !QFile::remove(indexDir.filePath(QString("postings.%1").arg(segmentCount)))) {
+                closeIndex();
+                return ERR_FILE_WRITE;
+            }
+        }
+    }
+
+    pairs.clear();
+    pendingBlobs.clear();
+    pendingEntries.clear();
+    pendingImages.clear();
+    imageEntries.clear();
+    seenGrams.fill(0, 1 << 19);
+    return ERR_SUCCESS;
+}
+
+UINT8 UEFIIndex::closeIndex()
+{
+    UINT8 result = writeSegment();
+
+    imagesFile.close();
+    blobsFile.close();
+    blobTableFile.close();
+    entriesFile.close();
+    seenGrams.clear();
+    return result;
+}
+
+UINT8 UEFIIndex::addImage(const QString & path, UINT32 & payloads)
+{
+    QFile inputFile;
+    inputFile.setFileName(path);
+    if (!inputFile.open(QFile::ReadOnly))
+        return ERR_FILE_OPEN;
+
+    QByteArray buffer = inputFile.readAll();
+    inputFile.close();
+
+    // New engine is used for every image, like for every file opened in UEFITool
+    FfsEngine ffsEngine;
+    UINT8 result = ffsEngine.parseImageFile(buffer);
+    if (result)
+        return result;
+
+    imageEntries.clear();
+    result = collectPayloads(&ffsEngine, ffsEngine.treeModel()->index(0, 0), QModelIndex(), imageCount, payloads);
+    if (result) {
+        imageEntries.clear();
+        return result;
+    }
+
+    // Image is committed with the next segment
+    pendingEntries.append(imageEntries);
+    imageEntries.clear();
+    pendingImages.append(path.toUtf8()).append('\n');
+    imagePaths.insert(path);
+    imageCount++;
+    return ERR_SUCCESS;
+}
+
+UINT8 UEFIIndex::collectPayloads(FfsEngine* engine, const QModelIndex & index, const QModelIndex & file, const UINT32 image, UINT32 & payloads)
+{
+    if (!index.isValid())
+        return ERR_SUCCESS;
+
+    TreeModel* model = engine->treeModel();
+    UINT8 result;
+    QModelIndex current = file;
+    // Raw body of the file
+    if (model->type(index) == Types::File) {
+        current = index;
+        result = addPayload(image, model->nameString(index), model->textString(index), tr("raw"), model->body(index));
+        if (result)
+            return result;
+        payloads++;
+    }
+    // Decompressed data of compressed section, including alignment of its child sections
+    else if (current.isValid() && model->type(index) == Types::Section
+        && model->compression(index) != COMPRESSION_ALGORITHM_NONE && model->rowCount(index) > 0) {
+        QByteArray decompressed;
+        result = engine->extract(index, decompressed, EXTRACT_MODE_BODY);
+        if (result)
+            return result;
+        result = addPayload(image, model->nameString(current), model->textString(current), tr("decompressed"), decompressed);
+        if (result)
+            return result;
+        payloads++;
+    }
+
+    for (int i = 0; i < model->rowCount(index); i++) {
+        result = collectPayloads(model, index.child(i, 0), current, image, payloads);
+        if (result)
+            return result;
+    }
+
+    return ERR_SUCCESS;
+}
+
+UINT8 UEFIIndex::addPayload(const UINT32 image, const QString & guid, const QString & text, const QString & kind, const QByteArray & data)
+{
+    if (data.isEmpty())
+        return ERR_SUCCESS;
+
+    // Same payloads from different images are stored and indexed once
+    QByteArray hash = QCryptographicHash::hash(data, QCryptographicHash::Sha1);
+    UINT32 blob;
+    if (blobHashes.contains(hash))
+        blob = blobHashes.value(hash);
+    else {
+        INDEX_BLOB_RECORD record;
+        record.Offset = blobsSize;
+        record.Size = data.size();
+        memcpy(record.Sha1, hash.constData(), sizeof(record.Sha1));
+        if (blobsFile.write(data) != data.size())
+            return ERR_FILE_WRITE;
+        pendingBlobs.append((const char*)&record, sizeof(record));
+        blobsSize += data.size();
+
+        blob = blobCount++;
+        blobHashes.insert(hash, blob);
+        addGrams(data, blob);
+        if (pairs.size() >= INDEX_SEGMENT_PAIRS) {
+            UINT8 result = writeSegment();
+            if (result)
+                return result;
+        }
+    }
+
+    QByteArray strings;
+    strings.append(guid.toUtf8()).append('\0').append(text.toUtf8()).append('\0').append(kind.toUtf8()).append('\0');
+    INDEX_ENTRY_HEADER header;
+    header.Image = image;
+    header.Blob = blob;
+    header.StringsSize = strings.size();
+    imageEntries.append((const char*)&header, sizeof(header)).append(strings);
+
+    return ERR_SUCCESS;
+}
+
+void UEFIIndex::addGrams(const QByteArray & data, const UINT32 blob)
+{
+    const UINT8* bytes = (const UINT8*)data.constData();
+    UINT32* seen = seenGrams.data();
+    int first = pairs.size();
+
+    // Every distinct trigram of the payload is added once
+    for (int i = 0; i + 3 <= data.size(); i++) {
+        UINT32 gram = bytes[i] | (bytes[i + 1] << 8) | (bytes[i + 2] << 16);
+        UINT32 bit = 1U << (gram & 0x1F);
+        if (seen[gram >> 5] & bit)
+            continue;
+        seen[gram >> 5] |= bit;
+        pairs.append(((UINT64)gram << 32) | blob);
+    }
+
+    // Clear only the words touched by this payload
+    for (int i = first; i < pairs.size(); i++) {
+        UINT32 gram = (UINT32)(pairs.at(i) >> 32);
+        seen[gram >> 5] = 0;
+    }
+}
+
+UINT8 UEFIIndex::writeSegment()
+{
+    if (!pairs.isEmpty()) {
+        UINT8 result = writePostings();
+        if (result)
+            return result;
+    }
+
+    // Payloads, entries and images are committed only after postings of their payloads are on disk,
+    // so an interrupted run doesn't leave payloads that can never be found
+    if (!blobsFile.flush()
+        || blobTableFile.write(pendingBlobs) != pendingBlobs.size() || !blobTableFile.flush()
+        || entriesFile.write(pendingEntries) != pendingEntries.size() || !entriesFile.flush()
+        || imagesFile.write(pendingImages) != pendingImages.size() || !imagesFile.flush())
+        return ERR_FILE_WRITE;
+    pendingBlobs.clear();
+    pendingEntries.clear();
+    pendingImages.clear();
+    return ERR_SUCCESS;
+}
+
+UINT8 UEFIIndex::writePostings()
+{
+    // Sorting groups pairs by trigram with payload numbers ascending
+    qSort(pairs);
+
+    QFile gramsFile(indexDir.filePath(QString("grams.%1").arg(segmentCount)));
+    QFile postingsFile(indexDir.filePath(QString("postings.%1").arg(segmentCount)));
+    if (!gramsFile.open(QFile::WriteOnly | QFile::Truncate)
+        || !postingsFile.open(QFile::WriteOnly | QFile::Truncate))
+        return ERR_FILE_OPEN;
+
+    QByteArray grams;
+    QByteArray postings;
+    UINT64 postingsOffset = 0;
+    int i = 0;
+    while (i < pairs.size()) {
+        INDEX_GRAM_RECORD record;
+        record.Gram = (UINT32)(pairs.at(i) >> 32);
+        record.Count = 0;
+        record.Offset = postingsOffset;
+
+        UINT32 previous = 0;
+        for (; i < pairs.size() && (UINT32)(pairs.at(i) >> 32) == record.Gram; i++) {
+            UINT32 blob = (UINT32)pairs.at(i);
+            UINT32 delta = blob - previous;
+            previous = blob;
+            do {
+                UINT8 byte = delta & 0x7F;
+                delta >>= 7;
+                if (delta)
+                    byte |= 0x80;
+                postings.append((char)byte);
+                postingsOffset++;
+            } while (delta);
+            record.Count++;
+        }
+        grams.append((const char*)&record, sizeof(record));
+
+        if (postings.size() >= INDEX_WRITE_BLOCK_SIZE) {
+            if (postingsFile.write(postings) != postings.size())
+                return ERR_FILE_WRITE;
+            postings.clear();
+        }
+    }
+
+    if (postingsFile.write(postings) != postings.size()
+        || gramsFile.write(grams) != grams.size()
+        || !postingsFile.flush() || !gramsFile.flush())
+        return ERR_FILE_WRITE;
+
+    segmentCount++;
+    pairs.clear();
+    return ERR_SUCCESS;
+}
+
+static void readPostings(const IndexSegment* segment, const UINT32 gram, const UINT32 blobCount, QVector<UINT32> & list)
+{
+    // Binary search for trigram record
+    UINT32 low = 0;
+    UINT32 high = segment->count;
+    while (low < high) {
+        UINT32 middle = low + (high - low) / 2;
+        if (segment->records[middle].Gram < gram)
+            low = middle + 1;
+        else
+            high = middle;
+    }
+    if (low >= segment->count || segment->records[low].Gram != gram)
+        return;
+
+    const INDEX_GRAM_RECORD & record = segment->records[low];
+    UINT64 position = record.Offset;
+    UINT32 blob = 0;
+    for (UINT32 i = 0; i < record.Count; i++) {
+        UINT32 delta = 0;
+        for (UINT32 shift = 0; position < segment->size && shift < 32; shift += 7) {
+            UINT8 byte = segment->data[position++];
+            delta |= (UINT32)(byte & 0x7F) << shift;
+            if (!(byte & 0x80))
+                break;
+        }
+        blob += delta;
+        // Payloads of an interrupted commit are not in blob table
+        if (blob >= blobCount)
+            break;
+        list.append(blob);
+    }
+}
+
+UINT8 UEFIIndex::findCandidates(const BytePattern & pattern, QVector<UINT32> & candidates)
+{
+    candidates.clear();
+
+    // Trigrams of fully defined bytes of pattern
+    QByteArray values = pattern.values();
+    QByteArray masks = pattern.masks();
+    QVector<UINT32> grams;
+    for (int i = 0; i + 3 <= values.size(); i++) {
+        if ((UINT8)masks.at(i) != 0xFF || (UINT8)masks.at(i + 1) != 0xFF || (UINT8)masks.at(i + 2) != 0xFF)
+            continue;
+        UINT32 gram = (UINT8)values.at(i) | ((UINT8)values.at(i + 1) << 8) | ((UINT8)values.at(i + 2) << 16);
+        if (!grams.contains(gram))
+            grams.append(gram);
+    }
+
+    // No trigrams, all payloads are candidates
+    if (grams.isEmpty()) {
+        candidates.reserve(blobCount);
+        for (UINT32 i = 0; i < blobCount; i++)
+            candidates.append(i);
+        return ERR_SUCCESS;
+    }
+
+    // Map all segments
+    QVector<IndexSegment*> segments;
+    UINT8 result = ERR_SUCCESS;
+    for (UINT32 i = 0; QFile::exists(indexDir.filePath(QString("grams.%1").arg(i))); i++) {
+        IndexSegment* segment = new IndexSegment;
+        segments.append(segment);
+        result = mapSegment(indexDir, i, segment);
+        if (result)
+            break;
+    }
+
+    // Posting lists are concatenated over segments, payload numbers of later segments are larger
+    QVector<QVector<UINT32> > lists;
+    for (int i = 0; !result && i < grams.size(); i++) {
+        QVector<UINT32> list;
+        for (int j = 0; j < segments.size(); j++)
+            readPostings(segments.at(j), grams.at(i), blobCount, list);
+        // Trigram is not indexed, so pattern can't be found
+        if (list.isEmpty()) {
+            lists.clear();
+            break;
+        }
+        lists.append(list);
+    }
+    qDeleteAll(segments);
+    if (result || lists.isEmpty())
+        return result;
+
+    // Intersect lists starting from the shortest one
+    int shortest = 0;
+    for (int i = 1; i < lists.size(); i++)
+        if (lists.at(i).size() < lists.at(shortest).size())
+            shortest = i;
+    candidates = lists.at(shortest);
+    for (int i = 0; i < lists.size() && !candidates.isEmpty(); i++) {
+        if (i == shortest)
+            continue;
+        const QVector<UINT32> & list = lists.at(i);
+        QVector<UINT32> intersection;
+        int j = 0;
+        int k = 0;
+        while (j < candidates.size() && k < list.size()) {
+            if (candidates.at(j) < list.at(k))
+                j++;
+            else if (candidates.at(j) > list.at(k))
+                k++;
+            else {
+                intersection.append(candidates.at(j));
+                j++;
+                k++;
+            }
+        }
+        candidates = intersection;
+    }
+
+    return ERR_SUCCESS;
+}
+
+UINT8 UEFIIndex::findInIndex(QString indexPath, QString pattern, const UINT8 type)
+{
+    BytePattern bytePattern;
+    UINT8 result;
+    if (type == INDEX_PATTERN_HEX)
+        result = bytePattern.compile(pattern.toLatin1());
+    else
+        result = bytePattern.compileText(pattern, type == INDEX_PATTERN_UNICODE, true);
+    if (result || bytePattern.isWildcard())
+        return ERR_INVALID_PARAMETER;
+
+    indexDir = QDir(indexPath);
+
+    // Read image paths
+    imagesFile.setFileName(indexDir.filePath("images"));
+    if (!imagesFile.open(QFile::ReadOnly))
+        return ERR_FILE_OPEN;
+    QStringList images = QString::fromUtf8(imagesFile.readAll()).split('\n', QString::SkipEmptyParts);
+    imagesFile.close();
+
+    // Read payload table
+    blobTableFile.setFileName(indexDir.filePath("blobtable"));
+    if (!blobTableFile.open(QFile::ReadOnly))
+        return ERR_FILE_OPEN;
+    QByteArray table = blobTableFile.readAll();
+    blobTableFile.close();
+    if (!table.startsWith(INDEX_SIGNATURE))
+        return ERR_INVALID_FILE;
+    const INDEX_BLOB_RECORD* records = (const INDEX_BLOB_RECORD*)(table.constData() + INDEX_SIGNATURE_SIZE);
+    blobCount = (table.size() - INDEX_SIGNATURE_SIZE) / sizeof(INDEX_BLOB_RECORD);
+
+    QVector<UINT32> candidates;
+    result = findCandidates(bytePattern, candidates);
+    if (result)
+        return result;
+
+    // Verify candidates against payload bytes
+    blobsFile.setFileName(indexDir.filePath("blobs"));
+    if (!blobsFile.open(QFile::ReadOnly))
+        return ERR_FILE_OPEN;
+    QHash<UINT32, QVector<UINT32> > hits;
+    for (int i = 0; i < candidates.size(); i++) {
+        UINT32 blob = candidates.at(i);
+        if (blob >= blobCount)
+            continue;
+        if (!blobsFile.seek(records[blob].Offset)) {
+            blobsFile.close();
+            return ERR_FILE_READ;
+        }
+        QByteArray data = blobsFile.read(records[blob].Size);
+        if ((UINT32)data.size() != records[blob].Size) {
+            blobsFile.close();
+            return ERR_FILE_READ;
+        }
+
+        INT32 offset = bytePattern.indexIn(data);
+        while (offset >= 0) {
+            hits[blob].append(offset);
+            offset = bytePattern.indexIn(data, offset + 1);
+        }
+    }
+    blobsFile.close();
+    if (hits.isEmpty())
+        return ERR_ITEM_NOT_FOUND;
+
+    // Report every module payload with matches
+    entriesFile.setFileName(indexDir.filePath("entries"));
+    if (!entriesFile.open(QFile::ReadOnly))
+        return ERR_FILE_OPEN;
+    UINT64 size = entriesFile.size();
+    const UINT8* entries = size ? entriesFile.map(0, size) : NULL;
+    if (size && !entries) {
+        entriesFile.close();
+        return ERR_FILE_READ;
+    }
+
+    UINT32 matches = 0;
+    QSet<UINT32> matchedImages;
+    UINT64 position = 0;
+    while (position + sizeof(INDEX_ENTRY_HEADER) <= size) {
+        const INDEX_ENTRY_HEADER* header = (const INDEX_ENTRY_HEADER*)(entries + position);
+        position += sizeof(INDEX_ENTRY_HEADER);
+        if (position + header->StringsSize > size)
+            break;
+        const char* strings = (const char*)(entries + position);
+        position += header->StringsSize;
+        if (!hits.contains(header->Blob))
+            continue;
+
+        // Strings are zero-terminated
+        QString guid = QString::fromUtf8(strings);
+        strings += strlen(strings) + 1;
+        QString text = QString::fromUtf8(strings);
+        strings += strlen(strings) + 1;
+        QString kind = QString::fromUtf8(strings);
+
+        const QVector<UINT32> & offsets = hits[header->Blob];
+        for (int i = 0; i < offsets.size(); i++) {
+            QString line = tr("%1: %2%3 %4 at offset %5")
+                .arg(images.value(header->Image))
+                .arg(guid)
+                .arg(text.isEmpty() ? QString() : QString(" \"%1\"").arg(text))
+                .arg(kind)
+                .arg(offsets.at(i), 8, 16, QChar('0'));
+            std::cout << line.toLocal8Bit().constData() << std::endl;
+        }
+        matches += offsets.size();
+        matchedImages.insert(header->Image);
+    }
+    entriesFile.close();
+
+    std::cout << matches << (matches == 1 ? " match in " : " matches in ")
+        << matchedImages.size() << (matchedImages.size() == 1 ? " image" : " images") << std::endl;
+    return ERR_SUCCESS;
+}
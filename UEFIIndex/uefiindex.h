@@ -0,0 +1,121 @@
+/* uefiindex.h
+
+Copyright (c) 2014, Nikolaj Schlej. All rights reserved.
+This program and the accompanying materials
+are licensed and made available under the terms and conditions of the BSD License
+which accompanies this distribution.  The full text of the license may be found at
+http://opensource.org/licenses/bsd-license.php
+
+THE PROGRAM IS DISTRIBUTED UNDER THE BSD LICENSE ON AN "AS IS" BASIS,
+WITHOUT WARRANTIES OR REPRESENTATIONS OF ANY KIND, EITHER EXPRESS OR IMPLIED.
+
+*/
+
+#ifndef __UEFIINDEX_H__
+#define __UEFIINDEX_H__
+
+#include <QObject>
+#include <QByteArray>
+#include <QDir>
+#include <QFile>
+#include <QHash>
+#include <QSet>
+#include <QString>
+#include <QStringList>
+#include <QVector>
+
+#include "../basetypes.h"
+#include "../bytepattern.h"
+#include "../ffsengine.h"
+
+// Index directory contents
+// images      - paths of indexed images, one per line in UTF-8
+// blobs       - unique module payloads one after another
+// blobtable   - signature followed by INDEX_BLOB_RECORD for every payload
+// entries     - INDEX_ENTRY_HEADER followed by its strings for every module payload in every image
+// grams.N     - INDEX_GRAM_RECORD for every trigram of segment N, sorted by trigram
+// postings.N  - payload numbers of segment N for every trigram, delta-encoded as 7-bit varints
+// Segments are append-only, every segment has payloads not present in earlier ones
+// Last segment with payloads missing from blobtable is left by an interrupted run and removed on next run
+// Payloads, entries and images are appended to their files only after the segment with their trigrams
+// is written, entries of an image before its path, so every indexed payload of a listed image can be found
+
+#define INDEX_SIGNATURE "UEFIIDX1"
+#define INDEX_SIGNATURE_SIZE 8
+
+#pragma pack(push,1)
+
+typedef struct _INDEX_BLOB_RECORD {
+    UINT64 Offset;
+    UINT32 Size;
+    UINT8  Sha1[20];
+} INDEX_BLOB_RECORD;
+
+typedef struct _INDEX_GRAM_RECORD {
+    UINT32 Gram;
+    UINT32 Count;
+    UINT64 Offset;
+} INDEX_GRAM_RECORD;
+
+typedef struct _INDEX_ENTRY_HEADER {
+    UINT32 Image;
+    UINT32 Blob;
+    UINT32 StringsSize;
+    // File GUID, file text and payload kind follow as zero-terminated UTF-8 strings
+} INDEX_ENTRY_HEADER;
+
+#pragma pack(pop)
+
+// Pattern types
+#define INDEX_PATTERN_HEX     0
+#define INDEX_PATTERN_TEXT    1
+#define INDEX_PATTERN_UNICODE 2
+
+class UEFIIndex : public QObject
+{
+    Q_OBJECT
+
+public:
+    explicit UEFIIndex(QObject *parent = 0);
+    ~UEFIIndex();
+
+    // Add image files and all image files in directories to the index, index is created if needed
+    UINT8 addToIndex(QString indexPath, QStringList paths);
+    // Find pattern in indexed payloads, candidates are verified against payload bytes
+    UINT8 findInIndex(QString indexPath, QString pattern, const UINT8 type);
+
+private:
+    QDir indexDir;
+    QFile imagesFile;
+    QFile blobsFile;
+    QFile blobTableFile;
+    QFile entriesFile;
+    QSet<QString> imagePaths;
+    UINT64 blobsSize;
+    UINT32 imageCount;
+    UINT32 blobCount;
+    UINT32 segmentCount;
+    QHash<QByteArray, UINT32> blobHashes;
+    // Trigram and payload number pairs of the current segment
+    QVector<UINT64> pairs;
+    // Trigrams already seen in the current payload
+    QVector<UINT32> seenGrams;
+    // Blob records, entries and image paths waiting for the current segment to be written
+    QByteArray pendingBlobs;
+    QByteArray pendingEntries;
+    QByteArray pendingImages;
+    // Entries of the image being added
+    QByteArray imageEntries;
+
+    UINT8 openIndex(const QString & indexPath);
+    UINT8 closeIndex();
+    UINT8 addImage(const QString & path, UINT32 & payloads);
+    UINT8 collectPayloads(FfsEngine* engine, const QModelIndex & index, const QModelIndex & file, const UINT32 image, UINT32 & payloads);
+    UINT8 addPayload(const UINT32 image, const QString & guid, const QString & text, const QString & kind, const QByteArray & data);
+    void addGrams(const QByteArray & data, const UINT32 blob);
+    UINT8 writeSegment();
+    UINT8 writePostings();
+    UINT8 findCandidates(const BytePattern & pattern, QVector<UINT32> & candidates);
+};
+
+#endif
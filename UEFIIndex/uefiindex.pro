@@ -0,0 +1,51 @@
+QT       += core
+QT       -= gui
+
+TARGET    = UEFIIndex
+TEMPLATE  = app
+CONFIG   += console
+CONFIG   -= app_bundle
+DEFINES  += _CONSOLE
+
+SOURCES  += uefiindex_main.cpp \
+ uefiindex.cpp \
+ ../types.cpp \
+ ../descriptor.cpp \
+ ../ffs.cpp \
+ ../ffsengine.cpp \
+ ../bytepattern.cpp \
+ ../dumpwriter.cpp \
+ ../imagebuilder.cpp \
+ ../patchprogram.cpp \
+ ../patternset.cpp \
+ ../treeitem.cpp \
+ ../treemodel.cpp \
+ ../LZMA/LzmaCompress.c \
+ ../LZMA/LzmaDecompress.c \
+ ../LZMA/SDK/C/LzFind.c \
+ ../LZMA/SDK/C/LzmaDec.c \
+ ../LZMA/SDK/C/LzmaEnc.c \
+ ../Tiano/EfiTianoDecompress.c \
+ ../Tiano/EfiTianoCompress.c
+
+HEADERS  += uefiindex.h \
+ ../basetypes.h \
+ ../descriptor.h \
+ ../gbe.h \
+ ../me.h \
+ ../ffs.h \
+ ../peimage.h \
+ ../types.h \
+ ../ffsengine.h \
+ ../bytepattern.h \
+ ../dumpwriter.h \
+ ../imagebuilder.h \
+ ../patchprogram.h \
+ ../patternset.h \
+ ../treeitem.h \
+ ../treemodel.h \
+ ../LZMA/LzmaCompress.h \
+ ../LZMA/LzmaDecompress.h \
+ ../Tiano/EfiTianoDecompress.h \
+ ../Tiano/EfiTianoCompress.h
+ 
@@ -0,0 +1,84 @@
+/* uefiindex_main.cpp
+
+Copyright (c) 2014, Nikolaj Schlej. All rights reserved.
+This program and the accompanying materials
+are licensed and made available under the terms and conditions of the BSD License
+which accompanies this distribution.  The full text of the license may be found at
+http://opensource.org/licenses/bsd-license.php
+
+THE PROGRAM IS DISTRIBUTED UNDER THE BSD LICENSE ON AN "AS IS" BASIS,
+WITHOUT WARRANTIES OR REPRESENTATIONS OF ANY KIND, EITHER EXPRESS OR IMPLIED.
+
+*/
+#include <QCoreApplication>
+#include <QString>
+#include <QStringList>
+#include <iostream>
+#include "uefiindex.h"
+
+int main(int argc, char *argv[])
+{
+    QCoreApplication a(argc, argv);
+    a.setOrganizationName("CodeRush");
+    a.setOrganizationDomain("coderush.me");
+    a.setApplicationName("UEFIIndex");
+
+    UEFIIndex w;
+    UINT8 result = ERR_SUCCESS;
+    UINT32 argumentsCount = a.arguments().length();
+    UINT8 type = INDEX_PATTERN_HEX;
+
+    if (argumentsCount == 5) {
+        if (a.arguments().at(4) == QString("text"))
+            type = INDEX_PATTERN_TEXT;
+        else if (a.arguments().at(4) == QString("unicode"))
+            type = INDEX_PATTERN_UNICODE;
+        else if (a.arguments().at(4) != QString("hex"))
+            argumentsCount = 0;
+    }
+
+    if (argumentsCount >= 4 && a.arguments().at(1) == QString("add")) {
+        result = w.addToIndex(a.arguments().at(2), a.arguments().mid(3));
+    }
+    else if ((argumentsCount == 4 || argumentsCount == 5) && a.arguments().at(1) == QString("find")) {
+        result = w.findInIndex(a.arguments().at(2), a.arguments().at(3), type);
+    }
+    else {
+        std::cout << "UEFIIndex 0.1.0 - UEFI image corpus indexing and search utility" << std::endl << std::endl <<
+            "Usage: UEFIIndex add index_dir image_file|image_dir..." << std::endl <<
+            "       UEFIIndex find index_dir pattern [hex|text|unicode]" << std::endl << std::endl <<
+            "Raw and decompressed data of every file in images is indexed by trigrams." << std::endl <<
+            "Dots in hex patterns match any nibble, text is matched case-sensitively." << std::endl;
+        return ERR_SUCCESS;
+    }
+
+    switch (result) {
+    case ERR_SUCCESS:
+        break;
+    case ERR_ITEM_NOT_FOUND:
+        std::cout << "Pattern not found" << std::endl;
+        break;
+    case ERR_INVALID_PARAMETER:
+        std::cout << "Invalid pattern" << std::endl;
+        break;
+    case ERR_INVALID_FILE:
+        std::cout << "Index is damaged or has unknown format" << std::endl;
+        break;
+    case ERR_DIR_CREATE:
+        std::cout << "Index directory can't be created" << std::endl;
+        break;
+    case ERR_FILE_OPEN:
+        std::cout << "Index files can't be opened" << std::endl;
+        break;
+    case ERR_FILE_READ:
+        std::cout << "Index files can't be read" << std::endl;
+        break;
+    case ERR_FILE_WRITE:
+        std::cout << "Index files can't be written" << std::endl;
+        break;
+    default:
+        std::cout << "Error " << result << std::endl;
+    }
+
+    return result;
+}
@@ -11,54 +11,373 @@ WITHOUT WARRANTIES OR REPRESENTATIONS OF ANY KIND, EITHER EXPRESS OR IMPLIED.
 
 */
 
+#include <string.h>
+#include <iostream>
+
+#include <QAtomicInt>
+#include <QCoreApplication>
+#include <QCryptographicHash>
+#include <QDirIterator>
+#include <QElapsedTimer>
+#include <QRunnable>
+#include <QThreadPool>
+#include <QtAlgorithms>
+
 #include "uefipatch.h"
 
+// Worker of batch mode, takes next image until all are patched
+class PatchWorker : public QRunnable
+{
+public:
+    PatchWorker(const UEFIPatch* patcher, const QStringList & paths, const QVector<PatchGroup> & groups, const bool delta, QAtomicInt* next, PatchSummary* summaries)
+        : patcher(patcher), paths(paths), groups(groups), delta(delta), next(next), summaries(summaries)
+    {
+    }
+
+    void run()
+    {
+        int i;
+        while ((i = next->fetchAndAddOrdered(1)) < paths.count())
+            patcher->patchImage(paths.at(i), groups, delta, summaries[i]);
+    }
+
+private:
+    const UEFIPatch* patcher;
+    QStringList paths;
+    QVector<PatchGroup> groups;
+    bool delta;
+    QAtomicInt* next;
+    PatchSummary* summaries;
+};
+
 UEFIPatch::UEFIPatch(QObject *parent) :
     QObject(parent)
 {
-    ffsEngine = new FfsEngine(this);
-    model = ffsEngine->treeModel();
 }
 
 UEFIPatch::~UEFIPatch()
 {
-    delete ffsEngine;
 }
 
-UINT8 UEFIPatch::patchFromFile(QString path)
+UINT8 UEFIPatch::patchFromFile(QString path, const bool delta)
 {
-    QFileInfo patchInfo = QFileInfo("patches.txt");
+    QVector<PatchGroup> groups;
+    UINT8 result = loadPatches("patches.txt", groups);
+    if (result)
+        return result;
 
-    if (!patchInfo.exists())
-        return ERR_INVALID_FILE;
+    PatchSummary summary;
+    result = patchImage(path, groups, delta, summary);
+    for (int i = 0; i < summary.messages.count(); i++)
+        std::cout << summary.messages.at(i).toLatin1().constData() << std::endl;
+    return result;
+}
 
-    QFile file;
-    file.setFileName("patches.txt");
+UINT8 UEFIPatch::patchBatch(QStringList paths, QString patchesPath, const int workers, const bool delta)
+{
+    // Patches are parsed and compiled once for all images
+    QVector<PatchGroup> groups;
+    UINT8 result = loadPatches(patchesPath, groups);
+    if (result)
+        return result;
+
+    // Expand directories to image files in them, skipping results of previous runs
+    QStringList files;
+    for (int i = 0; i < paths.count(); i++) {
+        if (QFileInfo(paths.at(i)).isDir()) {
+            QDirIterator it(paths.at(i), QDir::Files, QDirIterator::Subdirectories);
+            while (it.hasNext()) {
+                QString file = it.next();
+                if (!file.endsWith(".patched") && !file.endsWith(".delta"))
+                    files.append(file);
+            }
+        }
+        else
+            files.append(paths.at(i));
+    }
+    if (files.isEmpty())
+        return ERR_FILE_OPEN;
+
+    // Every worker parses its images with its own engine
+    QVector<PatchSummary> summaries(files.count());
+    QElapsedTimer timer;
+    timer.start();
+    QAtomicInt next(0);
+    QThreadPool pool;
+    pool.setMaxThreadCount(workers);
+    for (int i = 0; i < workers && i < files.count(); i++)
+        pool.start(new PatchWorker(this, files, groups, delta, &next, summaries.data()));
+    pool.waitForDone();
+
+    // Report in order of images
+    int patched = 0;
+    int failed = 0;
+    result = ERR_SUCCESS;
+    for (int i = 0; i < summaries.size(); i++) {
+        const PatchSummary & summary = summaries.at(i);
+        QString status;
+        if (summary.result == ERR_SUCCESS) {
+            QStringList lines;
+            for (int j = 0; j < summary.appliedLines.size(); j++)
+                lines.append(QString::number(summary.appliedLines.at(j)));
+            status = tr("patched, applied lines %1").arg(lines.join(", "));
+            patched++;
+        }
+        else if (summary.result == ERR_NOTHING_TO_PATCH)
+            status = tr("nothing to patch");
+        else {
+            status = tr("failed, %1").arg(errorMessage(summary.result));
+            if (!failed)
+                result = summary.result;
+            failed++;
+        }
+
+        std::cout << tr("%1: %2 (parse %3 ms, patch %4 ms, write %5 ms)")
+            .arg(summary.path)
+            .arg(status)
+            .arg(summary.parseTime)
+            .arg(summary.patchTime)
+            .arg(summary.writeTime).toLocal8Bit().constData() << std::endl;
+
+        // Messages of the engine are printed under their image
+        for (int j = 0; j < summary.messages.count(); j++)
+            std::cout << "    " << summary.messages.at(j).toLatin1().constData() << std::endl;
+    }
+
+    std::cout << tr("%1 of %2 images patched, %3 failed, %4 ms total")
+        .arg(patched)
+        .arg(summaries.size())
+        .arg(failed)
+        .arg(timer.elapsed()).toLocal8Bit().constData() << std::endl;
+
+    return result;
+}
+
+UINT8 UEFIPatch::patchImage(const QString & path, const QVector<PatchGroup> & groups, const bool delta, PatchSummary & summary) const
+{
+    // New engine is used for every image, like for every file opened in UEFITool
+    // Its messages are kept with the summary, so messages of images patched in parallel don't mix
+    FfsEngine ffsEngine;
+    ffsEngine.setCollectMessages(true);
+    UINT8 result = patchImage(&ffsEngine, path, groups, delta, summary);
+    summary.messages = ffsEngine.collectedMessages();
+    return result;
+}
+
+UINT8 UEFIPatch::patchImage(FfsEngine* ffsEngine, const QString & path, const QVector<PatchGroup> & groups, const bool delta, PatchSummary & summary) const
+{
+    summary.path = path;
+    summary.appliedLines.clear();
+    summary.messages.clear();
+    summary.parseTime = summary.patchTime = summary.writeTime = 0;
+    summary.result = ERR_SUCCESS;
+
+    QElapsedTimer timer;
+    timer.start();
 
-    if (!file.open(QFile::ReadOnly | QFile::Text))
-        return ERR_INVALID_FILE;
-    
     QFileInfo fileInfo = QFileInfo(path);
 
     if (!fileInfo.exists())
-        return ERR_FILE_OPEN;
+        return summary.result = ERR_FILE_OPEN;
 
     QFile inputFile;
     inputFile.setFileName(path);
 
     if (!inputFile.open(QFile::ReadOnly))
-        return ERR_FILE_READ;
+        return summary.result = ERR_FILE_READ;
 
     QByteArray buffer = inputFile.readAll();
     inputFile.close();
 
     UINT8 result = ffsEngine->parseImageFile(buffer);
+    summary.parseTime = timer.restart();
+    if (result)
+        return summary.result = result;
+
+    // Patch all files with GUID of the group
+    for (int i = 0; i < groups.size(); i++) {
+        QModelIndexList files;
+        ffsEngine->findItemsByGuid(groups.at(i).guid, files);
+        for (int j = 0; j < files.size(); j++) {
+            if (ffsEngine->treeModel()->type(files.at(j)) != Types::File)
+                continue;
+            result = patchFile(ffsEngine, files.at(j), groups.at(i), summary.appliedLines);
+            if (result && result != ERR_NOTHING_TO_PATCH)
+                return summary.result = result;
+        }
+    }
+    
+    ImageBuilder reconstructed;
+    result = ffsEngine->reconstructImageFile(reconstructed);
+    summary.patchTime = timer.restart();
+    if (result)
+        return summary.result = result;
+    if (reconstructed.equals(buffer))
+        return summary.result = ERR_NOTHING_TO_PATCH;
+
+    // Same line can be applied to several files
+    qSort(summary.appliedLines);
+    QVector<int> applied;
+    for (int i = 0; i < summary.appliedLines.size(); i++)
+        if (applied.isEmpty() || applied.last() != summary.appliedLines.at(i))
+            applied.append(summary.appliedLines.at(i));
+    summary.appliedLines = applied;
+    
+    if (delta) {
+        QByteArray deltaData;
+        makeDelta(buffer, reconstructed.toByteArray(), deltaData);
+        QFile deltaFile(QString(path).append(".delta"));
+        if (!deltaFile.open(QFile::WriteOnly) || deltaFile.write(deltaData) != deltaData.size())
+            result = ERR_FILE_WRITE;
+    }
+    else
+        result = reconstructed.write(QString(path).append(".patched"));
+    summary.writeTime = timer.restart();
+    if (result)
+        return summary.result = ERR_FILE_WRITE;
+
+    return summary.result = ERR_SUCCESS;
+}
+
+void UEFIPatch::makeDelta(const QByteArray & base, const QByteArray & result, QByteArray & delta) const
+{
+    PATCH_DELTA_HEADER header;
+    memcpy(header.Signature, PATCH_DELTA_SIGNATURE, PATCH_DELTA_SIGNATURE_SIZE);
+    memcpy(header.BaseSha1, QCryptographicHash::hash(base, QCryptographicHash::Sha1).constData(), sizeof(header.BaseSha1));
+    memcpy(header.ResultSha1, QCryptographicHash::hash(result, QCryptographicHash::Sha1).constData(), sizeof(header.ResultSha1));
+    header.BaseSize = base.size();
+    header.ResultSize = result.size();
+    header.RangeCount = 0;
+    delta.clear();
+    delta.append((const char*)&header, sizeof(header));
+
+    // Bytes past the end of base image are always new
+    const char* baseData = base.constData();
+    const char* resultData = result.constData();
+    UINT32 common = qMin(base.size(), result.size());
+    UINT32 size = result.size();
+    UINT32 offset = 0;
+    while (offset < size) {
+        // Skip equal bytes
+        while (offset < common && baseData[offset] == resultData[offset])
+            offset++;
+        if (offset == size)
+            break;
+
+        // Equal runs shorter than range header are included into the range
+        UINT32 end = offset;
+        UINT32 equal = 0;
+        while (end < size && equal < sizeof(PATCH_DELTA_RANGE)) {
+            if (end < common && baseData[end] == resultData[end])
+                equal++;
+            else
+                equal = 0;
+            end++;
+        }
+        end -= equal;
+
+        PATCH_DELTA_RANGE range;
+        range.Offset = offset;
+        range.Size = end - offset;
+        delta.append((const char*)&range, sizeof(range));
+        delta.append(resultData + offset, range.Size);
+        header.RangeCount++;
+        offset = end;
+    }
+
+    ((PATCH_DELTA_HEADER*)delta.data())->RangeCount = header.RangeCount;
+}
+
+UINT8 UEFIPatch::applyDelta(QString path, QString deltaPath)
+{
+    QFile inputFile(path);
+    if (!inputFile.open(QFile::ReadOnly))
+        return ERR_FILE_OPEN;
+    QByteArray buffer = inputFile.readAll();
+    inputFile.close();
+
+    QFile deltaFile(deltaPath);
+    if (!deltaFile.open(QFile::ReadOnly))
+        return ERR_INVALID_FILE;
+    QByteArray delta = deltaFile.readAll();
+    deltaFile.close();
+
+    if ((UINT32)delta.size() < sizeof(PATCH_DELTA_HEADER))
+        return ERR_INVALID_FILE;
+    const PATCH_DELTA_HEADER* header = (const PATCH_DELTA_HEADER*)delta.constData();
+    if (memcmp(header->Signature, PATCH_DELTA_SIGNATURE, PATCH_DELTA_SIGNATURE_SIZE))
+        return ERR_INVALID_FILE;
+
+    // Delta can only be applied to the image it was made for
+    if (header->BaseSize != (UINT32)buffer.size()
+        || QCryptographicHash::hash(buffer, QCryptographicHash::Sha1) != QByteArray((const char*)header->BaseSha1, sizeof(header->BaseSha1)))
+        return ERR_DELTA_BASE_MISMATCH;
+
+    QByteArray result = buffer;
+    result.resize(header->ResultSize);
+    UINT32 offset = sizeof(PATCH_DELTA_HEADER);
+    for (UINT32 i = 0; i < header->RangeCount; i++) {
+        if ((UINT32)delta.size() - offset < sizeof(PATCH_DELTA_RANGE))
+            return ERR_INVALID_FILE;
+        const PATCH_DELTA_RANGE* range = (const PATCH_DELTA_RANGE*)(delta.constData() + offset);
+        offset += sizeof(PATCH_DELTA_RANGE);
+        if ((UINT32)delta.size() - offset < range->Size
+            || (UINT64)range->Offset + range->Size > header->ResultSize)
+            return ERR_INVALID_FILE;
+        memcpy(result.data() + range->Offset, delta.constData() + offset, range->Size);
+        offset += range->Size;
+    }
+
+    if (QCryptographicHash::hash(result, QCryptographicHash::Sha1) != QByteArray((const char*)header->ResultSha1, sizeof(header->ResultSha1)))
+        return ERR_INVALID_FILE;
+
+    QFile outputFile(QString(path).append(".patched"));
+    if (!outputFile.open(QFile::WriteOnly) || outputFile.write(result) != result.size())
+        return ERR_FILE_WRITE;
+
+    return ERR_SUCCESS;
+}
+
+UINT8 UEFIPatch::loadPatches(const QString & patchesPath, QVector<PatchGroup> & groups)
+{
+    QFileInfo patchInfo = QFileInfo(patchesPath);
+
+    if (!patchInfo.exists())
+        return ERR_INVALID_FILE;
+
+    QFile file;
+    file.setFileName(patchesPath);
+
+    if (!file.open(QFile::ReadOnly | QFile::Text))
+        return ERR_INVALID_FILE;
+
+    QByteArray source = file.readAll();
+    file.close();
+
+    // Compiled patches are taken from cache if it was made from the same patches file
+    QByteArray hash = QCryptographicHash::hash(source, QCryptographicHash::Sha1);
+    QString cachePath = QString(patchesPath).append(".cache");
+    if (!readPatchCache(cachePath, hash, groups))
+        return ERR_SUCCESS;
+
+    UINT8 result = parsePatches(source, groups);
     if (result)
         return result;
 
-    UINT8 counter = 0;
-    while (!file.atEnd()) {
-        QByteArray line = file.readLine();
+    // Cache can't be written to read-only directories, patches are parsed every time then
+    writePatchCache(cachePath, hash, groups);
+    return ERR_SUCCESS;
+}
+
+UINT8 UEFIPatch::parsePatches(const QByteArray & source, QVector<PatchGroup> & groups)
+{
+    // Lines with the same file GUID and section type are grouped in order of appearance
+    QHash<QByteArray, int> groupIndex;
+    QVector<QVector<PatchData> > groupPatches;
+    groups.clear();
+    QList<QByteArray> lines = source.split('\n');
+    for (int lineNumber = 1; lineNumber <= lines.count(); lineNumber++) {
+        QByteArray line = lines.at(lineNumber - 1).trimmed();
         // Use sharp sign as commentary
         if (line.count() == 0 || line[0] == '#')
             continue;
@@ -68,13 +387,27 @@ UINT8 UEFIPatch::patchFromFile(QString path)
             continue;
         
         QUuid uuid = QUuid(list.at(0));
-        QByteArray guid = QByteArray::fromRawData((const char*)&uuid.data1, sizeof(EFI_GUID));
+        QByteArray guid = QByteArray((const char*)&uuid.data1, sizeof(EFI_GUID));
         bool converted;
         UINT8 sectionType = (UINT8)list.at(1).toUShort(&converted, 16);
         if (!converted)
             return ERR_INVALID_PARAMETER;
-                
-        QVector<PatchData> patches;
+
+        QByteArray key = guid;
+        key.append((char)sectionType);
+        if (!groupIndex.contains(key)) {
+            PatchGroup group;
+            group.guid = guid;
+            group.sectionType = sectionType;
+            group.compiled = ERR_SUCCESS;
+            groupIndex.insert(key, groups.size());
+            groups.append(group);
+            groupPatches.append(QVector<PatchData>());
+        }
+        int index = groupIndex.value(key);
+        PatchGroup & group = groups[index];
+        int lineIndex = group.lineNumbers.size();
+        group.lineNumbers.append(lineNumber);
 
         for (int i = 2; i < list.count(); i++) {
             QList<QByteArray> patchList = list.at(i).split(':');
@@ -84,66 +417,191 @@ UINT8 UEFIPatch::patchFromFile(QString path)
                 patch.offset = 0xFFFFFFFF;
                 patch.hexFindPattern = patchList.at(1);
                 patch.hexReplacePattern = patchList.at(2);
-                patches.append(patch);
             }
             else if (patch.type == PATCH_TYPE_OFFSET) {
                 patch.offset = patchList.at(1).toUInt(NULL, 16);
                 patch.hexReplacePattern = patchList.at(2);
-                patches.append(patch);
             }
             else {
                 // Ignore unknown patch type
                 continue;
             }
+            groupPatches[index].append(patch);
+            group.lineOfPatch.append(lineIndex);
         }
-        result = patchFile(model->index(0, 0), guid, sectionType, patches);
-        if (result && result != ERR_NOTHING_TO_PATCH)
-            return result;
-        counter++;
     }
-    
-    QByteArray reconstructed;
-    result = ffsEngine->reconstructImageFile(reconstructed);
-    if (result)
-        return result;
-    if (reconstructed == buffer)
-        return ERR_NOTHING_TO_PATCH;
-    
-    QFile outputFile;
-    outputFile.setFileName(path.append(".patched"));
-    if (!outputFile.open(QFile::WriteOnly))
+
+    // All lines of a group are compiled together, invalid patches are reported only for files present in image
+    for (int i = 0; i < groups.size(); i++)
+        groups[i].compiled = groups[i].program.compile(groupPatches.at(i));
+
+    return ERR_SUCCESS;
+}
+
+UINT8 UEFIPatch::readPatchCache(const QString & cachePath, const QByteArray & hash, QVector<PatchGroup> & groups)
+{
+    QFile file(cachePath);
+    if (!file.open(QFile::ReadOnly))
+        return ERR_FILE_OPEN;
+    QByteArray cache = file.readAll();
+    file.close();
+
+    if ((UINT32)cache.size() < sizeof(PATCH_CACHE_HEADER))
+        return ERR_INVALID_FILE;
+    const PATCH_CACHE_HEADER* header = (const PATCH_CACHE_HEADER*)cache.constData();
+    if (memcmp(header->Signature, PATCH_CACHE_SIGNATURE, PATCH_CACHE_SIGNATURE_SIZE)
+        || hash != QByteArray((const char*)header->SourceSha1, sizeof(header->SourceSha1)))
+        return ERR_INVALID_FILE;
+
+    groups.clear();
+    UINT32 offset = sizeof(PATCH_CACHE_HEADER);
+    for (UINT32 i = 0; i < header->GroupCount; i++) {
+        if ((UINT32)cache.size() - offset < sizeof(PATCH_CACHE_GROUP))
+            return ERR_INVALID_FILE;
+        const PATCH_CACHE_GROUP* groupHeader = (const PATCH_CACHE_GROUP*)(cache.constData() + offset);
+        offset += sizeof(PATCH_CACHE_GROUP);
+        UINT64 size = sizeof(UINT32) * ((UINT64)groupHeader->LineCount + groupHeader->PatchCount) + groupHeader->ProgramSize;
+        if ((UINT64)cache.size() - offset < size)
+            return ERR_INVALID_FILE;
+
+        PatchGroup group;
+        group.guid = QByteArray((const char*)&groupHeader->Guid, sizeof(EFI_GUID));
+        group.sectionType = groupHeader->SectionType;
+        group.compiled = groupHeader->Compiled;
+        const UINT32* numbers = (const UINT32*)(cache.constData() + offset);
+        for (UINT32 j = 0; j < groupHeader->LineCount; j++)
+            group.lineNumbers.append(numbers[j]);
+        for (UINT32 j = 0; j < groupHeader->PatchCount; j++) {
+            if (numbers[groupHeader->LineCount + j] >= groupHeader->LineCount)
+                return ERR_INVALID_FILE;
+            group.lineOfPatch.append(numbers[groupHeader->LineCount + j]);
+        }
+        offset += sizeof(UINT32) * (groupHeader->LineCount + groupHeader->PatchCount);
+        if (!group.compiled) {
+            if (group.program.fromBinary(cache.mid(offset, groupHeader->ProgramSize))
+                || group.program.count() != group.lineOfPatch.size())
+                return ERR_INVALID_FILE;
+        }
+        offset += groupHeader->ProgramSize;
+        groups.append(group);
+    }
+
+    return ERR_SUCCESS;
+}
+
+UINT8 UEFIPatch::writePatchCache(const QString & cachePath, const QByteArray & hash, const QVector<PatchGroup> & groups)
+{
+    QByteArray cache;
+    PATCH_CACHE_HEADER header;
+    memcpy(header.Signature, PATCH_CACHE_SIGNATURE, PATCH_CACHE_SIGNATURE_SIZE);
+    memcpy(header.SourceSha1, hash.constData(), sizeof(header.SourceSha1));
+    header.GroupCount = groups.size();
+    cache.append((const char*)&header, sizeof(header));
+
+    for (int i = 0; i < groups.size(); i++) {
+        const PatchGroup & group = groups.at(i);
+        // Program of group with invalid patches is not stored, only the error is
+        QByteArray program;
+        if (!group.compiled)
+            program = group.program.toBinary();
+
+        PATCH_CACHE_GROUP groupHeader;
+        memcpy(&groupHeader.Guid, group.guid.constData(), sizeof(EFI_GUID));
+        groupHeader.SectionType = group.sectionType;
+        groupHeader.Compiled = group.compiled;
+        groupHeader.LineCount = group.lineNumbers.size();
+        groupHeader.PatchCount = group.lineOfPatch.size();
+        groupHeader.ProgramSize = program.size();
+        cache.append((const char*)&groupHeader, sizeof(groupHeader));
+        for (int j = 0; j < group.lineNumbers.size(); j++) {
+            UINT32 number = group.lineNumbers.at(j);
+            cache.append((const char*)&number, sizeof(number));
+        }
+        for (int j = 0; j < group.lineOfPatch.size(); j++) {
+            UINT32 line = group.lineOfPatch.at(j);
+            cache.append((const char*)&line, sizeof(line));
+        }
+        cache.append(program);
+    }
+
+    // Write to temporary file first, so other instances never read partial cache
+    QString tempPath = QString(cachePath).append(".%1").arg(QCoreApplication::applicationPid());
+    QFile file(tempPath);
+    if (!file.open(QFile::WriteOnly))
+        return ERR_FILE_OPEN;
+    if (file.write(cache) != cache.size()) {
+        file.remove();
         return ERR_FILE_WRITE;
+    }
+    file.close();
 
-    outputFile.resize(0);
-    outputFile.write(reconstructed);
-    outputFile.close();
+    QFile::remove(cachePath);
+    if (!QFile::rename(tempPath, cachePath)) {
+        QFile::remove(tempPath);
+        return ERR_FILE_WRITE;
+    }
 
     return ERR_SUCCESS;
 }
 
-UINT8 UEFIPatch::patchFile(const QModelIndex & index, const QByteArray & fileGuid, const UINT8 sectionType, const QVector<PatchData> & patches)
+void UEFIPatch::findSections(TreeModel* model, const QModelIndex & index, const UINT8 sectionType, QModelIndexList & sections) const
 {
-  
-    if (!model || !index.isValid())
+    for (int i = 0; i < model->rowCount(index); i++) {
+        QModelIndex child = index.child(i, 0);
+        UINT8 type = model->type(child);
+        // Nested files are found by their own GUID
+        if (type == Types::File)
+            continue;
+        if (type == Types::Section && model->subtype(child) == sectionType)
+            sections.append(child);
+        else
+            findSections(model, child, sectionType, sections);
+    }
+}
+
+UINT8 UEFIPatch::patchFile(FfsEngine* ffsEngine, const QModelIndex & index, const PatchGroup & group, QVector<int> & appliedLines) const
+{
+    if (!ffsEngine || !index.isValid())
         return ERR_INVALID_PARAMETER;
-    if (model->type(index) == Types::Section && model->subtype(index) == sectionType) {
-        QModelIndex fileIndex = model->findParentOfType(index, Types::File);
-        if (model->type(fileIndex) == Types::File &&
-            model->header(fileIndex).left(sizeof(EFI_GUID)) == fileGuid)
-        {
-            return ffsEngine->patch(index, patches);
+    if (group.compiled)
+        return group.compiled;
+
+    QModelIndexList sections;
+    findSections(ffsEngine->treeModel(), index, group.sectionType, sections);
+
+    // Every line patches the first section it changes, all pending lines are applied to a section at once
+    QVector<bool> done(group.lineNumbers.size(), false);
+    int pending = group.lineNumbers.size();
+    PatchProgram program = group.program;
+    int selectedLines = pending;
+    bool patched = false;
+    for (int i = 0; i < sections.size() && pending > 0; i++) {
+        // Select patches of pending lines after some line is done, patch indexes are kept
+        if (selectedLines != pending) {
+            QVector<bool> selected(group.lineOfPatch.size());
+            for (int j = 0; j < group.lineOfPatch.size(); j++)
+                selected[j] = !done.at(group.lineOfPatch.at(j));
+            program = group.program.select(selected);
+            selectedLines = pending;
         }
-    }
 
-    if (model->rowCount(index) > 0) {
-        for (int i = 0; i < model->rowCount(index); i++) {
-            UINT8 result = patchFile(index.child(i, 0), fileGuid, sectionType, patches);
-            if (!result)
-                break;
-            else if (result != ERR_NOTHING_TO_PATCH)
-                return result;
+        QVector<PatchReplacement> replacements;
+        UINT8 result = ffsEngine->patch(sections.at(i), program, &replacements);
+        if (result == ERR_NOTHING_TO_PATCH)
+            continue;
+        if (result)
+            return result;
+
+        patched = true;
+        for (int j = 0; j < replacements.size(); j++) {
+            int line = group.lineOfPatch.at(replacements.at(j).patch);
+            if (!done.at(line) && replacements.at(j).before != replacements.at(j).after) {
+                done[line] = true;
+                appliedLines.append(group.lineNumbers.at(line));
+                pending--;
+            }
         }
     }
 
-    return ERR_NOTHING_TO_PATCH;
+    return patched ? ERR_SUCCESS : ERR_NOTHING_TO_PATCH;
 }
@@ -19,12 +19,87 @@ WITHOUT WARRANTIES OR REPRESENTATIONS OF ANY KIND, EITHER EXPRESS OR IMPLIED.
 #include <QString>
 #include <QStringList>
 #include <QFileInfo>
+#include <QHash>
+#include <QVector>
 #include <QUuid>
 
 #include "../basetypes.h"
 #include "../ffs.h"
 #include "../ffsengine.h"
 
+// Patch file lines for sections of one type in files with one GUID
+struct PatchGroup {
+    QByteArray guid;
+    UINT8 sectionType;
+    QVector<int> lineNumbers; // Numbers of lines in patch file
+    // All lines compiled once, result of compilation is reported for files found in image
+    PatchProgram program;
+    QVector<int> lineOfPatch; // Index of line in group for every compiled patch
+    UINT8 compiled;
+};
+
+// Patch cache is stored next to patches file with .cache extension
+// PATCH_CACHE_HEADER is followed by PATCH_CACHE_GROUP for every group, each followed by
+// UINT32 patch file line numbers, UINT32 line indexes of compiled patches and compiled program
+// Cache is used only if SHA-1 of patches file matches, it is rewritten otherwise
+
+#define PATCH_CACHE_SIGNATURE "UEFIPCH1"
+#define PATCH_CACHE_SIGNATURE_SIZE 8
+
+// Delta is written instead of patched image with .delta extension
+// PATCH_DELTA_HEADER is followed by PATCH_DELTA_RANGE with new bytes for every changed range
+// Result is base image resized to ResultSize with all ranges copied over it
+
+#define PATCH_DELTA_SIGNATURE "UEFIDLT1"
+#define PATCH_DELTA_SIGNATURE_SIZE 8
+
+#pragma pack(push,1)
+
+typedef struct _PATCH_CACHE_HEADER {
+    UINT8  Signature[PATCH_CACHE_SIGNATURE_SIZE];
+    UINT8  SourceSha1[20];
+    UINT32 GroupCount;
+} PATCH_CACHE_HEADER;
+
+typedef struct _PATCH_CACHE_GROUP {
+    EFI_GUID Guid;
+    UINT8  SectionType;
+    UINT8  Compiled;    // Error of compilation, no program is stored if not ERR_SUCCESS
+    UINT32 LineCount;
+    UINT32 PatchCount;
+    UINT32 ProgramSize;
+} PATCH_CACHE_GROUP;
+
+typedef struct _PATCH_DELTA_HEADER {
+    UINT8  Signature[PATCH_DELTA_SIGNATURE_SIZE];
+    UINT8  BaseSha1[20];
+    UINT8  ResultSha1[20];
+    UINT32 BaseSize;
+    UINT32 ResultSize;
+    UINT32 RangeCount;
+} PATCH_DELTA_HEADER;
+
+typedef struct _PATCH_DELTA_RANGE {
+    UINT32 Offset;
+    UINT32 Size;
+    // New bytes follow
+} PATCH_DELTA_RANGE;
+
+#pragma pack(pop)
+
+// Result of patching one image
+struct PatchSummary {
+    QString path;
+    UINT8 result;
+    QVector<int> appliedLines;
+    // Messages of the engine for this image
+    QStringList messages;
+    // Time of phases in milliseconds
+    qint64 parseTime;
+    qint64 patchTime;
+    qint64 writeTime;
+};
+
 class UEFIPatch : public QObject
 {
     Q_OBJECT
@@ -33,13 +108,24 @@ public:
     explicit UEFIPatch(QObject *parent = 0);
     ~UEFIPatch();
 
-    UINT8 patchFromFile(QString path);
+    UINT8 patchFromFile(QString path, const bool delta = false);
     UINT8 patch(QString path, QString fileGuid, QString findPattern, QString replacePattern);
+    // Patch image files and all image files in directories using pool of workers
+    UINT8 patchBatch(QStringList paths, QString patchesPath, const int workers, const bool delta = false);
+    // Patch one image with its own engine, can be called from worker threads
+    UINT8 patchImage(const QString & path, const QVector<PatchGroup> & groups, const bool delta, PatchSummary & summary) const;
+    // Write patched image made from original image and delta
+    UINT8 applyDelta(QString path, QString deltaPath);
 
 private:
-    UINT8 patchFile(const QModelIndex & index, const QByteArray & fileGuid, const UINT8 sectionType, const QVector<PatchData> & patches);
-    FfsEngine* ffsEngine;
-    TreeModel* model;
+    UINT8 loadPatches(const QString & patchesPath, QVector<PatchGroup> & groups);
+    UINT8 parsePatches(const QByteArray & source, QVector<PatchGroup> & groups);
+    UINT8 readPatchCache(const QString & cachePath, const QByteArray & hash, QVector<PatchGroup> & groups);
+    UINT8 writePatchCache(const QString & cachePath, const QByteArray & hash, const QVector<PatchGroup> & groups);
+    void makeDelta(const QByteArray & base, const QByteArray & result, QByteArray & delta) const;
+    void findSections(TreeModel* model, const QModelIndex & index, const UINT8 sectionType, QModelIndexList & sections) const;
+    UINT8 patchImage(FfsEngine* ffsEngine, const QString & path, const QVector<PatchGroup> & groups, const bool delta, PatchSummary & summary) const;
+    UINT8 patchFile(FfsEngine* ffsEngine, const QModelIndex & index, const PatchGroup & group, QVector<int> & appliedLines) const;
 };
 
 #endif
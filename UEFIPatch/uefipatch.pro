@@ -13,6 +13,11 @@ SOURCES  += uefipatch_main.cpp \
  ../descriptor.cpp \
  ../ffs.cpp \
  ../ffsengine.cpp \
+ ../bytepattern.cpp \
+ ../dumpwriter.cpp \
+ ../imagebuilder.cpp \
+ ../patchprogram.cpp \
+ ../patternset.cpp \
  ../treeitem.cpp \
  ../treemodel.cpp \
  ../LZMA/LzmaCompress.c \
@@ -32,6 +37,11 @@ HEADERS  += uefipatch.h \
  ../peimage.h \
  ../types.h \
  ../ffsengine.h \
+ ../bytepattern.h \
+ ../dumpwriter.h \
+ ../imagebuilder.h \
+ ../patchprogram.h \
+ ../patternset.h \
  ../treeitem.h \
  ../treemodel.h \
  ../LZMA/LzmaCompress.h \
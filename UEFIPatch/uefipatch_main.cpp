@@ -13,6 +13,7 @@ WITHOUT WARRANTIES OR REPRESENTATIONS OF ANY KIND, EITHER EXPRESS OR IMPLIED.
 #include <QCoreApplication>
 #include <QString>
 #include <QStringList>
+#include <QThread>
 #include <iostream>
 #include "uefipatch.h"
 
@@ -27,13 +28,44 @@ int main(int argc, char *argv[])
     UINT8 result = ERR_SUCCESS;
     UINT32 argumentsCount = a.arguments().length();
     
-    if (argumentsCount == 2) {
+    if (argumentsCount == 2 && !a.arguments().at(1).startsWith("-")) {
         result = w.patchFromFile(a.arguments().at(1));
     }
+    else if (argumentsCount == 3 && a.arguments().at(1) == "-d") {
+        result = w.patchFromFile(a.arguments().at(2), true);
+    }
+    else if (argumentsCount == 4 && a.arguments().at(1) == "-a") {
+        result = w.applyDelta(a.arguments().at(2), a.arguments().at(3));
+    }
+    else if (argumentsCount > 2 && a.arguments().at(1) == "-b") {
+        QString patchesPath = "patches.txt";
+        int workers = QThread::idealThreadCount();
+        bool delta = false;
+        QStringList paths;
+        for (UINT32 i = 2; i < argumentsCount; i++) {
+            QString argument = a.arguments().at(i);
+            if (argument == "-p" && i + 1 < argumentsCount)
+                patchesPath = a.arguments().at(++i);
+            else if (argument == "-j" && i + 1 < argumentsCount)
+                workers = a.arguments().at(++i).toInt();
+            else if (argument == "-d")
+                delta = true;
+            else
+                paths.append(argument);
+        }
+        if (workers < 1)
+            workers = 1;
+        result = w.patchBatch(paths, patchesPath, workers, delta);
+    }
     else {
         std::cout << "UEFIPatch 0.2.1 - UEFI image file patching utility" << std::endl << std::endl <<
-            "Usage: UEFIPatch image_file" << std::endl << std::endl <<
-            "Patches will be read from patches.txt file\n";
+            "Usage: UEFIPatch [-d] image_file" << std::endl <<
+            "       UEFIPatch -b [-d] [-p patches_file] [-j workers] image_file|image_dir..." << std::endl <<
+            "       UEFIPatch -a image_file delta_file" << std::endl << std::endl <<
+            "Patches will be read from patches.txt file, unless other file is specified by -p\n" <<
+            "In batch mode images are patched in parallel and summary is printed for every image\n" <<
+            "With -d only changed bytes are written to image_file.delta instead of image_file.patched\n" <<
+            "With -a image_file.patched is made from original image and its delta\n";
         return ERR_SUCCESS;
     }
 
@@ -57,7 +89,7 @@ int main(int argc, char *argv[])
         std::cout << "Pattern format mismatch" << std::endl;
         break;
     case ERR_INVALID_FILE:
-        std::cout << "patches.txt file not found or can't be read" << std::endl;
+        std::cout << "Patches or delta file not found or invalid" << std::endl;
         break;
     case ERR_FILE_OPEN:
         std::cout << "Input file not found" << std::endl;
@@ -68,6 +100,9 @@ int main(int argc, char *argv[])
     case ERR_FILE_WRITE:
         std::cout << "Output file can't be written" << std::endl;
         break;
+    case ERR_DELTA_BASE_MISMATCH:
+        std::cout << "Delta was made for another image" << std::endl;
+        break;
     default:
         std::cout << "Error " << result << std::endl;
     }
@@ -89,6 +89,8 @@ typedef uint16_t  CHAR16;
 #define ERR_PATCH_OFFSET_OUT_OF_BOUNDS      39
 #define ERR_INVALID_SYMBOL                  40
 #define ERR_NOTHING_TO_PATCH                41
+#define ERR_MEMORY_BUDGET_EXCEEDED          42
+#define ERR_DELTA_BASE_MISMATCH             43
 #define ERR_NOT_IMPLEMENTED                 0xFF
 
 // UDK porting definitions
@@ -142,6 +144,17 @@ typedef uint16_t  CHAR16;
 #define SEARCH_MODE_BODY    2
 #define SEARCH_MODE_ALL     3
 
+// Item offset is not known, i.e. item was not parsed from opened image
+#define OFFSET_UNKNOWN 0xFFFFFFFF
+
+// Relocation fixup is stored as image offset with relocation type in upper bits
+#define RELOCATION_TYPE_SHIFT  28
+#define RELOCATION_OFFSET_MASK 0x0FFFFFFF
+
+// Default decompression memory budgets
+#define DEFAULT_IMAGE_DECOMPRESSION_BUDGET   0x40000000
+#define DEFAULT_SECTION_DECOMPRESSION_BUDGET 0x10000000
+
 // EFI GUID
 typedef struct {
     UINT8 Data[16];
@@ -0,0 +1,303 @@
+/* bytepattern.cpp
+
+Copyright (c) 2014, Nikolaj Schlej. All rights reserved.
+This program and the accompanying materials
+are licensed and made available under the terms and conditions of the BSD License
+which accompanies this distribution.  The full text of the license may be found at
+http://opensource.org/licenses/bsd-license.php
+
+THE PROGRAM IS DISTRIBUTED UNDER THE BSD LICENSE ON AN "AS IS" BASIS,
+WITHOUT WARRANTIES OR REPRESENTATIONS OF ANY KIND, EITHER EXPRESS OR IMPLIED.
+
+*/
+
+#include <string.h>
+
+#include "bytepattern.h"
+
+BytePattern::BytePattern()
+    : anchorOffset(0), anchorLength(0), scanOffset(0), scanMask(0)
+{
+}
+
+// Bytes other than these are rare in firmware images and make better search candidates
+static bool isRareByte(const UINT8 value, const UINT8 mask)
+{
+    return value != 0x00 && value != mask;
+}
+
+// Latin-1 letters with case variants differing only in bit 5
+static bool isCaseFoldable(const UINT16 code)
+{
+    UINT16 lower = code | 0x20;
+    if (lower >= 'a' && lower <= 'z')
+        return true;
+    return lower >= 0xE0 && lower <= 0xFE && lower != 0xF7;
+}
+
+static INT8 hexNibble(const char c)
+{
+    if (c >= '0' && c <= '9')
+        return c - '0';
+    if (c >= 'a' && c <= 'f')
+        return c - 'a' + 10;
+    if (c >= 'A' && c <= 'F')
+        return c - 'A' + 10;
+    return -1;
+}
+
+UINT8 BytePattern::compile(const QByteArray & hexPattern)
+{
+    patternValues.clear();
+    patternMasks.clear();
+    anchorOffset = anchorLength = scanOffset = scanMask = 0;
+
+    if (hexPattern.isEmpty())
+        return ERR_INVALID_PARAMETER;
+
+    int length = hexPattern.size();
+    patternValues.reserve((length + 1) / 2);
+    patternMasks.reserve((length + 1) / 2);
+    for (int i = 0; i < length; i += 2) {
+        UINT8 value = 0;
+        UINT8 mask = 0;
+        for (int j = 0; j < 2; j++) {
+            value <<= 4;
+            mask <<= 4;
+            // Missing low nibble of the last byte is a wildcard
+            if (i + j >= length || hexPattern.at(i + j) == '.')
+                continue;
+            INT8 nibble = hexNibble(hexPattern.at(i + j));
+            if (nibble < 0) {
+                patternValues.clear();
+                patternMasks.clear();
+                return ERR_INVALID_PARAMETER;
+            }
+            value |= nibble;
+            mask |= 0x0F;
+        }
+        patternValues.append((char)value);
+        patternMasks.append((char)mask);
+    }
+
+    prepare();
+    return ERR_SUCCESS;
+}
+
+UINT8 BytePattern::compileText(const QString & text, const bool unicode, const bool caseSensitive)
+{
+    patternValues.clear();
+    patternMasks.clear();
+    anchorOffset = anchorLength = scanOffset = scanMask = 0;
+
+    if (text.isEmpty())
+        return ERR_INVALID_PARAMETER;
+
+    int length = text.size();
+    patternValues.reserve(unicode ? length * 2 : length);
+    patternMasks.reserve(unicode ? length * 2 : length);
+    for (int i = 0; i < length; i++) {
+        UINT16 code = text.at(i).unicode();
+        // Characters beyond Latin-1 can't be encoded as ASCII
+        if (!unicode && code > 0xFF) {
+            patternValues.clear();
+            patternMasks.clear();
+            return ERR_INVALID_PARAMETER;
+        }
+
+        UINT8 mask = (caseSensitive || !isCaseFoldable(code)) ? 0xFF : 0xDF;
+        patternValues.append((char)(code & mask));
+        patternMasks.append((char)mask);
+        // UTF-16LE high byte
+        if (unicode) {
+            patternValues.append((char)(code >> 8));
+            patternMasks.append((char)0xFF);
+        }
+    }
+
+    prepare();
+    return ERR_SUCCESS;
+}
+
+UINT8 BytePattern::compile(const QByteArray & values, const QByteArray & masks)
+{
+    patternValues.clear();
+    patternMasks.clear();
+    anchorOffset = anchorLength = scanOffset = scanMask = 0;
+
+    if (values.isEmpty() || values.size() != masks.size())
+        return ERR_INVALID_PARAMETER;
+    for (int i = 0; i < values.size(); i++)
+        if ((UINT8)values.at(i) & ~(UINT8)masks.at(i))
+            return ERR_INVALID_PARAMETER;
+
+    patternValues = values;
+    patternMasks = masks;
+    prepare();
+    return ERR_SUCCESS;
+}
+
+void BytePattern::prepare()
+{
+    // Find longest run of fully defined bytes, runs with rare bytes are preferred
+    bool anchorRare = false;
+    bool runRare = false;
+    int runOffset = 0;
+    for (int i = 0; i <= patternMasks.size(); i++) {
+        if (i < patternMasks.size() && (UINT8)patternMasks.at(i) == 0xFF) {
+            runRare = runRare || isRareByte(patternValues.at(i), 0xFF);
+            continue;
+        }
+        int runLength = i - runOffset;
+        if (runLength && (runRare > anchorRare || (runRare == anchorRare && runLength > anchorLength))) {
+            anchorOffset = runOffset;
+            anchorLength = runLength;
+            anchorRare = runRare;
+        }
+        runOffset = i + 1;
+        runRare = false;
+    }
+
+    // Choose the byte searched first: rare values, then most defined bits, then anchor bytes are preferred
+    int bestScore = 0;
+    for (int i = 0; i < patternMasks.size(); i++) {
+        UINT8 mask = patternMasks.at(i);
+        if (!mask)
+            continue;
+        int score = (isRareByte(patternValues.at(i), mask) ? 0x100 : 0) + mask * 2
+            + (i >= anchorOffset && i < anchorOffset + anchorLength ? 1 : 0);
+        if (score > bestScore) {
+            bestScore = score;
+            scanOffset = i;
+            scanMask = mask;
+        }
+    }
+}
+
+bool BytePattern::isEmpty() const
+{
+    return patternValues.isEmpty();
+}
+
+bool BytePattern::isWildcard() const
+{
+    for (int i = 0; i < patternMasks.size(); i++)
+        if (patternMasks.at(i))
+            return false;
+    return true;
+}
+
+int BytePattern::size() const
+{
+    return patternValues.size();
+}
+
+QByteArray BytePattern::values() const
+{
+    return patternValues;
+}
+
+QByteArray BytePattern::masks() const
+{
+    return patternMasks;
+}
+
+QByteArray BytePattern::hexPattern() const
+{
+    static const char digits[] = "0123456789ABCDEF";
+    QByteArray hex;
+    hex.reserve(patternValues.size() * 2);
+    for (int i = 0; i < patternValues.size(); i++) {
+        UINT8 value = (UINT8)patternValues.at(i);
+        UINT8 mask = (UINT8)patternMasks.at(i);
+        hex.append((mask & 0xF0) == 0xF0 ? digits[value >> 4] : '.');
+        hex.append((mask & 0x0F) == 0x0F ? digits[value & 0x0F] : '.');
+    }
+    return hex;
+}
+
+QByteArray BytePattern::anchor() const
+{
+    return patternValues.mid(anchorOffset, anchorLength);
+}
+
+int BytePattern::anchorPosition() const
+{
+    return anchorOffset;
+}
+
+bool BytePattern::matchesAt(const char* data) const
+{
+    const char* values = patternValues.constData();
+    const char* masks = patternMasks.constData();
+    int length = patternValues.size();
+    for (int i = 0; i < length; i++)
+        if (((UINT8)data[i] & (UINT8)masks[i]) != (UINT8)values[i])
+            return false;
+    return true;
+}
+
+INT32 BytePattern::indexIn(const char* data, const UINT32 size, const UINT32 from) const
+{
+    UINT32 length = patternValues.size();
+    if (!data || !length || size < length || from > size - length)
+        return -1;
+
+    // Last possible match position
+    UINT32 last = size - length;
+
+    // All bytes are wildcards
+    if (!scanMask)
+        return from;
+
+    // Search for candidates with memchr, C libraries vectorize it
+    if (scanMask == 0xFF) {
+        const char scanByte = patternValues.at(scanOffset);
+        const char* current = data + from + scanOffset;
+        const char* end = data + last + scanOffset + 1;
+        while (current < end) {
+            current = (const char*)memchr(current, scanByte, end - current);
+            if (!current)
+                return -1;
+
+            const char* candidate = current - scanOffset;
+            if (matchesAt(candidate))
+                return candidate - data;
+            current++;
+        }
+        return -1;
+    }
+
+    // Partially defined byte, i.e. case-insensitive letter, is checked 8 bytes at a time
+    const UINT64 ones = 0x0101010101010101ULL;
+    const UINT64 highs = 0x8080808080808080ULL;
+    const UINT64 masks = ones * scanMask;
+    const UINT64 values = ones * (UINT8)patternValues.at(scanOffset);
+    const char* scan = data + scanOffset;
+    UINT32 i = from;
+    while (i <= last) {
+        UINT32 count = 1;
+        if (last - i >= 7) {
+            UINT64 word;
+            memcpy(&word, scan + i, sizeof(word));
+            // Zero byte in difference means candidate position
+            UINT64 difference = (word & masks) ^ values;
+            if (!((difference - ones) & ~difference & highs)) {
+                i += 8;
+                continue;
+            }
+            count = 8;
+        }
+        for (UINT32 j = i; j < i + count; j++)
+            if (((UINT8)scan[j] & scanMask) == (UINT8)patternValues.at(scanOffset) && matchesAt(data + j))
+                return j;
+        i += count;
+    }
+
+    return -1;
+}
+
+INT32 BytePattern::indexIn(const QByteArray & data, const UINT32 from) const
+{
+    return indexIn(data.constData(), data.size(), from);
+}
@@ -0,0 +1,66 @@
+/* bytepattern.h
+
+Copyright (c) 2014, Nikolaj Schlej. All rights reserved.
+This program and the accompanying materials
+are licensed and made available under the terms and conditions of the BSD License
+which accompanies this distribution.  The full text of the license may be found at
+http://opensource.org/licenses/bsd-license.php
+
+THE PROGRAM IS DISTRIBUTED UNDER THE BSD LICENSE ON AN "AS IS" BASIS,
+WITHOUT WARRANTIES OR REPRESENTATIONS OF ANY KIND, EITHER EXPRESS OR IMPLIED.
+
+*/
+
+#ifndef __BYTEPATTERN_H__
+#define __BYTEPATTERN_H__
+
+#include <QByteArray>
+#include <QString>
+
+#include "basetypes.h"
+
+// Hex pattern with '.' nibble wildcards or text compiled to value and mask bytes
+// Data is matched as raw bytes, without conversion to hex string or text
+class BytePattern
+{
+public:
+    BytePattern();
+
+    // Compile hex pattern, odd length pattern ends with high nibble of the last byte
+    UINT8 compile(const QByteArray & hexPattern);
+    // Compile text as ASCII or UTF-16LE bytes, case of Latin-1 letters is ignored by masking bit 5
+    UINT8 compileText(const QString & text, const bool unicode, const bool caseSensitive);
+    // Use value and mask bytes compiled before, masked out value bits must be zero
+    UINT8 compile(const QByteArray & values, const QByteArray & masks);
+
+    // Reading operations
+    bool isEmpty() const;
+    bool isWildcard() const;
+    int size() const;
+    QByteArray values() const;
+    QByteArray masks() const;
+    // Hex pattern with '.' for nibbles not fully defined
+    QByteArray hexPattern() const;
+    // Longest run of fully defined bytes, preferably with rare ones, and its position in pattern
+    QByteArray anchor() const;
+    int anchorPosition() const;
+
+    // Matching operations, return -1 if pattern is not found
+    bool matchesAt(const char* data) const;
+    INT32 indexIn(const char* data, const UINT32 size, const UINT32 from = 0) const;
+    INT32 indexIn(const QByteArray & data, const UINT32 from = 0) const;
+
+private:
+    QByteArray patternValues;
+    QByteArray patternMasks;
+    // Longest run of fully defined bytes, used to find match candidates
+    int anchorOffset;
+    int anchorLength;
+    // Byte searched first, 0x00 and 0xFF are avoided as most common in images
+    int scanOffset;
+    UINT8 scanMask;
+
+    void prepare();
+};
+
+#endif
@@ -0,0 +1,396 @@
+/* dumpwriter.cpp
+
+Copyright (c) 2014, Nikolaj Schlej. All rights reserved.
+This program and the accompanying materials
+are licensed and made available under the terms and conditions of the BSD License
+which accompanies this distribution.  The full text of the license may be found at
+http://opensource.org/licenses/bsd-license.php
+
+THE PROGRAM IS DISTRIBUTED UNDER THE BSD LICENSE ON AN "AS IS" BASIS,
+WITHOUT WARRANTIES OR REPRESENTATIONS OF ANY KIND, EITHER EXPRESS OR IMPLIED.
+
+*/
+
+#include <string.h>
+
+#include <QCryptographicHash>
+#include <QDateTime>
+#include <QDir>
+#include <QFileInfo>
+#include <QMutexLocker>
+#include <QRunnable>
+
+#ifdef Q_OS_WIN
+#include <windows.h>
+#else
+#include <unistd.h>
+#endif
+
+#include "dumpwriter.h"
+
+// Parent directories are created by writers of other entries at the same time,
+// so creating of a path can fail on a directory made by another thread and is retried
+#define DUMP_MKPATH_ATTEMPTS 8
+
+static bool makePath(const QString & path)
+{
+    QDir dir;
+    for (int attempt = 0; !dir.mkpath(path); attempt++) {
+        if (attempt == DUMP_MKPATH_ATTEMPTS)
+            return false;
+    }
+    return true;
+}
+
+// Short writes and failed flushes, for example on full disk, are errors too
+static UINT8 writeWholeFile(const QString & path, const QByteArray & data, const QIODevice::OpenMode mode = QFile::WriteOnly)
+{
+    QFile file(path);
+    if (!file.open(mode))
+        return ERR_FILE_OPEN;
+    bool written = (file.write(data) == data.size() && file.flush());
+    file.close();
+    if (!written || file.error() != QFile::NoError)
+        return ERR_FILE_WRITE;
+    return ERR_SUCCESS;
+}
+
+class DumpWriterThread : public QRunnable
+{
+public:
+    DumpWriterThread(DumpWriter* writer)
+        : writer(writer)
+    {
+    }
+
+    void run()
+    {
+        DumpEntry entry;
+        while (writer->takeEntry(entry)) {
+            // After an error entries are taken from the queue without writing them
+            if (writer->error.fetchAndAddOrdered(0))
+                continue;
+            UINT8 result = writer->writeEntry(entry);
+            if (result)
+                writer->error.testAndSetOrdered(0, result);
+        }
+    }
+
+private:
+    DumpWriter* writer;
+};
+
+DumpWriter::DumpWriter(const int writers, const int queueSize)
+    : dumpLayout(DUMP_LAYOUT_TREE), writerCount(writers > 0 ? writers : 1), startedWriters(0), freeSlots(queueSize > 0 ? queueSize : 1), closing(false), error(0),
+    archiveOffset(0), archiveTime(0)
+{
+    pool.setMaxThreadCount(writerCount);
+}
+
+DumpWriter::~DumpWriter()
+{
+    close();
+}
+
+UINT8 DumpWriter::open(const QString & path, const UINT8 layout)
+{
+    if (layout != DUMP_LAYOUT_TREE && layout != DUMP_LAYOUT_DEDUPLICATED && layout != DUMP_LAYOUT_ARCHIVE)
+        return ERR_INVALID_PARAMETER;
+
+    if (layout == DUMP_LAYOUT_ARCHIVE) {
+        // Members are named as files of the tree layout would be
+        QString archivePath = QString(path).append(".tar");
+        if (QFileInfo(archivePath).exists())
+            return ERR_DIR_ALREADY_EXIST;
+        archive.setFileName(archivePath);
+        if (!archive.open(QFile::WriteOnly))
+            return ERR_FILE_OPEN;
+        archiveBuffer.clear();
+        archiveBuffer.reserve(DUMP_ARCHIVE_BUFFER_SIZE);
+        archiveOffset = 0;
+        archiveRoot = QFileInfo(path).fileName().toUtf8();
+        archiveToc.clear();
+        archiveTime = QDateTime::currentDateTime().toTime_t();
+    }
+    else {
+        QDir dir;
+        if (dir.cd(path))
+            return ERR_DIR_ALREADY_EXIST;
+
+        if (!dir.mkpath(path))
+            return ERR_DIR_CREATE;
+    }
+
+    root = path;
+    dumpLayout = layout;
+    blobs.clear();
+    closing = false;
+    error.fetchAndStoreOrdered(0);
+    // Archive is written sequentially
+    startedWriters = (layout == DUMP_LAYOUT_ARCHIVE) ? 1 : writerCount;
+    for (int i = 0; i < startedWriters; i++)
+        pool.start(new DumpWriterThread(this));
+
+    return ERR_SUCCESS;
+}
+
+UINT8 DumpWriter::write(const DumpEntry & entry)
+{
+    UINT8 result = error.fetchAndAddOrdered(0);
+    if (result)
+        return result;
+    if (root.isEmpty())
+        return ERR_INVALID_PARAMETER;
+
+    freeSlots.acquire();
+    queueMutex.lock();
+    queue.enqueue(entry);
+    queueMutex.unlock();
+    usedSlots.release();
+    return ERR_SUCCESS;
+}
+
+UINT8 DumpWriter::close()
+{
+    if (root.isEmpty())
+        return ERR_SUCCESS;
+
+    // Every writer stops when it finds the queue empty after closing
+    queueMutex.lock();
+    closing = true;
+    queueMutex.unlock();
+    usedSlots.release(startedWriters);
+    pool.waitForDone();
+
+    if (dumpLayout == DUMP_LAYOUT_ARCHIVE) {
+        UINT8 result = error.fetchAndAddOrdered(0) ? ERR_SUCCESS : closeArchive();
+        if (!result && !archive.flush())
+            result = ERR_FILE_WRITE;
+        archive.close();
+        if (!result && archive.error() != QFile::NoError)
+            result = ERR_FILE_WRITE;
+        if (result)
+            error.testAndSetOrdered(0, result);
+        archiveBuffer.clear();
+        archiveToc.clear();
+    }
+
+    root.clear();
+    return error.fetchAndAddOrdered(0);
+}
+
+bool DumpWriter::takeEntry(DumpEntry & entry)
+{
+    usedSlots.acquire();
+    QMutexLocker locker(&queueMutex);
+    if (queue.isEmpty())
+        return false;
+    entry = queue.dequeue();
+    freeSlots.release();
+    return true;
+}
+
+UINT8 DumpWriter::writeEntry(const DumpEntry & entry)
+{
+    if (dumpLayout == DUMP_LAYOUT_ARCHIVE)
+        return writeArchiveEntry(entry);
+
+    QString path = entry.path.isEmpty() ? root : QString("%1/%2").arg(root).arg(entry.path);
+
+    if (!makePath(path))
+        return ERR_DIR_CREATE;
+
+    UINT8 result;
+    if (!entry.header.isEmpty()) {
+        result = writeFile(QString("%1/header.bin").arg(path), entry.header);
+        if (result)
+            return result;
+    }
+
+    if (!entry.body.isEmpty()) {
+        result = writeFile(QString("%1/body.bin").arg(path), entry.body);
+        if (result)
+            return result;
+    }
+
+    return writeWholeFile(QString("%1/info.txt").arg(path), entry.info, QFile::Text | QFile::WriteOnly);
+}
+
+UINT8 DumpWriter::writeFile(const QString & path, const QByteArray & data)
+{
+    if (dumpLayout == DUMP_LAYOUT_DEDUPLICATED)
+        return writeBlob(path, data);
+
+    return writeWholeFile(path, data);
+}
+
+UINT8 DumpWriter::writeBlob(const QString & path, const QByteArray & data)
+{
+    QByteArray hash = QCryptographicHash::hash(data, QCryptographicHash::Sha1).toHex();
+    QString blobName = QString("blobs/%1/%2").arg(QString(hash.left(2))).arg(QString(hash.mid(2)));
+    QString blobPath = QString("%1/%2").arg(root).arg(blobName);
+
+    // The first thread with this data writes the blob, others wait for it
+    blobsMutex.lock();
+    bool owner = !blobs.contains(hash);
+    if (owner)
+        blobs.insert(hash, false);
+    else {
+        while (!blobs.value(hash))
+            blobWritten.wait(&blobsMutex);
+    }
+    blobsMutex.unlock();
+
+    if (owner) {
+        UINT8 result;
+        if (!makePath(QString("%1/blobs/%2").arg(root).arg(QString(hash.left(2)))))
+            result = ERR_DIR_CREATE;
+        else
+            result = writeWholeFile(blobPath, data);
+
+        // Waiting threads are released even if the blob was not written, the error stops the dump anyway
+        blobsMutex.lock();
+        blobs.insert(hash, true);
+        blobWritten.wakeAll();
+        blobsMutex.unlock();
+        if (result)
+            return result;
+    }
+
+    // Hard link looks like a normal file for tools reading the dump
+#ifdef Q_OS_WIN
+    if (CreateHardLinkW((LPCWSTR)path.utf16(), (LPCWSTR)blobPath.utf16(), NULL))
+        return ERR_SUCCESS;
+#else
+    if (!link(QFile::encodeName(blobPath).constData(), QFile::encodeName(path).constData()))
+        return ERR_SUCCESS;
+#endif
+
+    return writeWholeFile(QString(path).append(".ref"), blobName.toLatin1(), QFile::Text | QFile::WriteOnly);
+}
+
+UINT8 DumpWriter::writeArchiveEntry(const DumpEntry & entry)
+{
+    QByteArray path = archiveRoot;
+    if (!entry.path.isEmpty())
+        path.append('/').append(entry.path.toUtf8());
+
+    UINT8 result;
+    if (!entry.header.isEmpty()) {
+        result = appendArchiveMember(QByteArray(path).append("/header.bin"), entry.header);
+        if (result)
+            return result;
+    }
+
+    if (!entry.body.isEmpty()) {
+        result = appendArchiveMember(QByteArray(path).append("/body.bin"), entry.body);
+        if (result)
+            return result;
+    }
+
+    return appendArchiveMember(QByteArray(path).append("/info.txt"), entry.info);
+}
+
+// Write octal number to tar header field, terminated by zero
+static void setOctal(char* field, const int length, const UINT64 value)
+{
+    QByteArray octal = QByteArray::number((qulonglong)value, 8).rightJustified(length - 1, '0');
+    memcpy(field, octal.constData(), length - 1);
+    field[length - 1] = '\0';
+}
+
+QByteArray DumpWriter::archiveHeader(const QByteArray & name, const UINT64 size, const char type) const
+{
+    QByteArray header(512, '\0');
+    char* data = header.data();
+    memcpy(data, name.constData(), qMin(name.size(), 100));
+    setOctal(data + 100, 8, 0644);
+    setOctal(data + 108, 8, 0);
+    setOctal(data + 116, 8, 0);
+    setOctal(data + 124, 12, size);
+    setOctal(data + 136, 12, archiveTime);
+    data[156] = type;
+    memcpy(data + 257, "ustar\0" "00", 8);
+
+    // Checksum is calculated with spaces in its own field
+    memset(data + 148, ' ', 8);
+    UINT32 checksum = 0;
+    for (int i = 0; i < 512; i++)
+        checksum += (UINT8)data[i];
+    setOctal(data + 148, 7, checksum);
+    return header;
+}
+
+QByteArray DumpWriter::archiveHeaders(const QByteArray & name, const UINT64 size) const
+{
+    // Length of headers depends on the name only
+    QByteArray headers;
+    if (name.size() > 100) {
+        // Pax record length includes its own decimal length
+        QByteArray record = QByteArray(" path=").append(name).append('\n');
+        int length = record.size();
+        while (length != record.size() + QByteArray::number(length).size())
+            length = record.size() + QByteArray::number(length).size();
+        record.prepend(QByteArray::number(length));
+
+        headers.append(archiveHeader("PaxHeader", record.size(), 'x'));
+        headers.append(record);
+        headers.append(QByteArray((512 - record.size() % 512) % 512, '\0'));
+    }
+
+    headers.append(archiveHeader(name, size, '0'));
+    return headers;
+}
+
+UINT8 DumpWriter::appendArchiveMember(const QByteArray & name, const QByteArray & data)
+{
+    archiveBuffer.append(archiveHeaders(name, data.size()));
+    UINT64 offset = archiveOffset + archiveBuffer.size();
+    archiveToc.append(QByteArray::number((qulonglong)offset)).append(' ')
+        .append(QByteArray::number(data.size())).append(' ')
+        .append(name).append('\n');
+
+    // Large data is written directly instead of copying it to the buffer
+    if (data.size() >= DUMP_ARCHIVE_BUFFER_SIZE) {
+        UINT8 result = flushArchive();
+        if (result)
+            return result;
+        if (archive.write(data) != data.size())
+            return ERR_FILE_WRITE;
+        archiveOffset += data.size();
+    }
+    else
+        archiveBuffer.append(data);
+    archiveBuffer.append(QByteArray((512 - data.size() % 512) % 512, '\0'));
+
+    if (archiveBuffer.size() >= DUMP_ARCHIVE_BUFFER_SIZE)
+        return flushArchive();
+    return ERR_SUCCESS;
+}
+
+UINT8 DumpWriter::flushArchive()
+{
+    if (archiveBuffer.isEmpty())
+        return ERR_SUCCESS;
+    if (archive.write(archiveBuffer) != archiveBuffer.size())
+        return ERR_FILE_WRITE;
+    archiveOffset += archiveBuffer.size();
+    archiveBuffer.clear();
+    return ERR_SUCCESS;
+}
+
+UINT8 DumpWriter::closeArchive()
+{
+    // Table of contents ends with offset of its own data
+    QByteArray name = QByteArray(archiveRoot).append("/toc.txt");
+    UINT64 offset = archiveOffset + archiveBuffer.size() + archiveHeaders(name, 0).size();
+    QByteArray toc = archiveToc;
+    toc.append("toc ").append(QByteArray::number((qulonglong)offset)).append('\n');
+    archiveBuffer.append(archiveHeaders(name, toc.size()));
+    archiveBuffer.append(toc);
+    archiveBuffer.append(QByteArray((512 - toc.size() % 512) % 512, '\0'));
+
+    // End of archive
+    archiveBuffer.append(QByteArray(1024, '\0'));
+    return flushArchive();
+}
@@ -0,0 +1,116 @@
+/* dumpwriter.h
+
+Copyright (c) 2014, Nikolaj Schlej. All rights reserved.
+This program and the accompanying materials
+are licensed and made available under the terms and conditions of the BSD License
+which accompanies this distribution.  The full text of the license may be found at
+http://opensource.org/licenses/bsd-license.php
+
+THE PROGRAM IS DISTRIBUTED UNDER THE BSD LICENSE ON AN "AS IS" BASIS,
+WITHOUT WARRANTIES OR REPRESENTATIONS OF ANY KIND, EITHER EXPRESS OR IMPLIED.
+
+*/
+
+#ifndef __DUMPWRITER_H__
+#define __DUMPWRITER_H__
+
+#include <QAtomicInt>
+#include <QByteArray>
+#include <QFile>
+#include <QHash>
+#include <QMutex>
+#include <QQueue>
+#include <QSemaphore>
+#include <QString>
+#include <QThreadPool>
+#include <QWaitCondition>
+
+#include "basetypes.h"
+
+// I/O threads are waiting for the file system most of the time, so there are more of them than cores
+#define DEFAULT_DUMP_WRITERS    8
+#define DEFAULT_DUMP_QUEUE_SIZE 256
+
+// Dump layouts
+// Tree - directory for every item with its header.bin, body.bin and info.txt
+// Deduplicated - the same tree, but every unique header or body is stored once as blobs/XX/SHA-1 file,
+//   header.bin and body.bin are hard links to it, or header.bin.ref and body.bin.ref files
+//   with path of the blob relative to dump directory if links are not supported
+// Archive - the same tree as members of one POSIX tar file with .tar extension, written by one thread
+//   with large sequential writes, names longer than ustar allows are stored in pax headers
+//   The last member is toc.txt with "offset size name" line for data of every member,
+//   its last line is "toc offset" with offset of toc.txt data, so a module can be read
+//   from the archive after reading its last non-zero block and the table of contents
+#define DUMP_LAYOUT_TREE         0
+#define DUMP_LAYOUT_DEDUPLICATED 1
+#define DUMP_LAYOUT_ARCHIVE      2
+
+// Archive data is written in pieces of this size
+#define DUMP_ARCHIVE_BUFFER_SIZE 0x400000
+
+// Files of one dumped item, path is relative to dump directory and empty for the root item
+struct DumpEntry {
+    QString path;
+    QByteArray header;
+    QByteArray body;
+    QByteArray info;
+};
+
+class DumpWriterThread;
+
+// Writes dumped items on a pool of I/O threads
+// Entries are taken in order of adding, the queue is bounded, so adding waits for writers when it is full
+class DumpWriter
+{
+public:
+    DumpWriter(const int writers = DEFAULT_DUMP_WRITERS, const int queueSize = DEFAULT_DUMP_QUEUE_SIZE);
+    ~DumpWriter();
+
+    // Dump directory or archive must not exist
+    UINT8 open(const QString & path, const UINT8 layout = DUMP_LAYOUT_TREE);
+    // Returns the first error of writers, entries added after it are not written
+    UINT8 write(const DumpEntry & entry);
+    // Wait for all entries to be written
+    UINT8 close();
+
+private:
+    friend class DumpWriterThread;
+
+    QString root;
+    UINT8 dumpLayout;
+    int writerCount;
+    int startedWriters;
+    QThreadPool pool;
+    QQueue<DumpEntry> queue;
+    QMutex queueMutex;
+    QSemaphore freeSlots;
+    QSemaphore usedSlots;
+    bool closing;
+    QAtomicInt error;
+
+    // Blobs of deduplicated layout, true for written ones, false for ones being written by another thread
+    QHash<QByteArray, bool> blobs;
+    QMutex blobsMutex;
+    QWaitCondition blobWritten;
+
+    // Archive layout state, used only by the single writer thread
+    QFile archive;
+    QByteArray archiveBuffer;
+    UINT64 archiveOffset;
+    QByteArray archiveRoot;
+    QByteArray archiveToc;
+    UINT32 archiveTime;
+
+    bool takeEntry(DumpEntry & entry);
+    UINT8 writeEntry(const DumpEntry & entry);
+    UINT8 writeFile(const QString & path, const QByteArray & data);
+    UINT8 writeBlob(const QString & path, const QByteArray & data);
+    UINT8 writeArchiveEntry(const DumpEntry & entry);
+    QByteArray archiveHeader(const QByteArray & name, const UINT64 size, const char type) const;
+    QByteArray archiveHeaders(const QByteArray & name, const UINT64 size) const;
+    UINT8 appendArchiveMember(const QByteArray & name, const QByteArray & data);
+    UINT8 flushArchive();
+    UINT8 closeArchive();
+};
+
+#endif
@@ -11,6 +11,7 @@ WITHWARRANTIES OR REPRESENTATIONS OF ANY KIND, EITHER EXPRESS OR IMPLIED.
 */
 
 #include <math.h>
+#include <stdlib.h>
 
 #include "ffsengine.h"
 #include "types.h"
@@ -24,6 +25,13 @@ WITHWARRANTIES OR REPRESENTATIONS OF ANY KIND, EITHER EXPRESS OR IMPLIED.
 #include "LZMA/LzmaCompress.h"
 #include "LZMA/LzmaDecompress.h"
 
+#include <QElapsedTimer>
+#include <QMutex>
+#include <QMutexLocker>
+#include <QRegExp>
+#include <QRunnable>
+#include <QThreadPool>
+
 #ifdef _CONSOLE
 #include <iostream>
 #endif
@@ -162,6 +170,12 @@ QString errorMessage(UINT8 errorCode)
     case ERR_NOTHING_TO_PATCH:
         msg = QObject::tr("Nothing to patch");
         break;
+    case ERR_MEMORY_BUDGET_EXCEEDED:
+        msg = QObject::tr("Decompression memory budget exceeded");
+        break;
+    case ERR_DELTA_BASE_MISMATCH:
+        msg = QObject::tr("Delta was made for another image");
+        break;
     default:
         msg = QObject::tr("Unknown error %1").arg(errorCode);
         break;
@@ -176,10 +190,29 @@ FfsEngine::FfsEngine(QObject *parent)
     model = new TreeModel();
     oldPeiCoreEntryPoint = 0;
     newPeiCoreEntryPoint = 0;
+    imageBudget = DEFAULT_IMAGE_DECOMPRESSION_BUDGET;
+    sectionBudget = DEFAULT_SECTION_DECOMPRESSION_BUDGET;
+    imageBudgetUsed = 0;
+    parsingImage = false;
+    dumpWriters = DEFAULT_DUMP_WRITERS;
+    compressionOptimization = false;
+    usedAlgorithms = 0;
+    searching = false;
+    searchChunksReported = 0;
+    searchType = 0;
+    searchMode = SEARCH_MODE_ALL;
+    searchUnicode = false;
+#ifdef _CONSOLE
+    collectMessages = false;
+#endif
 }
 
 FfsEngine::~FfsEngine(void)
 {
+    // Stop search without reporting results
+    searchCancelled.fetchAndStoreOrdered(1);
+    searchPool.waitForDone();
+    deleteSearchChunks();
     delete model;
 }
 
@@ -188,16 +221,43 @@ TreeModel* FfsEngine::treeModel() const
     return model;
 }
 
+UINT32 FfsEngine::snapshot() const
+{
+    return model->snapshot();
+}
+
+UINT8 FfsEngine::restore(const UINT32 snapshot)
+{
+    // Cached reconstruction data can belong to undone changes
+    reconstructedSections.clear();
+    optimizationAttempts.clear();
+    return model->restore(snapshot);
+}
+
 void FfsEngine::msg(const QString & message, const QModelIndex & index)
 {
+    QMutexLocker locker(&messageMutex);
 #ifndef _CONSOLE 
     messageItems.enqueue(MessageListItem(message, NULL, 0, index));
 #else
-    std::cout << message.toLatin1().constData() << std::endl;
+    if (collectMessages)
+        messageLines.append(message);
+    else
+        std::cout << message.toLatin1().constData() << std::endl;
 #endif
 }
 
-#ifndef _CONSOLE
+#ifdef _CONSOLE
+void FfsEngine::setCollectMessages(const bool collect)
+{
+    collectMessages = collect;
+}
+
+QStringList FfsEngine::collectedMessages() const
+{
+    return messageLines;
+}
+#else
 QQueue<MessageListItem> FfsEngine::messages() const
 {
     return messageItems;
@@ -227,6 +287,13 @@ UINT8 FfsEngine::parseImageFile(const QByteArray & buffer)
 {
     oldPeiCoreEntryPoint = 0;
     newPeiCoreEntryPoint = 0;
+    imageBudgetUsed = 0;
+    usedAlgorithms = 0;
+    relocationIndex.clear();
+    volumeBases.clear();
+    itemLocations.clear();
+    spaceProvenance.clear();
+    openedImage = buffer;
     UINT32 capsuleHeaderSize = 0;
     FLASH_DESCRIPTOR_HEADER* descriptorHeader = NULL;
     QModelIndex index;
@@ -239,6 +306,9 @@ UINT8 FfsEngine::parseImageFile(const QByteArray & buffer)
         return ERR_INVALID_PARAMETER;
     }
 
+    // Per-image budget is charged only by decompression done while parsing the image
+    parsingImage = true;
+
     // Check buffer for being normal EFI capsule header
     if (buffer.startsWith(EFI_CAPSULE_GUID)) {
         // Get info
@@ -253,6 +323,7 @@ UINT8 FfsEngine::parseImageFile(const QByteArray & buffer)
             .arg(capsuleHeader->CapsuleImageSize, 8, 16, QChar('0'));
         // Add tree item
         index = model->addItem(Types::Capsule, Subtypes::UefiCapsule, COMPRESSION_ALGORITHM_NONE, name, "", info, header, body);
+        model->setOffset(index, 0);
     }
 
     // Check buffer for being extended Aptio capsule header
@@ -270,6 +341,7 @@ UINT8 FfsEngine::parseImageFile(const QByteArray & buffer)
         //!TODO: more info about Aptio capsule
         // Add tree item
         index = model->addItem(Types::Capsule, Subtypes::AptioCapsule, COMPRESSION_ALGORITHM_NONE, name, "", info, header, body);
+        model->setOffset(index, 0);
     }
 
     // Skip capsule header to have flash chip image
@@ -284,8 +356,13 @@ UINT8 FfsEngine::parseImageFile(const QByteArray & buffer)
         // Parse as Intel image
         QModelIndex imageIndex;
         result = parseIntelImage(flashImage, imageIndex, index);
-        if (result != ERR_INVALID_FLASH_DESCRIPTOR)
+        model->setOffset(imageIndex, 0);
+        if (result != ERR_INVALID_FLASH_DESCRIPTOR) {
+            parsingImage = false;
+            updateItemLocations();
+            model->setJournalEnabled(true);
             return result;
+        }
     }
 
     // Get info
@@ -295,7 +372,12 @@ UINT8 FfsEngine::parseImageFile(const QByteArray & buffer)
 
     // Add tree item
     index = model->addItem(Types::Image, Subtypes::BiosImage, COMPRESSION_ALGORITHM_NONE, name, "", info, QByteArray(), flashImage, QByteArray(), index);
-    return parseBios(flashImage, index);
+    model->setOffset(index, 0);
+    result = parseBios(flashImage, index);
+    parsingImage = false;
+    updateItemLocations();
+    model->setJournalEnabled(true);
+    return result;
 }
 
 UINT8 FfsEngine::parseIntelImage(const QByteArray & intelImage, QModelIndex & index, const QModelIndex & parent)
@@ -491,7 +573,8 @@ UINT8 FfsEngine::parseIntelImage(const QByteArray & intelImage, QModelIndex & in
     // VSCC table
 
     // Add descriptor tree item
-    model->addItem(Types::Region, Subtypes::DescriptorRegion, COMPRESSION_ALGORITHM_NONE, name, "", info, QByteArray(), body, QByteArray(), index);
+    QModelIndex descriptorIndex = model->addItem(Types::Region, Subtypes::DescriptorRegion, COMPRESSION_ALGORITHM_NONE, name, "", info, QByteArray(), body, QByteArray(), index);
+    model->setOffset(descriptorIndex, 0);
     
     // Sort regions in ascending order
     qSort(offsets);
@@ -503,21 +586,25 @@ UINT8 FfsEngine::parseIntelImage(const QByteArray & intelImage, QModelIndex & in
         if (offsets.at(i) == gbeBegin) {
             QModelIndex gbeIndex;
             result = parseGbeRegion(gbe, gbeIndex, index);
+            model->setOffset(gbeIndex, gbeBegin);
         }
         // Parse ME region
         else if (offsets.at(i) == meBegin) {
             QModelIndex meIndex;
             result = parseMeRegion(me, meIndex, index);
+            model->setOffset(meIndex, meBegin);
         }
         // Parse BIOS region
         else if (offsets.at(i) == biosBegin) {
             QModelIndex biosIndex;
             result = parseBiosRegion(bios, biosIndex, index);
+            model->setOffset(biosIndex, biosBegin);
         }
         // Parse PDR region
         else if (offsets.at(i) == pdrBegin) {
             QModelIndex pdrIndex;
             result = parsePdrRegion(pdr, pdrIndex, index);
+            model->setOffset(pdrIndex, pdrBegin);
         }
         if (result)
             return result;
@@ -645,7 +732,8 @@ UINT8 FfsEngine::parseBios(const QByteArray & bios, const QModelIndex & parent)
         info = tr("Size: %1")
             .arg(padding.size(), 8, 16, QChar('0'));
         // Add tree item
-        model->addItem(Types::Padding, 0, COMPRESSION_ALGORITHM_NONE, name, "", info, QByteArray(), padding, QByteArray(), parent);
+        QModelIndex paddingIndex = model->addItem(Types::Padding, 0, COMPRESSION_ALGORITHM_NONE, name, "", info, QByteArray(), padding, QByteArray(), parent);
+        model->setOffset(paddingIndex, 0);
     }
 
     // Search for and parse all volumes
@@ -668,7 +756,8 @@ UINT8 FfsEngine::parseBios(const QByteArray & bios, const QModelIndex & parent)
             info = tr("Size: %1")
                 .arg(padding.size(), 8, 16, QChar('0'));
             // Add tree item
-            model->addItem(Types::Padding, 0, COMPRESSION_ALGORITHM_NONE, name, "", info, QByteArray(), padding, QByteArray(), parent);
+            QModelIndex paddingIndex = model->addItem(Types::Padding, 0, COMPRESSION_ALGORITHM_NONE, name, "", info, QByteArray(), padding, QByteArray(), parent);
+            model->setOffset(paddingIndex, prevVolumeOffset + prevVolumeSize);
         }
 
         // Get volume size
@@ -707,6 +796,7 @@ UINT8 FfsEngine::parseBios(const QByteArray & bios, const QModelIndex & parent)
         // Parse volume
         QModelIndex index;
         UINT8 result = parseVolume(bios.mid(volumeOffset, volumeSize), index, parent);
+        model->setOffset(index, volumeOffset);
         if (result)
             msg(tr("parseBios: Volume parsing failed with error %1").arg(result), parent);
 
@@ -733,7 +823,8 @@ UINT8 FfsEngine::parseBios(const QByteArray & bios, const QModelIndex & parent)
                 info = tr("Size: %2")
                     .arg(padding.size(), 8, 16, QChar('0'));
                 // Add tree item
-                model->addItem(Types::Padding, 0, COMPRESSION_ALGORITHM_NONE, name, "", info, QByteArray(), padding, QByteArray(), parent);
+                QModelIndex paddingIndex = model->addItem(Types::Padding, 0, COMPRESSION_ALGORITHM_NONE, name, "", info, QByteArray(), padding, QByteArray(), parent);
+                model->setOffset(paddingIndex, prevVolumeOffset + prevVolumeSize);
             }
             break;
         }
@@ -933,6 +1024,7 @@ UINT8  FfsEngine::parseVolume(const QByteArray & volume, QModelIndex & index, co
         // Parse file
         QModelIndex fileIndex;
         result = parseFile(file, fileIndex, empty == '\xFF' ? ERASE_POLARITY_TRUE : ERASE_POLARITY_FALSE, index);
+        model->setOffset(fileIndex, fileOffset - headerSize);
         if (result && result != ERR_VOLUMES_NOT_FOUND)
             msg(tr("parseVolume: FFS file parsing failed with error %1").arg(result), index);
 
@@ -947,6 +1039,9 @@ UINT8  FfsEngine::parseVolume(const QByteArray & volume, QModelIndex & index, co
         fileOffset = ALIGN8(fileOffset);
     }
 
+    // Calculate volume base once, reconstruction and address lookups use it
+    volumeBases.insert(index.internalPointer(), calculateVolumeBase(index));
+
     return ERR_SUCCESS;
 }
 
@@ -1140,6 +1235,7 @@ UINT8 FfsEngine::parseSections(const QByteArray & body, const QModelIndex & pare
         // Parse section
         QModelIndex sectionIndex;
         result = parseSection(body.mid(sectionOffset, sectionSize), sectionIndex, parent);
+        model->setOffset(sectionIndex, sectionOffset);
         if (result)
             return result;
 
@@ -1177,21 +1273,31 @@ UINT8 FfsEngine::parseSection(const QByteArray & section, QModelIndex & index, c
         header = section.left(sizeof(EFI_COMPRESSION_SECTION));
         body = section.mid(sizeof(EFI_COMPRESSION_SECTION), sectionSize - sizeof(EFI_COMPRESSION_SECTION));
         algorithm = COMPRESSION_ALGORITHM_UNKNOWN;
-        // Decompress section
-        result = decompress(body, compressedSectionHeader->CompressionType, decompressed, &algorithm);
-        if (result)
+        // Decompress section, unless nothing needed can be inside
+        bool filteredOut = !parseFilter.isEmpty() && !mayContainSelected(parseFilter, model->findParentOfType(parent, Types::File));
+        if (filteredOut)
             parseCurrentSection = false;
+        else {
+            result = decompress(body, compressedSectionHeader->CompressionType, decompressed, &algorithm);
+            if (result)
+                parseCurrentSection = false;
+        }
         
         // Get info
-        info = tr("Type: %1\nSize: %2\nCompression type: %3\nDecompressed size: %4")
+        info = tr("Type: %1\nSize: %2\nCompression type: %3\nDecompressed size: %4%5")
             .arg(sectionHeader->Type, 2, 16, QChar('0'))
             .arg(body.size(), 6, 16, QChar('0'))
             .arg(compressionTypeToQString(algorithm))
-            .arg(compressedSectionHeader->UncompressedLength, 8, 16, QChar('0'));
+            .arg(compressedSectionHeader->UncompressedLength, 8, 16, QChar('0'))
+            .arg(filteredOut ? tr("\nNot decompressed: filtered out") : "");
 
         // Add tree item
         index = model->addItem(Types::Section, sectionHeader->Type, algorithm, name, "", info, header, body, QByteArray(), parent, mode);
 
+        // Filtered out sections are left unparsed without a message
+        if (filteredOut)
+            break;
+
         // Show message
         if (!parseCurrentSection) 
             msg(tr("parseSection: Decompression failed with error %1").arg(result), index);
@@ -1227,10 +1333,17 @@ UINT8 FfsEngine::parseSection(const QByteArray & section, QModelIndex & index, c
             .arg(guidDefinedSectionHeader->Attributes, 4, 16, QChar('0'));
 
         UINT8 algorithm = COMPRESSION_ALGORITHM_NONE;
+        bool filteredOut = false;
         // Check if section requires processing
         if (guidDefinedSectionHeader->Attributes & EFI_GUIDED_SECTION_PROCESSING_REQUIRED) {
+            // Compressed data is not processed, unless something needed can be inside
+            if (!parseFilter.isEmpty() && !mayContainSelected(parseFilter, model->findParentOfType(parent, Types::File))) {
+                filteredOut = true;
+                parseCurrentSection = false;
+                info += tr("\nNot processed: filtered out");
+            }
             // Tiano compressed section
-            if (QByteArray((const char*)&guidDefinedSectionHeader->SectionDefinitionGuid, sizeof(EFI_GUID)) == EFI_GUIDED_SECTION_TIANO) {
+            else if (QByteArray((const char*)&guidDefinedSectionHeader->SectionDefinitionGuid, sizeof(EFI_GUID)) == EFI_GUIDED_SECTION_TIANO) {
                 algorithm = COMPRESSION_ALGORITHM_UNKNOWN;
                 info += tr("\nCompression type: Tiano");
                 result = decompress(body, EFI_STANDARD_COMPRESSION, decompressed, &algorithm);
@@ -1284,6 +1397,9 @@ UINT8 FfsEngine::parseSection(const QByteArray & section, QModelIndex & index, c
         if (msgInvalidCrc)
             msg(tr("parseSection: GUID defined section with invalid CRC32"), index);
 
+        // Filtered out sections are left unparsed without a message
+        if (filteredOut)
+            break;
         if (!parseCurrentSection) {
             msg(tr("parseSection: GUID defined section can not be processed"), index);
         }
@@ -1339,6 +1455,16 @@ UINT8 FfsEngine::parseSection(const QByteArray & section, QModelIndex & index, c
             if (result)
                 msg(tr("parseSection: Can't get entry point of image file"), index);
         }
+
+        // Index relocations of PEI images, they are rebased every time their file moves
+        if ((sectionHeader->Type == EFI_SECTION_PE32 || sectionHeader->Type == EFI_SECTION_TE) &&
+            (model->subtype(parent) == EFI_FV_FILETYPE_PEI_CORE ||
+            model->subtype(parent) == EFI_FV_FILETYPE_PEIM ||
+            model->subtype(parent) == EFI_FV_FILETYPE_COMBINED_PEIM_DRIVER)) {
+            QVector<UINT32> relocations;
+            if (!getRelocations(body, relocations))
+                relocationIndex.insert(index.internalPointer(), relocations);
+        }
     }
     break;
     case EFI_SECTION_FREEFORM_SUBTYPE_GUID: {
@@ -1487,6 +1613,7 @@ UINT8 FfsEngine::create(const QModelIndex & index, const UINT8 type, const QByte
 
         // Set action
         model->setAction(fileIndex, action);
+        updateNewItemLocations(fileIndex);
     }
     else if (type == Types::File) {
         if (model->type(parent) != Types::Volume)
@@ -1545,6 +1672,11 @@ UINT8 FfsEngine::create(const QModelIndex & index, const UINT8 type, const QByte
 
         // Set action
         model->setAction(fileIndex, action);
+        updateNewItemLocations(fileIndex);
+
+        // Volume base depends on VTF presence
+        if (newHeader.left(sizeof(EFI_GUID)) == EFI_FFS_VOLUME_TOP_FILE_GUID)
+            volumeBases.remove(parent.internalPointer());
 
         // Rebase all PEI-files that follow
         rebasePeiFiles(fileIndex);
@@ -1596,6 +1728,7 @@ UINT8 FfsEngine::create(const QModelIndex & index, const UINT8 type, const QByte
 
             // Set create action
             model->setAction(sectionIndex, action);
+            updateNewItemLocations(sectionIndex);
 
             // Find parent file for rebase
             fileIndex = model->findParentOfType(parent, Types::File);
@@ -1622,6 +1755,7 @@ UINT8 FfsEngine::create(const QModelIndex & index, const UINT8 type, const QByte
 
             // Set create action
             model->setAction(sectionIndex, action);
+            updateNewItemLocations(sectionIndex);
 
             // Find parent file for rebase
             fileIndex = model->findParentOfType(parent, Types::File);
@@ -1642,6 +1776,7 @@ UINT8 FfsEngine::create(const QModelIndex & index, const UINT8 type, const QByte
 
             // Set create action
             model->setAction(sectionIndex, action);
+            updateNewItemLocations(sectionIndex);
 
             // Find parent file for rebase
             fileIndex = model->findParentOfType(parent, Types::File);
@@ -1822,6 +1957,10 @@ UINT8 FfsEngine::remove(const QModelIndex & index)
     // Set action for the item
     model->setAction(index, Actions::Remove);
 
+    // Volume base depends on VTF presence
+    if (model->type(index) == Types::File && model->header(index).left(sizeof(EFI_GUID)) == EFI_FFS_VOLUME_TOP_FILE_GUID)
+        volumeBases.remove(index.parent().internalPointer());
+
     QModelIndex fileIndex;
 
     if (model->type(index) == Types::Volume && model->rowCount(index) > 0)
@@ -1865,6 +2004,32 @@ UINT8 FfsEngine::rebuild(const QModelIndex & index)
 }
 
 // Compression routines
+void FfsEngine::setDumpWriters(const int writers)
+{
+    dumpWriters = writers > 0 ? writers : 1;
+}
+
+void FfsEngine::setParseFilter(const ItemFilter & filter)
+{
+    parseFilter = filter;
+}
+
+void FfsEngine::setDecompressionBudget(const UINT32 perImage, const UINT32 perSection)
+{
+    imageBudget = perImage;
+    sectionBudget = perSection;
+}
+
+UINT32 FfsEngine::imageDecompressionBudget() const
+{
+    return imageBudget;
+}
+
+UINT32 FfsEngine::sectionDecompressionBudget() const
+{
+    return sectionBudget;
+}
+
 UINT8 FfsEngine::decompress(const QByteArray & compressedData, const UINT8 compressionType, QByteArray & decompressedData, UINT8 * algorithm)
 {
     UINT8* data;
@@ -1874,6 +2039,15 @@ UINT8 FfsEngine::decompress(const QByteArray & compressedData, const UINT8 compr
     UINT8* scratch;
     UINT32 scratchSize = 0;
     EFI_TIANO_HEADER* header;
+    INT32 result;
+
+    // Get memory budget available for this section, decompression after parsing is limited by per-section budget only
+    UINT32 budget = sectionBudget;
+    if (parsingImage) {
+        UINT32 imageBudgetLeft = imageBudgetUsed < imageBudget ? imageBudget - imageBudgetUsed : 0;
+        if (budget > imageBudgetLeft)
+            budget = imageBudgetLeft;
+    }
 
     switch (compressionType)
     {
@@ -1896,6 +2070,16 @@ UINT8 FfsEngine::decompress(const QByteArray & compressedData, const UINT8 compr
         if (ERR_SUCCESS != EfiTianoGetInfo(data, dataSize, &decompressedSize, &scratchSize))
             return ERR_STANDARD_DECOMPRESSION_FAILED;
 
+        // Check declared size against memory budget before allocating anything
+        if (decompressedSize > budget) {
+            msg(tr("decompress: declared decompressed size %1 exceeds memory budget of %2 bytes")
+                .arg(decompressedSize, 8, 16, QChar('0'))
+                .arg(budget, 8, 16, QChar('0')));
+            if (algorithm)
+                *algorithm = COMPRESSION_ALGORITHM_UNKNOWN;
+            return ERR_MEMORY_BUDGET_EXCEEDED;
+        }
+
         // Allocate memory
         decompressed = new UINT8[decompressedSize];
         scratch = new UINT8[scratchSize];
@@ -1912,13 +2096,21 @@ UINT8 FfsEngine::decompress(const QByteArray & compressedData, const UINT8 compr
                 delete[] scratch;
                 return ERR_STANDARD_DECOMPRESSION_FAILED;
             }
-            else if (algorithm)
-                *algorithm = COMPRESSION_ALGORITHM_EFI11;
+            else {
+                if (algorithm)
+                    *algorithm = COMPRESSION_ALGORITHM_EFI11;
+                usedAlgorithms |= 1 << COMPRESSION_ALGORITHM_EFI11;
+            }
+        }
+        else {
+            if (algorithm)
+                *algorithm = COMPRESSION_ALGORITHM_TIANO;
+            usedAlgorithms |= 1 << COMPRESSION_ALGORITHM_TIANO;
         }
-        else if (algorithm)
-            *algorithm = COMPRESSION_ALGORITHM_TIANO;
 
         decompressedData = QByteArray((const char*)decompressed, decompressedSize);
+        if (parsingImage)
+            imageBudgetUsed += decompressedSize;
 
         delete[] decompressed;
         delete[] scratch;
@@ -1927,16 +2119,11 @@ UINT8 FfsEngine::decompress(const QByteArray & compressedData, const UINT8 compr
         // Get buffer sizes
         data = (UINT8*)compressedData.constData();
         dataSize = compressedData.size();
+        decompressed = NULL;
 
-        // Get info
-        if (ERR_SUCCESS != LzmaGetInfo(data, dataSize, &decompressedSize))
-            return ERR_CUSTOMIZED_DECOMPRESSION_FAILED;
-
-        // Allocate memory
-        decompressed = new UINT8[decompressedSize];
-
-        // Decompress section data
-        if (ERR_SUCCESS != LzmaDecompress(data, dataSize, decompressed)) {
+        // Decompress section data, output buffer is grown as needed up to the budget
+        result = LzmaDecompressBounded(data, dataSize, budget, (VOID**)&decompressed, &decompressedSize);
+        if (result != ERR_SUCCESS && result != ERR_OUT_OF_MEMORY && dataSize >= sizeof(EFI_COMMON_SECTION_HEADER)) {
             // Intel modified LZMA workaround
             EFI_COMMON_SECTION_HEADER* shittySectionHeader;
             UINT32 shittySectionSize;
@@ -1946,34 +2133,40 @@ UINT8 FfsEngine::decompress(const QByteArray & compressedData, const UINT8 compr
             shittySectionSize = sizeOfSectionHeader(shittySectionHeader);
 
             // Decompress section data once again
-            data += shittySectionSize;
-
-            // Get info again
-            if (ERR_SUCCESS != LzmaGetInfo(data, dataSize, &decompressedSize)) {
-                delete[] decompressed;
-                return ERR_CUSTOMIZED_DECOMPRESSION_FAILED;
+            // Header of such section is not a valid LZMA header, so budget error from the first attempt is kept only if this one fails too
+            if (shittySectionSize < dataSize) {
+                INT32 secondResult = LzmaDecompressBounded(data + shittySectionSize, dataSize - shittySectionSize, budget, (VOID**)&decompressed, &decompressedSize);
+                if (secondResult == ERR_SUCCESS) {
+                    result = ERR_SUCCESS;
+                    if (algorithm)
+                        *algorithm = COMPRESSION_ALGORITHM_IMLZMA;
+                }
+                else if (result != ERR_MEMORY_BUDGET_EXCEEDED)
+                    result = secondResult;
             }
+        }
+        else if (result == ERR_SUCCESS && algorithm)
+            *algorithm = COMPRESSION_ALGORITHM_LZMA;
 
-            // Decompress section data again
-            if (ERR_SUCCESS != LzmaDecompress(data, dataSize, decompressed)) {
-                if (algorithm)
-                    *algorithm = COMPRESSION_ALGORITHM_UNKNOWN;
-                delete[] decompressed;
-                return ERR_CUSTOMIZED_DECOMPRESSION_FAILED;
-            }
-            else {
-                if (algorithm)
-                    *algorithm = COMPRESSION_ALGORITHM_IMLZMA;
-                decompressedData = QByteArray((const char*)decompressed, decompressedSize);
-            }
+        if (result == ERR_MEMORY_BUDGET_EXCEEDED) {
+            msg(tr("decompress: LZMA decompression aborted, data exceeds memory budget of %1 bytes")
+                .arg(budget, 8, 16, QChar('0')));
+            if (algorithm)
+                *algorithm = COMPRESSION_ALGORITHM_UNKNOWN;
+            return ERR_MEMORY_BUDGET_EXCEEDED;
         }
-        else {
+        if (result != ERR_SUCCESS) {
             if (algorithm)
-                *algorithm = COMPRESSION_ALGORITHM_LZMA;
-            decompressedData = QByteArray((const char*)decompressed, decompressedSize);
+                *algorithm = COMPRESSION_ALGORITHM_UNKNOWN;
+            return ERR_CUSTOMIZED_DECOMPRESSION_FAILED;
         }
 
-        delete[] decompressed;
+        decompressedData = QByteArray((const char*)decompressed, decompressedSize);
+        if (parsingImage)
+            imageBudgetUsed += decompressedSize;
+        usedAlgorithms |= 1 << COMPRESSION_ALGORITHM_LZMA;
+
+        free(decompressed);
         return ERR_SUCCESS;
     default:
         msg(tr("decompress: Unknown compression type (%1)").arg(compressionType));
@@ -1983,6 +2176,9 @@ UINT8 FfsEngine::decompress(const QByteArray & compressedData, const UINT8 compr
     }
 }
 
+// EFI 1.1 and Tiano compressors keep their state in static variables
+static QMutex efiTianoCompressMutex(QMutex::Recursive);
+
 UINT8 FfsEngine::compress(const QByteArray & data, const UINT8 algorithm, QByteArray & compressedData)
 {
     UINT8* compressed;
@@ -1996,6 +2192,7 @@ UINT8 FfsEngine::compress(const QByteArray & data, const UINT8 algorithm, QByteA
         break;
     case COMPRESSION_ALGORITHM_EFI11:
     {
+        QMutexLocker locker(&efiTianoCompressMutex);
         UINT64 compressedSize = 0;
         if (EfiCompress(data.constData(), data.size(), NULL, &compressedSize) != ERR_BUFFER_TOO_SMALL)
             return ERR_STANDARD_COMPRESSION_FAILED;
@@ -2011,6 +2208,7 @@ UINT8 FfsEngine::compress(const QByteArray & data, const UINT8 algorithm, QByteA
         break;
     case COMPRESSION_ALGORITHM_TIANO:
     {
+        QMutexLocker locker(&efiTianoCompressMutex);
         UINT64 compressedSize = 0;
         if (TianoCompress(data.constData(), data.size(), NULL, &compressedSize) != ERR_BUFFER_TOO_SMALL)
             return ERR_STANDARD_COMPRESSION_FAILED;
@@ -2065,7 +2263,383 @@ UINT8 FfsEngine::compress(const QByteArray & data, const UINT8 algorithm, QByteA
     }
 }
 
+// Compression optimizer
+// Maximum number of optimizer runs for one volume during reconstruction
+#define MAX_OPTIMIZATION_ATTEMPTS 3
+// Number of steps the required space is divided into for plan selection
+#define OPTIMIZATION_SPACE_STEPS 1024
+
+class CompressionTrial : public QRunnable
+{
+public:
+    CompressionTrial(FfsEngine* engine, const QByteArray & data, const UINT8 algorithm)
+        : engine(engine), data(data), algorithm(algorithm), result(ERR_NOT_IMPLEMENTED), size(0), time(0)
+    {
+        setAutoDelete(false);
+    }
+
+    void run()
+    {
+        // Hold the lock while measuring, so waiting for other EFI 1.1 or Tiano trials is not counted
+        QMutexLocker locker(algorithm == COMPRESSION_ALGORITHM_EFI11 || algorithm == COMPRESSION_ALGORITHM_TIANO ? &efiTianoCompressMutex : NULL);
+        QElapsedTimer timer;
+        timer.start();
+        QByteArray compressed;
+        result = engine->compress(data, algorithm, compressed);
+        size = compressed.size();
+        time = timer.nsecsElapsed() / 1000;
+    }
+
+    FfsEngine* engine;
+    QByteArray data;
+    UINT8 algorithm;
+    UINT8 result;
+    UINT32 size;
+    qint64 time;
+};
+
+void FfsEngine::setCompressionOptimization(const bool enabled, const QVector<UINT8> & algorithms)
+{
+    compressionOptimization = enabled;
+    optimizationAlgorithms = algorithms;
+}
+
+void FfsEngine::findCompressionSections(const QModelIndex & index, const QModelIndex & volumeIndex, QVector<QModelIndex> & sections)
+{
+    for (int i = 0; i < model->rowCount(index); i++) {
+        QModelIndex current = index.child(i, 0);
+        if (model->action(current) == Actions::Remove)
+            continue;
+
+        // Nested volumes have fixed size, their content does not change the size of this volume
+        if (model->type(current) == Types::Volume && current != volumeIndex)
+            continue;
+
+        if (model->type(current) == Types::Section && model->subtype(current) == EFI_SECTION_COMPRESSION) {
+            UINT8 algorithm = model->compression(current);
+            if (algorithm == COMPRESSION_ALGORITHM_NONE || algorithm == COMPRESSION_ALGORITHM_EFI11 ||
+                algorithm == COMPRESSION_ALGORITHM_TIANO || algorithm == COMPRESSION_ALGORITHM_LZMA)
+                sections.append(current);
+            // Sizes of sections inside compressed ones do not matter
+            continue;
+        }
+
+        // Sections inside compressed GUID defined sections change the volume only by recompression of the outer one
+        if (model->type(current) == Types::Section && model->compression(current) != COMPRESSION_ALGORITHM_NONE)
+            continue;
+
+        findCompressionSections(current, volumeIndex, sections);
+    }
+}
+
+UINT8 FfsEngine::optimizeCompression(const QModelIndex & volumeIndex, const UINT32 requiredSpace, QVector<CompressionPlanItem> & plan)
+{
+    plan.clear();
+    if (!volumeIndex.isValid() || model->type(volumeIndex) != Types::Volume)
+        return ERR_INVALID_PARAMETER;
+
+    // Get algorithms to try
+    QVector<UINT8> algorithms = optimizationAlgorithms;
+    if (algorithms.isEmpty()) {
+        if (usedAlgorithms & (1 << COMPRESSION_ALGORITHM_EFI11))
+            algorithms.append(COMPRESSION_ALGORITHM_EFI11);
+        if (usedAlgorithms & (1 << COMPRESSION_ALGORITHM_TIANO))
+            algorithms.append(COMPRESSION_ALGORITHM_TIANO);
+        if (usedAlgorithms & (1 << COMPRESSION_ALGORITHM_LZMA))
+            algorithms.append(COMPRESSION_ALGORITHM_LZMA);
+    }
+    if (algorithms.isEmpty()) {
+        msg(tr("optimizeCompression: no compression algorithms to try"), volumeIndex);
+        return ERR_INVALID_PARAMETER;
+    }
+
+    // Find candidate sections
+    QVector<QModelIndex> sections;
+    findCompressionSections(volumeIndex, volumeIndex, sections);
+    if (sections.isEmpty()) {
+        msg(tr("optimizeCompression: volume has no compressed sections"), volumeIndex);
+        return ERR_ITEM_NOT_FOUND;
+    }
+
+    // Prepare uncompressed bodies and compression trials for every candidate
+    // Modified sections will be compressed anyway, so their current algorithm is tried too
+    QVector<QModelIndex> candidates;
+    QVector<QVector<CompressionTrial*> > trials;
+    QVector<CompressionTrial*> allTrials;
+    for (int i = 0; i < sections.size(); i++) {
+        QByteArray body;
+        if (reconstructSectionBody(sections[i], body))
+            continue;
+
+        UINT8 current = model->compression(sections[i]);
+        QVector<CompressionTrial*> sectionTrials;
+        for (int j = 0; j < algorithms.size(); j++) {
+            if (algorithms[j] != current)
+                sectionTrials.append(new CompressionTrial(this, body, algorithms[j]));
+        }
+        if (model->action(sections[i]) != Actions::NoAction)
+            sectionTrials.prepend(new CompressionTrial(this, body, current));
+        if (sectionTrials.isEmpty())
+            continue;
+
+        candidates.append(sections[i]);
+        trials.append(sectionTrials);
+        allTrials += sectionTrials;
+    }
+
+    // Run all trials in parallel
+    QThreadPool pool;
+    for (int i = 0; i < allTrials.size(); i++)
+        pool.start(allTrials[i]);
+    pool.waitForDone();
+
+    // Select the plan with the least total compression time that saves enough space
+    // This is a multiple-choice knapsack problem, solved over required space divided into steps
+    UINT32 step = requiredSpace / OPTIMIZATION_SPACE_STEPS + 1;
+    UINT32 steps = (requiredSpace + step - 1) / step;
+    const qint64 infinity = Q_INT64_C(0x7FFFFFFFFFFFFFFF);
+    QVector<qint64> best(steps + 1, infinity);
+    QVector<QVector<INT32> > choice(candidates.size());
+    QVector<QVector<UINT32> > previous(candidates.size());
+    QVector<UINT32> currentSizes(candidates.size());
+    best[0] = 0;
+    for (int i = 0; i < candidates.size(); i++) {
+        QModelIndex section = candidates[i];
+        bool modified = (model->action(section) != Actions::NoAction);
+
+        // Current size and time of keeping current algorithm
+        qint64 keepTime = 0;
+        UINT32 currentSize = model->body(section).size();
+        if (modified) {
+            keepTime = trials[i][0]->time;
+            currentSize = trials[i][0]->result ? 0xFFFFFFFF : trials[i][0]->size;
+        }
+        currentSizes[i] = currentSize;
+
+        QVector<qint64> next(steps + 1, infinity);
+        choice[i].fill(-1, steps + 1);
+        previous[i].fill(0, steps + 1);
+        for (UINT32 s = 0; s <= steps; s++) {
+            if (best[s] == infinity)
+                continue;
+            // Keep current algorithm
+            if (best[s] + keepTime < next[s]) {
+                next[s] = best[s] + keepTime;
+                choice[i][s] = -1;
+                previous[i][s] = s;
+            }
+            // Switch to another algorithm
+            for (int j = modified ? 1 : 0; j < trials[i].size(); j++) {
+                CompressionTrial* trial = trials[i][j];
+                if (trial->result || trial->size >= currentSize)
+                    continue;
+                UINT32 saved = qMin((currentSize - trial->size) / step + s, steps);
+                if (best[s] + trial->time < next[saved]) {
+                    next[saved] = best[s] + trial->time;
+                    choice[i][saved] = j;
+                    previous[i][saved] = s;
+                }
+            }
+        }
+        best = next;
+    }
+
+    UINT8 result = ERR_SUCCESS;
+    if (best[steps] == infinity) {
+        msg(tr("optimizeCompression: no compression plan saves %1 bytes").arg(requiredSpace, 8, 16, QChar('0')), volumeIndex);
+        result = ERR_INVALID_VOLUME;
+    }
+    else {
+        // Restore the plan
+        UINT32 s = steps;
+        for (int i = candidates.size() - 1; i >= 0; i--) {
+            INT32 j = choice[i][s];
+            if (j >= 0) {
+                CompressionPlanItem item;
+                item.index = candidates[i];
+                item.oldAlgorithm = model->compression(candidates[i]);
+                item.newAlgorithm = trials[i][j]->algorithm;
+                item.oldSize = currentSizes[i];
+                item.newSize = trials[i][j]->size;
+                item.time = trials[i][j]->time;
+                plan.prepend(item);
+            }
+            s = previous[i][s];
+        }
+    }
+
+    for (int i = 0; i < allTrials.size(); i++)
+        delete allTrials[i];
+
+    return result;
+}
+
+UINT8 FfsEngine::freeVolumeSpace(const QModelIndex & volumeIndex, const UINT32 requiredSpace)
+{
+    // Only called from sequential reconstruction, sections with volumes are not rebuilt in parallel
+    UINT8& attempts = optimizationAttempts[volumeIndex.internalPointer()];
+    if (attempts >= MAX_OPTIMIZATION_ATTEMPTS)
+        return ERR_INVALID_VOLUME;
+    attempts++;
+
+    QVector<CompressionPlanItem> plan;
+    UINT8 result = optimizeCompression(volumeIndex, requiredSpace, plan);
+    if (result)
+        return result;
+
+    // Report and apply the plan
+    qint64 time = 0;
+    UINT32 saved = 0;
+    for (int i = 0; i < plan.size(); i++) {
+        time += plan[i].time;
+        saved += plan[i].oldSize - plan[i].newSize;
+    }
+    msg(tr("optimizeCompression: recompressing %1 section(s) saves %2 bytes of %3 required, compression time %4 ms")
+        .arg(plan.size())
+        .arg(saved, 8, 16, QChar('0'))
+        .arg(requiredSpace, 8, 16, QChar('0'))
+        .arg(time / 1000), volumeIndex);
+
+    // Recompression is done to save the image, not by user, so it's not journaled and can't be undone
+    bool journalEnabled = model->isJournalEnabled();
+    model->setJournalEnabled(false);
+    for (int i = 0; i < plan.size(); i++) {
+        QModelIndex fileIndex = model->findParentOfType(plan[i].index, Types::File);
+        QString name = model->textString(fileIndex).isEmpty() ? model->nameString(fileIndex) : model->textString(fileIndex);
+        msg(tr("optimizeCompression: %1: %2 -> %3, size %4 -> %5, %6 ms")
+            .arg(name)
+            .arg(compressionTypeToQString(plan[i].oldAlgorithm))
+            .arg(compressionTypeToQString(plan[i].newAlgorithm))
+            .arg(plan[i].oldSize, 8, 16, QChar('0'))
+            .arg(plan[i].newSize, 8, 16, QChar('0'))
+            .arg(plan[i].time / 1000), plan[i].index);
+
+        model->setCompression(plan[i].index, plan[i].newAlgorithm);
+        reconstructedSections.remove(plan[i].index.internalPointer());
+        if (model->action(plan[i].index) == Actions::NoAction)
+            model->setAction(plan[i].index, Actions::Rebuild);
+    }
+    model->setJournalEnabled(journalEnabled);
+
+    return ERR_SUCCESS;
+}
+
 // Construction routines
+void FfsEngine::updateItemLocations()
+{
+    for (int i = 0; i < model->rowCount(); i++)
+        if (model->offset(model->index(i, 0)) != OFFSET_UNKNOWN)
+            updateItemLocations(model->index(i, 0), NULL, model->offset(model->index(i, 0)));
+}
+
+void FfsEngine::updateNewItemLocations(const QModelIndex & index)
+{
+    // New items are not in opened image, every one starts its own address space until the image is rebuilt
+    // Tree items are aligned, so this space never is the decompressed data of a compressed section item
+    void* space = (UINT8*)index.internalPointer() + 1;
+    spaceProvenance.insert(space, tr("new %1").arg(model->nameString(index)));
+    updateItemLocations(index, space, 0);
+}
+
+void FfsEngine::updateItemLocations(const QModelIndex & index, void* space, const UINT32 offset)
+{
+    ItemLocation location;
+    location.space = space;
+    location.offset = offset;
+    itemLocations.insert(index.internalPointer(), location);
+
+    // Children of compressed sections are in decompressed data, which starts a new address space
+    UINT32 bodyOffset = offset + model->header(index).size();
+    if (model->compression(index) != COMPRESSION_ALGORITHM_NONE) {
+        spaceProvenance.insert(index.internalPointer(), tr("%1 -> %2 section -> decompressed")
+            .arg(provenanceString(index))
+            .arg(compressionTypeToQString(model->compression(index))));
+        space = index.internalPointer();
+        bodyOffset = 0;
+    }
+
+    for (int i = 0; i < model->rowCount(index); i++) {
+        // Item offsets are relative to parent body
+        QModelIndex child = index.child(i, 0);
+        if (model->offset(child) != OFFSET_UNKNOWN)
+            updateItemLocations(child, space, bodyOffset + model->offset(child));
+    }
+}
+
+UINT8 FfsEngine::getImageOffset(const QModelIndex & index, UINT32 & offset)
+{
+    if (!index.isValid())
+        return ERR_INVALID_PARAMETER;
+
+    QHash<void*, ItemLocation>::const_iterator location = itemLocations.constFind(index.internalPointer());
+    if (location == itemLocations.constEnd() || location.value().space)
+        return ERR_ITEM_NOT_FOUND;
+
+    offset = location.value().offset;
+    return ERR_SUCCESS;
+}
+
+QString FfsEngine::provenanceString(const QModelIndex & index, const UINT32 offset)
+{
+    if (!index.isValid())
+        return QString();
+
+    QHash<void*, ItemLocation>::const_iterator location = itemLocations.constFind(index.internalPointer());
+    if (location == itemLocations.constEnd())
+        return QString();
+
+    // Chains of compressed sections are built once during parsing
+    const ItemLocation & found = location.value();
+    return tr("%1+0x%2")
+        .arg(found.space ? spaceProvenance.value(found.space) : tr("image"))
+        .arg(found.offset + offset, 8, 16, QChar('0'));
+}
+
+UINT8 FfsEngine::getAddress(const QModelIndex & index, UINT32 & address)
+{
+    if (!index.isValid())
+        return ERR_INVALID_PARAMETER;
+
+    // Address is known for items inside volumes with known base
+    QModelIndex volumeIndex = model->findParentOfType(index, Types::Volume);
+    if (!volumeIndex.isValid())
+        return ERR_ITEM_NOT_FOUND;
+
+    QHash<void*, UINT32>::const_iterator volumeBase = volumeBases.constFind(volumeIndex.internalPointer());
+    if (volumeBase == volumeBases.constEnd() || !volumeBase.value())
+        return ERR_VOLUME_BASE_NOT_FOUND;
+
+    UINT32 offset;
+    UINT32 volumeOffset;
+    if (getImageOffset(index, offset) || getImageOffset(volumeIndex, volumeOffset))
+        return ERR_ITEM_NOT_FOUND;
+
+    address = volumeBase.value() + offset - volumeOffset;
+    return ERR_SUCCESS;
+}
+
+QByteArray FfsEngine::unmodifiedItem(const QModelIndex & index)
+{
+    // Returned data can outlive opened image, so it owns its bytes
+    UINT32 offset;
+    UINT32 size = model->header(index).size() + model->body(index).size() + model->tail(index).size();
+    if (!getImageOffset(index, offset) && (UINT64)offset + size <= (UINT64)openedImage.size())
+        return openedImage.mid(offset, size);
+
+    return model->header(index).append(model->body(index)).append(model->tail(index));
+}
+
+void FfsEngine::appendUnmodifiedItem(ImageBuilder & builder, const QModelIndex & index)
+{
+    // Builder refers to the original bytes of the item in opened image instead of copying them
+    UINT32 offset;
+    UINT32 size = model->header(index).size() + model->body(index).size() + model->tail(index).size();
+    if (!getImageOffset(index, offset) && (UINT64)offset + size <= (UINT64)openedImage.size())
+        builder.append(openedImage, offset, size);
+    else
+        builder.append(model->header(index).append(model->body(index)).append(model->tail(index)));
+}
+
 UINT8 FfsEngine::constructPadFile(const QByteArray &guid, const UINT32 size, const UINT8 revision, const UINT8 erasePolarity, QByteArray & pad)
 {
     if (size < sizeof(EFI_FFS_FILE_HEADER) || erasePolarity == ERASE_POLARITY_UNKNOWN)
@@ -2096,7 +2670,7 @@ UINT8 FfsEngine::constructPadFile(const QByteArray &guid, const UINT32 size, con
     return ERR_SUCCESS;
 }
 
-UINT8 FfsEngine::reconstructIntelImage(const QModelIndex& index, QByteArray& reconstructed)
+UINT8 FfsEngine::reconstructIntelImage(const QModelIndex& index, ImageBuilder& reconstructed)
 {
     if (!index.isValid())
         return ERR_SUCCESS;
@@ -2105,7 +2679,8 @@ UINT8 FfsEngine::reconstructIntelImage(const QModelIndex& index, QByteArray& rec
 
     // No action
     if (model->action(index) == Actions::NoAction) {
-        reconstructed = model->header(index).append(model->body(index)).append(model->tail(index));
+        reconstructed.clear();
+        appendUnmodifiedItem(reconstructed, index);
         return ERR_SUCCESS;
     }
 
@@ -2113,24 +2688,21 @@ UINT8 FfsEngine::reconstructIntelImage(const QModelIndex& index, QByteArray& rec
     else if (model->action(index) == Actions::Rebuild) {
         reconstructed.clear();
         // First child will always be descriptor for this type of image
-        QByteArray descriptor;
-        result = reconstructRegion(index.child(0, 0), descriptor);
+        ImageBuilder descriptorBuilder;
+        result = reconstructRegion(index.child(0, 0), descriptorBuilder);
         if (result)
             return result;
+        QByteArray descriptor = descriptorBuilder.toByteArray();
         reconstructed.append(descriptor);
 
         FLASH_DESCRIPTOR_MAP* descriptorMap = (FLASH_DESCRIPTOR_MAP*)(descriptor.constData() + sizeof(FLASH_DESCRIPTOR_HEADER));
         FLASH_DESCRIPTOR_REGION_SECTION* regionSection = (FLASH_DESCRIPTOR_REGION_SECTION*)calculateAddress8((UINT8*)descriptor.constData(), descriptorMap->RegionBase);
-        QByteArray gbe;
         UINT32 gbeBegin = calculateRegionOffset(regionSection->GbeBase);
         UINT32 gbeEnd = gbeBegin + calculateRegionSize(regionSection->GbeBase, regionSection->GbeLimit);
-        QByteArray me;
         UINT32 meBegin = calculateRegionOffset(regionSection->MeBase);
         UINT32 meEnd = meBegin + calculateRegionSize(regionSection->MeBase, regionSection->MeLimit);
-        QByteArray bios;
         UINT32 biosBegin = calculateRegionOffset(regionSection->BiosBase);
         UINT32 biosEnd = biosBegin + calculateRegionSize(regionSection->BiosBase, regionSection->BiosLimit);
-        QByteArray pdr;
         UINT32 pdrBegin = calculateRegionOffset(regionSection->PdrBase);
         UINT32 pdrEnd = pdrBegin + calculateRegionSize(regionSection->PdrBase, regionSection->PdrLimit);
 
@@ -2138,57 +2710,52 @@ UINT8 FfsEngine::reconstructIntelImage(const QModelIndex& index, QByteArray& rec
         // Reconstruct other regions
         char empty = '\xFF'; //!TODO: determine empty char using one of reserved descriptor fields
         for (int i = 1; i < model->rowCount(index); i++) {
-            QByteArray region;
+            ImageBuilder region;
             result = reconstructRegion(index.child(i, 0), region);
             if (result)
                 return result;
 
+            UINT32 begin;
+            UINT32 end;
             switch (model->subtype(index.child(i, 0)))
             {
             case Subtypes::GbeRegion:
-                gbe = region;
-                if (gbeBegin > offset)
-                    reconstructed.append(QByteArray(gbeBegin - offset, empty));
-                reconstructed.append(gbe);
-                offset = gbeEnd;
+                begin = gbeBegin;
+                end = gbeEnd;
                 break;
             case Subtypes::MeRegion:
-                me = region;
-                if (meBegin > offset)
-                    reconstructed.append(QByteArray(meBegin - offset, empty));
-                reconstructed.append(me);
-                offset = meEnd;
+                begin = meBegin;
+                end = meEnd;
                 break;
             case Subtypes::BiosRegion:
-                bios = region;
-                if (biosBegin > offset)
-                    reconstructed.append(QByteArray(biosBegin - offset, empty));
-                reconstructed.append(bios);
-                offset = biosEnd;
+                begin = biosBegin;
+                end = biosEnd;
                 break;
             case Subtypes::PdrRegion:
-                pdr = region;
-                if (pdrBegin > offset)
-                    reconstructed.append(QByteArray(pdrBegin - offset, empty));
-                reconstructed.append(pdr);
-                offset = pdrEnd;
+                begin = pdrBegin;
+                end = pdrEnd;
                 break;
             default:
                 msg(tr("reconstructIntelImage: unknown region type found"), index);
                 return ERR_INVALID_REGION;
             }
+
+            if (begin > offset)
+                reconstructed.append(QByteArray(begin - offset, empty));
+            reconstructed.append(region);
+            offset = end;
         }
         if ((UINT32)model->body(index).size() > offset)
             reconstructed.append(QByteArray((UINT32)model->body(index).size() - offset, empty));
 
         // Check size of reconstructed image, it must be same
-        if (reconstructed.size() > model->body(index).size()) {
+        if (reconstructed.size() > (UINT32)model->body(index).size()) {
             msg(tr("reconstructIntelImage: reconstructed body %1 is bigger then original %2")
                 .arg(reconstructed.size(), 8, 16, QChar('0'))
                 .arg(model->body(index).size(), 8, 16, QChar('0')), index);
             return ERR_INVALID_PARAMETER;
         }
-        else if (reconstructed.size() < model->body(index).size()) {
+        else if (reconstructed.size() < (UINT32)model->body(index).size()) {
             msg(tr("reconstructIntelImage: reconstructed body %1 is smaller then original %2")
                 .arg(reconstructed.size(), 8, 16, QChar('0'))
                 .arg(model->body(index).size(), 8, 16, QChar('0')), index);
@@ -2203,7 +2770,7 @@ UINT8 FfsEngine::reconstructIntelImage(const QModelIndex& index, QByteArray& rec
     return ERR_NOT_IMPLEMENTED;
 }
 
-UINT8 FfsEngine::reconstructRegion(const QModelIndex& index, QByteArray& reconstructed)
+UINT8 FfsEngine::reconstructRegion(const QModelIndex& index, ImageBuilder& reconstructed)
 {
     if (!index.isValid())
         return ERR_SUCCESS;
@@ -2212,7 +2779,8 @@ UINT8 FfsEngine::reconstructRegion(const QModelIndex& index, QByteArray& reconst
 
     // No action
     if (model->action(index) == Actions::NoAction) {
-        reconstructed = model->header(index).append(model->body(index)).append(model->tail(index));
+        reconstructed.clear();
+        appendUnmodifiedItem(reconstructed, index);
         return ERR_SUCCESS;
     }
     else if (model->action(index) == Actions::Remove) {
@@ -2221,11 +2789,11 @@ UINT8 FfsEngine::reconstructRegion(const QModelIndex& index, QByteArray& reconst
     }
     else if (model->action(index) == Actions::Rebuild ||
         model->action(index) == Actions::Replace) {
+        reconstructed.clear();
         if (model->rowCount(index)) {
-            reconstructed.clear();
             // Reconstruct children
             for (int i = 0; i < model->rowCount(index); i++) {
-                QByteArray child;
+                ImageBuilder child;
                 result = reconstruct(index.child(i, 0), child);
                 if (result)
                     return result;
@@ -2234,16 +2802,16 @@ UINT8 FfsEngine::reconstructRegion(const QModelIndex& index, QByteArray& reconst
         }
         // Use stored item body
         else
-            reconstructed = model->body(index);
+            reconstructed.append(model->body(index));
 
         // Check size of reconstructed region, it must be same
-        if (reconstructed.size() > model->body(index).size()) {
+        if (reconstructed.size() > (UINT32)model->body(index).size()) {
             msg(tr("reconstructRegion: reconstructed region (%1) is bigger then original (%2)")
                 .arg(reconstructed.size(), 8, 16, QChar('0'))
                 .arg(model->body(index).size(), 8, 16, QChar('0')), index);
             return ERR_INVALID_PARAMETER;
         }
-        else if (reconstructed.size() < model->body(index).size()) {
+        else if (reconstructed.size() < (UINT32)model->body(index).size()) {
             msg(tr("reconstructRegion: reconstructed region (%1) is smaller then original (%2)")
                 .arg(reconstructed.size(), 8, 16, QChar('0'))
                 .arg(model->body(index).size(), 8, 16, QChar('0')), index);
@@ -2251,7 +2819,7 @@ UINT8 FfsEngine::reconstructRegion(const QModelIndex& index, QByteArray& reconst
         }
 
         // Reconstruction successful
-        reconstructed = model->header(index).append(reconstructed);
+        reconstructed.prepend(model->header(index));
         return ERR_SUCCESS;
     }
 
@@ -2259,6 +2827,100 @@ UINT8 FfsEngine::reconstructRegion(const QModelIndex& index, QByteArray& reconst
     return ERR_NOT_IMPLEMENTED;
 }
 
+UINT8 FfsEngine::findItemsByGuid(const QByteArray & guid, QModelIndexList & indexes)
+{
+    if (guid.size() != sizeof(EFI_GUID))
+        return ERR_INVALID_PARAMETER;
+
+    indexes = model->findByGuid(guid);
+    if (indexes.isEmpty())
+        return ERR_ITEM_NOT_FOUND;
+
+    return ERR_SUCCESS;
+}
+
+UINT32 FfsEngine::calculateVolumeBase(const QModelIndex & index)
+{
+    UINT8 result;
+    QByteArray header = model->header(index);
+    UINT32 volumeSize;
+    result = getVolumeSize(header, 0, volumeSize);
+    if (result)
+        return 0;
+
+    UINT32 volumeBase;
+    QByteArray file;
+    bool baseFound = false;
+
+    // Search for VTF
+    for (int i = 0; i < model->rowCount(index); i++) {
+        file = model->header(index.child(i, 0));
+        // VTF found
+        if (file.left(sizeof(EFI_GUID)) == EFI_FFS_VOLUME_TOP_FILE_GUID) {
+            baseFound = true;
+            volumeBase = (UINT32) (0x100000000 - volumeSize);
+            break;
+        }
+    }
+
+    // Determine if volume is inside compressed item
+    if (!baseFound) {
+        // Iterate up to the root, checking for compression type to be other then none
+        for (QModelIndex parentIndex = index.parent(); model->type(parentIndex) != Types::Root; parentIndex = parentIndex.parent())
+            if (model->compression(parentIndex) != COMPRESSION_ALGORITHM_NONE) {
+                // No rebase needed for compressed PEI files
+                baseFound = true;
+                volumeBase = 0;
+                break;
+            }
+    }
+
+    // Find volume base address using first PEI file in it
+    if (!baseFound) {
+        // Search for first PEI-file and use it as base source
+        UINT32 fileOffset = header.size();
+        for (int i = 0; i < model->rowCount(index); i++) {
+            if ((model->subtype(index.child(i, 0)) == EFI_FV_FILETYPE_PEI_CORE ||
+                model->subtype(index.child(i, 0)) == EFI_FV_FILETYPE_PEIM ||
+                model->subtype(index.child(i, 0)) == EFI_FV_FILETYPE_COMBINED_PEIM_DRIVER)){
+                QModelIndex peiFile = index.child(i, 0);
+                UINT32 sectionOffset = sizeof(EFI_FFS_FILE_HEADER);
+                // Search for PE32 or TE section
+                for (int j = 0; j < model->rowCount(peiFile); j++) {
+                    if (model->subtype(peiFile.child(j, 0)) == EFI_SECTION_PE32 ||
+                        model->subtype(peiFile.child(j, 0)) == EFI_SECTION_TE) {
+                        QModelIndex image = peiFile.child(j, 0);
+                        // Check for correct action
+                        if (model->action(image) == Actions::Remove || model->action(image) == Actions::Insert)
+                            continue;
+                        // Calculate relative base address
+                        UINT32 relbase = fileOffset + sectionOffset + model->header(image).size();
+                        // Calculate offset of image relative to file base
+                        UINT32 imagebase;
+                        result = getBase(model->body(image), imagebase);
+                        if (!result) {
+                            // Calculate volume base
+                            volumeBase = imagebase - relbase;
+                            baseFound = true;
+                            goto out;
+                        }
+                    }
+                    sectionOffset += model->header(peiFile.child(j, 0)).size() + model->body(peiFile.child(j, 0)).size();
+                    sectionOffset = ALIGN4(sectionOffset);
+                }
+            }
+            fileOffset += model->header(index.child(i, 0)).size() + model->body(index.child(i, 0)).size() + model->tail(index.child(i, 0)).size();
+            fileOffset = ALIGN8(fileOffset);
+        }
+    }
+out:
+    // Do not set volume base
+    if (!baseFound)
+        volumeBase = 0;
+
+    return volumeBase;
+}
+
 UINT8 FfsEngine::reconstructVolume(const QModelIndex & index, QByteArray & reconstructed)
 {
     if (!index.isValid())
@@ -2268,7 +2930,7 @@ UINT8 FfsEngine::reconstructVolume(const QModelIndex & index, QByteArray & recon
 
     // No action
     if (model->action(index) == Actions::NoAction) {
-        reconstructed = model->header(index).append(model->body(index)).append(model->tail(index));
+        reconstructed = unmodifiedItem(index);
         return ERR_SUCCESS;
     }
     else if (model->action(index) == Actions::Remove) {
@@ -2300,76 +2962,15 @@ UINT8 FfsEngine::reconstructVolume(const QModelIndex & index, QByteArray & recon
             UINT8 polarity = volumeHeader->Attributes & EFI_FVB_ERASE_POLARITY ? ERASE_POLARITY_TRUE : ERASE_POLARITY_FALSE;
             char empty = volumeHeader->Attributes & EFI_FVB_ERASE_POLARITY ? '\xFF' : '\x00';
 
-            // Calculate volume base for volume
+            // Get volume base calculated during parsing
+            // It's recalculated only for volumes with VTF inserted or removed
             UINT32 volumeBase;
+            QHash<void*, UINT32>::const_iterator cachedBase = volumeBases.constFind(index.internalPointer());
+            if (cachedBase != volumeBases.constEnd())
+                volumeBase = cachedBase.value();
+            else
+                volumeBase = calculateVolumeBase(index);
             QByteArray file;
-            bool baseFound = false;
-
-            // Search for VTF
-            for (int i = 0; i < model->rowCount(index); i++) {
-                file = model->header(index.child(i, 0));
-                // VTF found
-                if (file.left(sizeof(EFI_GUID)) == EFI_FFS_VOLUME_TOP_FILE_GUID) {
-                    baseFound = true;
-                    volumeBase = (UINT32) (0x100000000 - volumeSize);
-                    break;
-                }
-            }
-
-            // Determine if volume is inside compressed item
-            if (!baseFound) {
-                // Iterate up to the root, checking for compression type to be other then none
-                for (QModelIndex parentIndex = index.parent(); model->type(parentIndex) != Types::Root; parentIndex = parentIndex.parent())
-                    if (model->compression(parentIndex) != COMPRESSION_ALGORITHM_NONE) {
-                        // No rebase needed for compressed PEI files
-                        baseFound = true;
-                        volumeBase = 0;
-                        break;
-                    }
-            }
-
-            // Find volume base address using first PEI file in it
-            if (!baseFound) {
-                // Search for first PEI-file and use it as base source
-                UINT32 fileOffset = header.size();
-                for (int i = 0; i < model->rowCount(index); i++) {
-                    if ((model->subtype(index.child(i, 0)) == EFI_FV_FILETYPE_PEI_CORE ||
-                        model->subtype(index.child(i, 0)) == EFI_FV_FILETYPE_PEIM ||
-                        model->subtype(index.child(i, 0)) == EFI_FV_FILETYPE_COMBINED_PEIM_DRIVER)){
-                        QModelIndex peiFile = index.child(i, 0);
-                        UINT32 sectionOffset = sizeof(EFI_FFS_FILE_HEADER);
-                        // Search for PE32 or TE section
-                        for (int j = 0; j < model->rowCount(peiFile); j++) {
-                            if (model->subtype(peiFile.child(j, 0)) == EFI_SECTION_PE32 ||
-                                model->subtype(peiFile.child(j, 0)) == EFI_SECTION_TE) {
-                                QModelIndex image = peiFile.child(j, 0);
-                                // Check for correct action
-                                if (model->action(image) == Actions::Remove || model->action(image) == Actions::Insert)
-                                    continue;
-                                // Calculate relative base address
-                                UINT32 relbase = fileOffset + sectionOffset + model->header(image).size();
-                                // Calculate offset of image relative to file base
-                                UINT32 imagebase;
-                                result = getBase(model->body(image), imagebase);
-                                if (!result) {
-                                    // Calculate volume base
-                                    volumeBase = imagebase - relbase;
-                                    baseFound = true;
-                                    goto out;
-                                }
-                            }
-                            sectionOffset += model->header(peiFile.child(j, 0)).size() + model->body(peiFile.child(j, 0)).size();
-                            sectionOffset = ALIGN4(sectionOffset);
-                        }
-                    }
-                    fileOffset += model->header(index.child(i, 0)).size() + model->body(index.child(i, 0)).size() + model->tail(index.child(i, 0)).size();
-                    fileOffset = ALIGN8(fileOffset);
-                }
-            }
-        out:
-            // Do not set volume base
-            if (!baseFound)
-                volumeBase = 0;
 
             // Reconstruct files in volume
             UINT32 offset = 0;
@@ -2469,6 +3070,9 @@ UINT8 FfsEngine::reconstructVolume(const QModelIndex & index, QByteArray & recon
                 // No more space left in volume
                 else if (vtfOffset < offset) {
                     msg(tr("reconstructVolume: %1: volume has no free space left").arg(guidToQString(volumeHeader->FileSystemGuid)), index);
+                    // Try to make it fit by changing compression of sections
+                    if (compressionOptimization && !freeVolumeSpace(index, offset - vtfOffset))
+                        return reconstructVolume(index, reconstructed);
                     return ERR_INVALID_VOLUME;
                 }
 
@@ -2501,6 +3105,9 @@ UINT8 FfsEngine::reconstructVolume(const QModelIndex & index, QByteArray & recon
                     UINT8 parentType = model->type(index.parent());
                     if (parentType != Types::File && parentType != Types::Section) {
                         msg(tr("reconstructVolume: %1: root volume can't be grown").arg(guidToQString(volumeHeader->FileSystemGuid)), index);
+                        // Try to make it fit by changing compression of sections
+                        if (compressionOptimization && !freeVolumeSpace(index, reconstructed.size() - volumeBodySize))
+                            return reconstructVolume(index, reconstructed);
                         return ERR_INVALID_VOLUME;
                     }
 
@@ -2545,7 +3152,7 @@ UINT8 FfsEngine::reconstructFile(const QModelIndex& index, const UINT8 revision,
 
     // No action
     if (model->action(index) == Actions::NoAction) {
-        reconstructed = model->header(index).append(model->body(index)).append(model->tail(index));
+        reconstructed = unmodifiedItem(index);
         return ERR_SUCCESS;
     }
     else if (model->action(index) == Actions::Remove) {
@@ -2613,9 +3220,11 @@ UINT8 FfsEngine::reconstructFile(const QModelIndex& index, const UINT8 revision,
             // Construct new file body
             // File contains raw data, must be parsed as region
             if (model->subtype(index) == EFI_FV_FILETYPE_ALL || model->subtype(index) == EFI_FV_FILETYPE_RAW) {
-                result = reconstructRegion(index, reconstructed);
+                ImageBuilder region;
+                result = reconstructRegion(index, region);
                 if (result)
                     return result;
+                reconstructed = region.toByteArray();
             }
             // File contains sections
             else {
@@ -2696,17 +3305,57 @@ UINT8 FfsEngine::reconstructFile(const QModelIndex& index, const UINT8 revision,
     return ERR_NOT_IMPLEMENTED;
 }
 
-UINT8 FfsEngine::reconstructSection(const QModelIndex& index, const UINT32 base, QByteArray& reconstructed)
+UINT8 FfsEngine::reconstructSectionBody(const QModelIndex& index, QByteArray& reconstructed)
 {
-    if (!index.isValid())
-        return ERR_SUCCESS;
-
     UINT8 result;
+    UINT32 offset = 0;
 
-    // No action
-    if (model->action(index) == Actions::NoAction) {
-        reconstructed = model->header(index).append(model->body(index)).append(model->tail(index));
-        return ERR_SUCCESS;
+    reconstructed.clear();
+    for (int i = 0; i < model->rowCount(index); i++) {
+        // Align to 4 byte boundary
+        UINT8 alignment = offset % 4;
+        if (alignment) {
+            alignment = 4 - alignment;
+            offset += alignment;
+            reconstructed.append(QByteArray(alignment, '\x00'));
+        }
+
+        // Reconstruct subsections
+        QByteArray section;
+        result = reconstruct(index.child(i, 0), section);
+        if (result)
+            return result;
+
+        // Check for empty queue
+        if (section.isEmpty())
+            continue;
+
+        // Append current subsection to new section body
+        reconstructed.append(section);
+
+        // Change current file offset
+        offset += section.size();
+    }
+
+    return ERR_SUCCESS;
+}
+
+UINT8 FfsEngine::reconstructSection(const QModelIndex& index, const UINT32 base, QByteArray& reconstructed)
+{
+    return reconstructSection(index, base, reconstructed, newPeiCoreEntryPoint);
+}
+
+UINT8 FfsEngine::reconstructSection(const QModelIndex& index, const UINT32 base, QByteArray& reconstructed, UINT32 & peiCoreEntryPoint)
+{
+    if (!index.isValid())
+        return ERR_SUCCESS;
+
+    UINT8 result;
+
+    // No action
+    if (model->action(index) == Actions::NoAction) {
+        reconstructed = unmodifiedItem(index);
+        return ERR_SUCCESS;
     }
     else if (model->action(index) == Actions::Remove) {
         reconstructed.clear();
@@ -2716,41 +3365,22 @@ UINT8 FfsEngine::reconstructSection(const QModelIndex& index, const UINT32 base,
         model->action(index) == Actions::Replace ||
         model->action(index) == Actions::Rebuild ||
         model->action(index) == Actions::Rebase) {
+        // Use section already reconstructed in parallel
+        QHash<void*, QByteArray>::const_iterator it = reconstructedSections.constFind(index.internalPointer());
+        if (it != reconstructedSections.constEnd()) {
+            reconstructed = it.value();
+            return ERR_SUCCESS;
+        }
+
         QByteArray header = model->header(index);
         EFI_COMMON_SECTION_HEADER* commonHeader = (EFI_COMMON_SECTION_HEADER*)header.data();
 
         // Reconstruct section with children
         if (model->rowCount(index)) {
-            reconstructed.clear();
             // Construct new section body
-            UINT32 offset = 0;
-
-            // Reconstruct section body
-            for (int i = 0; i < model->rowCount(index); i++) {
-                // Align to 4 byte boundary
-                UINT8 alignment = offset % 4;
-                if (alignment) {
-                    alignment = 4 - alignment;
-                    offset += alignment;
-                    reconstructed.append(QByteArray(alignment, '\x00'));
-                }
-
-                // Reconstruct subsections
-                QByteArray section;
-                result = reconstruct(index.child(i, 0), section);
-                if (result)
-                    return result;
-
-                // Check for empty queue
-                if (section.isEmpty())
-                    continue;
-
-                // Append current subsection to new section body
-                reconstructed.append(section);
-
-                // Change current file offset
-                offset += section.size();
-            }
+            result = reconstructSectionBody(index, reconstructed);
+            if (result)
+                return result;
 
             // Only this 2 sections can have compressed body
             if (model->subtype(index) == EFI_SECTION_COMPRESSION) {
@@ -2820,7 +3450,12 @@ UINT8 FfsEngine::reconstructSection(const QModelIndex& index, const UINT32 base,
             model->subtype(index.parent()) == EFI_FV_FILETYPE_COMBINED_PEIM_DRIVER)) {
 
             if (base) {
-                result = rebase(reconstructed, base + header.size());
+                // Use relocations indexed during parsing, if section body was not changed
+                QHash<void*, QVector<UINT32> >::const_iterator relocations = relocationIndex.constFind(index.internalPointer());
+                if (relocations != relocationIndex.constEnd() && !model->rowCount(index))
+                    result = rebase(reconstructed, base + header.size(), relocations.value());
+                else
+                    result = rebase(reconstructed, base + header.size());
                 if (result) {
                     msg(tr("reconstructSection: executable section rebase failed"), index);
                     return result;
@@ -2828,7 +3463,7 @@ UINT8 FfsEngine::reconstructSection(const QModelIndex& index, const UINT32 base,
 
                 // Special case of PEI Core rebase
                 if (model->subtype(index.parent()) == EFI_FV_FILETYPE_PEI_CORE) {
-                    result = getEntryPoint(reconstructed, newPeiCoreEntryPoint);
+                    result = getEntryPoint(reconstructed, peiCoreEntryPoint);
                     if (result)
                         msg(tr("reconstructSection: can't get entry point of PEI core"), index);
                 }
@@ -2852,6 +3487,57 @@ UINT8 FfsEngine::reconstruct(const QModelIndex &index, QByteArray& reconstructed
 
     UINT8 result;
 
+    switch (model->type(index)) {
+    case Types::Image:
+    case Types::Capsule:
+    case Types::Region:
+    {
+        // Big items are built from pieces and flattened only here
+        ImageBuilder builder;
+        result = reconstruct(index, builder);
+        if (result)
+            return result;
+        reconstructed = builder.toByteArray();
+    }
+        break;
+
+    case Types::Padding:
+        // No reconstruction needed
+        reconstructed = unmodifiedItem(index);
+        return ERR_SUCCESS;
+        break;
+
+    case Types::Volume:
+        result = reconstructVolume(index, reconstructed);
+        if (result)
+            return result;
+        break;
+
+    case Types::File: //Must not be called that way
+        msg(tr("reconstruct: call of generic function is not supported for files").arg(model->type(index)), index);
+        return ERR_GENERIC_CALL_NOT_SUPPORTED;
+        break;
+
+    case Types::Section:
+        result = reconstructSection(index, 0, reconstructed);
+        if (result)
+            return result;
+        break;
+    default:
+        msg(tr("reconstruct: unknown item type (%1)").arg(model->type(index)), index);
+        return ERR_UNKNOWN_ITEM_TYPE;
+    }
+
+    return ERR_SUCCESS;
+}
+
+UINT8 FfsEngine::reconstruct(const QModelIndex &index, ImageBuilder& reconstructed)
+{
+    if (!index.isValid())
+        return ERR_SUCCESS;
+
+    UINT8 result;
+
     switch (model->type(index)) {
     case Types::Image:
         if (model->subtype(index) == Subtypes::IntelImage) {
@@ -2882,34 +3568,114 @@ UINT8 FfsEngine::reconstruct(const QModelIndex &index, QByteArray& reconstructed
             return result;
         break;
 
-    case Types::Padding:
-        // No reconstruction needed
-        reconstructed = model->header(index).append(model->body(index)).append(model->tail(index));
-        return ERR_SUCCESS;
-        break;
+    default:
+    {
+        // Unmodified volumes, sections and padding are referenced from opened image
+        if (model->type(index) != Types::File
+            && (model->type(index) == Types::Padding || model->action(index) == Actions::NoAction)) {
+            reconstructed.clear();
+            appendUnmodifiedItem(reconstructed, index);
+            break;
+        }
 
-    case Types::Volume:
-        result = reconstructVolume(index, reconstructed);
+        // Other items need contiguous data to be reconstructed
+        QByteArray data;
+        result = reconstruct(index, data);
         if (result)
             return result;
-        break;
+        reconstructed.clear();
+        reconstructed.append(data);
+    }
+    }
 
-    case Types::File: //Must not be called that way
-        msg(tr("reconstruct: call of generic function is not supported for files").arg(model->type(index)), index);
-        return ERR_GENERIC_CALL_NOT_SUPPORTED;
-        break;
+    return ERR_SUCCESS;
+}
 
-    case Types::Section:
-        result = reconstructSection(index, 0, reconstructed);
-        if (result)
-            return result;
-        break;
-    default:
-        msg(tr("reconstruct: unknown item type (%1)").arg(model->type(index)), index);
-        return ERR_UNKNOWN_ITEM_TYPE;
+class SectionReconstruction : public QRunnable
+{
+public:
+    SectionReconstruction(FfsEngine* engine, const QModelIndex & index)
+        : engine(engine), index(index), result(ERR_NOT_IMPLEMENTED), peiCoreEntryPoint(0)
+    {
+        setAutoDelete(false);
     }
 
-    return ERR_SUCCESS;
+    void run()
+    {
+        // Compressed sections don't depend on their base, so it's not needed here
+        result = engine->reconstructSection(index, 0, data, peiCoreEntryPoint);
+    }
+
+    FfsEngine* engine;
+    QModelIndex index;
+    UINT8 result;
+    QByteArray data;
+    UINT32 peiCoreEntryPoint;
+};
+
+bool FfsEngine::containsVolumes(const QModelIndex & index)
+{
+    for (int i = 0; i < model->rowCount(index); i++) {
+        QModelIndex child = index.child(i, 0);
+        if (model->type(child) == Types::Volume || containsVolumes(child))
+            return true;
+    }
+    return false;
+}
+
+void FfsEngine::findRebuiltCompressedSections(const QModelIndex & index, const int depth, QVector<QVector<QModelIndex> > & levels)
+{
+    // Unmodified and removed items have no modified children
+    UINT8 action = model->action(index);
+    if (action == Actions::NoAction || action == Actions::Remove)
+        return;
+
+    if (model->type(index) == Types::Section &&
+        (model->subtype(index) == EFI_SECTION_COMPRESSION || model->subtype(index) == EFI_SECTION_GUID_DEFINED) &&
+        model->compression(index) != COMPRESSION_ALGORITHM_NONE && model->rowCount(index) &&
+        !containsVolumes(index)) {
+        // Volumes can be changed by compression optimizer, so sections with them are rebuilt sequentially
+        if (levels.size() <= depth)
+            levels.resize(depth + 1);
+        levels[depth].append(index);
+    }
+
+    for (int i = 0; i < model->rowCount(index); i++)
+        findRebuiltCompressedSections(index.child(i, 0), depth + 1, levels);
+}
+
+UINT8 FfsEngine::reconstructCompressedSections(const QModelIndex & index)
+{
+    QVector<QVector<QModelIndex> > levels;
+    findRebuiltCompressedSections(index, 0, levels);
+
+    // Deepest sections go first, so outer ones can use their results
+    QThreadPool pool;
+    UINT8 result = ERR_SUCCESS;
+    for (int depth = levels.size() - 1; depth >= 0 && !result; depth--) {
+        if (levels[depth].isEmpty())
+            continue;
+
+        QVector<SectionReconstruction*> tasks;
+        for (int i = 0; i < levels[depth].size(); i++) {
+            tasks.append(new SectionReconstruction(this, levels[depth][i]));
+            pool.start(tasks.last());
+        }
+        pool.waitForDone();
+
+        for (int i = 0; i < tasks.size(); i++) {
+            if (tasks[i]->result && !result)
+                result = tasks[i]->result;
+            else if (!tasks[i]->result) {
+                reconstructedSections.insert(tasks[i]->index.internalPointer(), tasks[i]->data);
+                if (tasks[i]->peiCoreEntryPoint)
+                    newPeiCoreEntryPoint = tasks[i]->peiCoreEntryPoint;
+            }
+            delete tasks[i];
+        }
+    }
+
+    return result;
 }
 
 UINT8 FfsEngine::growVolume(QByteArray & header, const UINT32 size, UINT32 & newSize)
@@ -2957,13 +3723,46 @@ UINT8 FfsEngine::growVolume(QByteArray & header, const UINT32 size, UINT32 & new
 
 UINT8 FfsEngine::reconstructImageFile(QByteArray & reconstructed)
 {
-    return reconstruct(model->index(0, 0), reconstructed);
+    ImageBuilder builder;
+    UINT8 result = reconstructImageFile(builder);
+    if (result)
+        return result;
+
+    reconstructed = builder.toByteArray();
+    return ERR_SUCCESS;
+}
+
+UINT8 FfsEngine::reconstructImageFile(ImageBuilder & reconstructed)
+{
+    optimizationAttempts.clear();
+
+    // Recompress modified sections in parallel, then do the layout
+    UINT8 result = reconstructCompressedSections(model->index(0, 0));
+    if (!result)
+        result = reconstruct(model->index(0, 0), reconstructed);
+
+    reconstructedSections.clear();
+    return result;
 }
 
 // Search routines
-UINT8 FfsEngine::findHexPattern(const QModelIndex & index, const QByteArray & hexPattern, const UINT8 mode)
+UINT32 FfsEngine::searchItemOffset(const QModelIndex & index, const UINT8 mode, const UINT32 offset)
 {
-    if (hexPattern.isEmpty())
+    // Body offsets are converted to offsets from item start
+    if (mode == SEARCH_MODE_BODY)
+        return model->header(index).size() + offset;
+
+    // Header search data of leaf items is header and tail, body is between them in the item
+    UINT32 headerSize = model->header(index).size();
+    if (mode == SEARCH_MODE_HEADER && offset >= headerSize)
+        return offset + model->body(index).size();
+
+    return offset;
+}
+
+UINT8 FfsEngine::findPatterns(const QModelIndex & index, const PatternSet & patterns, const UINT8 mode, QVector<SearchResult> & results)
+{
+    if (patterns.isEmpty())
         return ERR_INVALID_PARAMETER;
 
     if (!index.isValid())
@@ -2971,7 +3770,7 @@ UINT8 FfsEngine::findHexPattern(const QModelIndex & index, const QByteArray & he
 
     bool hasChildren = (model->rowCount(index) > 0);
     for (int i = 0; i < model->rowCount(index); i++) {
-        findHexPattern(index.child(i, index.column()), hexPattern, mode);
+        findPatterns(index.child(i, index.column()), patterns, mode, results);
     }
 
     QByteArray data;
@@ -2983,67 +3782,138 @@ UINT8 FfsEngine::findHexPattern(const QModelIndex & index, const QByteArray & he
         if (mode == SEARCH_MODE_HEADER)
             data.append(model->header(index)).append(model->tail(index));
         else if (mode == SEARCH_MODE_BODY)
-            data.append(model->body(index));
+            data = model->body(index);
         else
             data.append(model->header(index)).append(model->body(index)).append(model->tail(index));
     }
 
-    // Check for "all substrings" pattern
-    if (hexPattern.count('.') == hexPattern.length())
-        return ERR_SUCCESS;
-
-    QString hexBody = QString(data.toHex());
-    QRegExp regexp = QRegExp(QString(hexPattern), Qt::CaseInsensitive);
-    INT32 offset = regexp.indexIn(hexBody);
-    while (offset >= 0) {
-        if (offset % 2 == 0) {
-            msg(tr("Hex pattern \"%1\" found as \"%2\" in %3 at %4-offset %5")
-                .arg(QString(hexPattern))
-                .arg(hexBody.mid(offset, hexPattern.length()))
-                .arg(model->nameString(index))
-                .arg(mode == SEARCH_MODE_BODY ? tr("body") : tr("header"))
-                .arg(offset/2, 8, 16, QChar('0')),
-                index);
-        }
-        offset = regexp.indexIn(hexBody, offset + 1);
+    QVector<PatternMatch> matches;
+    patterns.search(data, matches);
+    for (int i = 0; i < matches.size(); i++) {
+        SearchResult result;
+        result.index = index;
+        result.pattern = matches.at(i).pattern;
+        result.mode = (mode == SEARCH_MODE_BODY ? SEARCH_MODE_BODY : SEARCH_MODE_HEADER);
+        result.offset = matches.at(i).offset;
+        result.itemOffset = searchItemOffset(index, mode, result.offset);
+        results.append(result);
     }
 
     return ERR_SUCCESS;
 }
 
-UINT8 FfsEngine::findGuidPattern(const QModelIndex & index, const QByteArray & guidPattern, const UINT8 mode)
+// Items are searched by worker threads in chunks of about this size
+#define SEARCH_CHUNK_SIZE 0x100000
+
+#define SEARCH_TYPE_BYTES 0
+#define SEARCH_TYPE_TEXT  1
+
+struct SearchHit {
+    int item;
+    UINT32 offset;
+};
+
+class SearchChunk : public QRunnable
 {
-    if (guidPattern.isEmpty())
-        return ERR_INVALID_PARAMETER;
+public:
+    SearchChunk(FfsEngine* engine, QAtomicInt* cancelled, const bool notify)
+        : engine(engine), cancelled(cancelled), notify(notify), complete(false), done(0)
+    {
+        setAutoDelete(false);
+    }
 
-    if (!index.isValid())
-        return ERR_SUCCESS;
+    void run()
+    {
+        int i;
+        for (i = 0; i < items.size(); i++) {
+            if (cancelled->fetchAndAddOrdered(0))
+                break;
+            searchItem(i);
+        }
+        complete = (i == items.size());
 
-    bool hasChildren = (model->rowCount(index) > 0);
-    for (int i = 0; i < model->rowCount(index); i++) {
-        findGuidPattern(index.child(i, index.column()), guidPattern, mode);
+        // Results are reported in tree order on the thread of the engine
+        done.fetchAndStoreOrdered(1);
+        if (notify)
+            QMetaObject::invokeMethod(engine, "reportSearchResults", Qt::QueuedConnection);
     }
 
-    QByteArray data;
-    if (hasChildren) {
-        if (mode != SEARCH_MODE_BODY)
-            data = model->header(index);
+    void searchItem(const int item)
+    {
+        const SearchItem & searched = items.at(item);
+        INT32 size = pattern.size();
+        UINT32 start = 0;
+        for (int i = 0; i < SEARCH_ITEM_PARTS; i++) {
+            const QByteArray & part = searched.parts[i];
+            if (part.isEmpty())
+                continue;
+
+            INT32 offset = pattern.indexIn(part);
+            while (offset >= 0) {
+                addHit(item, start + offset);
+                offset = pattern.indexIn(part, offset + 1);
+            }
+
+            // Matches starting in this part and ending in next ones are found in a window over the boundary,
+            // it has less than pattern size bytes of this part, so every match in them crosses the boundary
+            QByteArray window = part.right(size - 1);
+            INT32 own = window.size();
+            for (int j = i + 1; j < SEARCH_ITEM_PARTS && window.size() < own + size - 1; j++)
+                window.append(searched.parts[j].left(own + size - 1 - window.size()));
+            if (window.size() > own) {
+                UINT32 windowStart = start + part.size() - own;
+                offset = pattern.indexIn(window);
+                while (offset >= 0 && offset < own) {
+                    addHit(item, windowStart + offset);
+                    offset = pattern.indexIn(window, offset + 1);
+                }
+            }
+
+            start += part.size();
+        }
     }
-    else {
-        if (mode == SEARCH_MODE_HEADER)
-            data.append(model->header(index)).append(model->tail(index));
-        else if (mode == SEARCH_MODE_BODY)
-            data.append(model->body(index));
-        else
-            data.append(model->header(index)).append(model->body(index)).append(model->tail(index));
+
+    void addHit(const int item, const UINT32 offset)
+    {
+        SearchHit hit;
+        hit.item = item;
+        hit.offset = offset;
+        hits.append(hit);
+    }
+
+    FfsEngine* engine;
+    QAtomicInt* cancelled;
+    bool notify;
+    BytePattern pattern;
+    QVector<SearchItem> items;
+    QVector<SearchHit> hits;
+    bool complete;
+    QAtomicInt done;
+};
+
+// Bytes of searched item data, which can be in several parts
+static QByteArray searchItemBytes(const SearchItem & item, UINT32 offset, const UINT32 size)
+{
+    QByteArray bytes;
+    for (int i = 0; i < SEARCH_ITEM_PARTS && (UINT32)bytes.size() < size; i++) {
+        const QByteArray & part = item.parts[i];
+        if (offset >= (UINT32)part.size()) {
+            offset -= part.size();
+            continue;
+        }
+        bytes.append(part.mid(offset, size - bytes.size()));
+        offset = 0;
     }
+    return bytes;
+}
 
-    QString hexBody = QString(data.toHex());
+static UINT8 guidToHexPattern(const QByteArray & guidPattern, QByteArray & hexPattern)
+{
     QList<QByteArray> list = guidPattern.split('-');
     if (list.count() != 5)
         return ERR_INVALID_PARAMETER;
-    
-    QByteArray hexPattern;
+
+    hexPattern.clear();
     // Reverse first GUID block
     hexPattern.append(list.at(0).mid(6, 2));
     hexPattern.append(list.at(0).mid(4, 2));
@@ -3058,196 +3928,462 @@ UINT8 FfsEngine::findGuidPattern(const QModelIndex & index, const QByteArray & g
     // Append fourth and fifth GUID blocks as is
     hexPattern.append(list.at(3)).append(list.at(4));
 
+    return ERR_SUCCESS;
+}
+
+UINT8 FfsEngine::findHexPattern(const QModelIndex & index, const QByteArray & hexPattern, const UINT8 mode)
+{
+    UINT8 result = startHexSearch(index, hexPattern, mode, false);
+    if (!result)
+        waitForSearch();
+    return result;
+}
+
+UINT8 FfsEngine::findGuidPattern(const QModelIndex & index, const QByteArray & guidPattern, const UINT8 mode)
+{
+    UINT8 result = startGuidSearch(index, guidPattern, mode, false);
+    if (!result)
+        waitForSearch();
+    return result;
+}
+
+UINT8 FfsEngine::findTextPattern(const QModelIndex & index, const QString & pattern, const bool unicode, const Qt::CaseSensitivity caseSensitive)
+{
+    UINT8 result = startTextSearch(index, pattern, unicode, caseSensitive, false);
+    if (!result)
+        waitForSearch();
+    return result;
+}
+
+UINT8 FfsEngine::startHexSearch(const QModelIndex & index, const QByteArray & hexPattern, const UINT8 mode, const bool notify)
+{
+    if (hexPattern.isEmpty())
+        return ERR_INVALID_PARAMETER;
+
+    BytePattern pattern;
+    if (pattern.compile(hexPattern))
+        return ERR_INVALID_PARAMETER;
+
     // Check for "all substrings" pattern
-    if (hexPattern.count('.') == hexPattern.length())
+    if (pattern.isWildcard())
         return ERR_SUCCESS;
 
-    QRegExp regexp = QRegExp(QString(hexPattern), Qt::CaseInsensitive);
-    INT32 offset = regexp.indexIn(hexBody);
-    while (offset >= 0) {
-        if (offset % 2 == 0) {
-            msg(tr("GUID pattern \"%1\" found as \"%2\" in %3 at %4-offset %5")
-                .arg(QString(guidPattern))
-                .arg(hexBody.mid(offset, hexPattern.length()))
-                .arg(model->nameString(index))
-                .arg(mode == SEARCH_MODE_BODY ? tr("body") : tr("header"))
-                .arg(offset / 2, 8, 16, QChar('0')),
-                index);
-        }
-        offset = regexp.indexIn(hexBody, offset + 1);
-    }
+    cancelSearch();
+    searchType = SEARCH_TYPE_BYTES;
+    searchMode = mode;
+    searchPattern = pattern;
+    searchDescription = tr("Hex pattern \"%1\"").arg(QString(hexPattern));
+    return startSearch(index, notify);
+}
 
-    return ERR_SUCCESS;
+UINT8 FfsEngine::startGuidSearch(const QModelIndex & index, const QByteArray & guidPattern, const UINT8 mode, const bool notify)
+{
+    if (guidPattern.isEmpty())
+        return ERR_INVALID_PARAMETER;
+
+    QByteArray hexPattern;
+    if (guidToHexPattern(guidPattern, hexPattern))
+        return ERR_INVALID_PARAMETER;
+
+    BytePattern pattern;
+    if (pattern.compile(hexPattern))
+        return ERR_INVALID_PARAMETER;
+
+    // Check for "all substrings" pattern
+    if (pattern.isWildcard())
+        return ERR_SUCCESS;
+
+    cancelSearch();
+    searchType = SEARCH_TYPE_BYTES;
+    searchMode = mode;
+    searchPattern = pattern;
+    searchDescription = tr("GUID pattern \"%1\"").arg(QString(guidPattern));
+    return startSearch(index, notify);
 }
 
-UINT8 FfsEngine::findTextPattern(const QModelIndex & index, const QString & pattern, const bool unicode, const Qt::CaseSensitivity caseSensitive)
+UINT8 FfsEngine::startTextSearch(const QModelIndex & index, const QString & pattern, const bool unicode, const Qt::CaseSensitivity caseSensitive, const bool notify)
 {
     if (pattern.isEmpty())
         return ERR_INVALID_PARAMETER;
 
+    // Text is encoded once and searched as raw bytes at any alignment
+    BytePattern bytePattern;
+    if (bytePattern.compileText(pattern, unicode, caseSensitive == Qt::CaseSensitive))
+        return ERR_INVALID_PARAMETER;
+
+    cancelSearch();
+    searchType = SEARCH_TYPE_TEXT;
+    searchMode = SEARCH_MODE_BODY;
+    searchPattern = bytePattern;
+    searchText = pattern;
+    searchUnicode = unicode;
+    return startSearch(index, notify);
+}
+
+void FfsEngine::collectSearchItems(const QModelIndex & index, QVector<SearchItem> & items)
+{
     if (!index.isValid())
-        return ERR_SUCCESS;
+        return;
 
     bool hasChildren = (model->rowCount(index) > 0);
     for (int i = 0; i < model->rowCount(index); i++) {
-        findTextPattern(index.child(i, index.column()), pattern, unicode, caseSensitive);
+        collectSearchItems(index.child(i, index.column()), items);
     }
 
-    if (hasChildren)
-        return ERR_SUCCESS;
+    // Data is shared with the tree, nothing is copied here
+    SearchItem item;
+    item.index = index;
+    if (searchType == SEARCH_TYPE_TEXT) {
+        // Text is searched in bodies of leaf items
+        if (hasChildren)
+            return;
+        item.parts[1] = model->body(index);
+    }
+    else if (hasChildren) {
+        if (searchMode != SEARCH_MODE_BODY)
+            item.parts[0] = model->header(index);
+    }
+    else {
+        if (searchMode != SEARCH_MODE_BODY) {
+            item.parts[0] = model->header(index);
+            item.parts[2] = model->tail(index);
+        }
+        if (searchMode != SEARCH_MODE_HEADER)
+            item.parts[1] = model->body(index);
+    }
 
-    QString data;
-    if (unicode)
-        data = QString::fromUtf16((const ushort*)model->body(index).data(), model->body(index).length() / 2);
-    else
-        data = QString::fromLatin1((const char*)model->body(index).data(), model->body(index).length());
+    for (int i = 0; i < SEARCH_ITEM_PARTS; i++) {
+        if (!item.parts[i].isEmpty()) {
+            items.append(item);
+            break;
+        }
+    }
+}
+
+UINT8 FfsEngine::startSearch(const QModelIndex & index, const bool notify)
+{
+    if (!index.isValid())
+        return ERR_SUCCESS;
 
-    int offset = -1;
-    while ((offset = data.indexOf(pattern, offset + 1, caseSensitive)) >= 0) {
-        msg(tr("%1 text \"%2\" found in %3 at offset %4")
-            .arg(unicode ? "Unicode" : "ASCII")
-            .arg(pattern)
-            .arg(model->nameString(index))
-            .arg(unicode ? offset * 2 : offset, 8, 16, QChar('0')),
-            index);
+    // Item data is collected here, so workers never access the model
+    // Only references to shared data are taken, so this walk doesn't copy any item data
+    QVector<SearchItem> items;
+    collectSearchItems(index, items);
+
+    // Split items into chunks in tree order
+    searchCancelled.fetchAndStoreOrdered(0);
+    SearchChunk* chunk = NULL;
+    UINT32 chunkSize = 0;
+    for (int i = 0; i < items.size(); i++) {
+        if (!chunk || chunkSize >= SEARCH_CHUNK_SIZE) {
+            chunk = new SearchChunk(this, &searchCancelled, notify);
+            chunk->pattern = searchPattern;
+            searchChunks.append(chunk);
+            chunkSize = 0;
+        }
+        chunk->items.append(items.at(i));
+        for (int j = 0; j < SEARCH_ITEM_PARTS; j++)
+            chunkSize += items.at(i).parts[j].size();
     }
 
+    searching = true;
+    searchChunksReported = 0;
+    for (int i = 0; i < searchChunks.size(); i++)
+        searchPool.start(searchChunks[i]);
+
+    // Nothing to search
+    if (searchChunks.isEmpty())
+        reportSearchResults();
+
     return ERR_SUCCESS;
 }
 
-UINT8 FfsEngine::rebase(QByteArray &executable, const UINT32 base)
+void FfsEngine::deleteSearchChunks()
 {
-    UINT32 delta;       // Difference between old and new base addresses
-    UINT32 relocOffset; // Offset of relocation region
-    UINT32 relocSize;   // Size of relocation region
-    UINT32 teFixup = 0; // Bytes removed form PE header for TE images
+    qDeleteAll(searchChunks);
+    searchChunks.clear();
+}
 
-    // Copy input data to local storage
-    QByteArray file = executable;
+void FfsEngine::waitForSearch()
+{
+    searchPool.waitForDone();
+    reportSearchResults();
+}
+
+void FfsEngine::cancelSearch()
+{
+    if (!searching)
+        return;
+
+    searchCancelled.fetchAndStoreOrdered(1);
+    waitForSearch();
+}
+
+bool FfsEngine::isSearching() const
+{
+    return searching;
+}
+
+void FfsEngine::reportSearchResults()
+{
+    if (!searching)
+        return;
+
+    bool cancelled = false;
+    while (searchChunksReported < searchChunks.size()) {
+        SearchChunk* chunk = searchChunks[searchChunksReported];
+        if (!chunk->done.fetchAndAddOrdered(0))
+            break;
+
+        for (int i = 0; i < chunk->hits.size(); i++) {
+            const SearchItem & item = chunk->items.at(chunk->hits.at(i).item);
+            UINT32 offset = chunk->hits.at(i).offset;
+            QString location = provenanceString(item.index, searchItemOffset(item.index, searchMode, offset));
+            if (searchType == SEARCH_TYPE_TEXT)
+                msg(tr("%1 text \"%2\" found in %3 at offset %4%5")
+                    .arg(searchUnicode ? "Unicode" : "ASCII")
+                    .arg(searchText)
+                    .arg(model->nameString(item.index))
+                    .arg(offset, 8, 16, QChar('0'))
+                    .arg(location.isEmpty() ? QString() : tr(", %1").arg(location)),
+                    item.index);
+            else
+                msg(tr("%1 found as \"%2\" in %3 at %4-offset %5%6")
+                    .arg(searchDescription)
+                    .arg(QString(searchItemBytes(item, offset, searchPattern.size()).toHex()))
+                    .arg(model->nameString(item.index))
+                    .arg(searchMode == SEARCH_MODE_BODY ? tr("body") : tr("header"))
+                    .arg(offset, 8, 16, QChar('0'))
+                    .arg(location.isEmpty() ? QString() : tr(", %1").arg(location)),
+                    item.index);
+        }
+        searchChunksReported++;
+
+        // Chunks after the interrupted one are not reported to keep tree order
+        if (!chunk->complete) {
+            cancelled = true;
+            break;
+        }
+    }
+
+    if (!cancelled && searchChunksReported < searchChunks.size()) {
+        emit searchProgress(searchChunksReported, searchChunks.size());
+        return;
+    }
+
+    // All chunks are finished after cancellation, so they can be deleted
+    searchPool.waitForDone();
+    emit searchProgress(searchChunks.size(), searchChunks.size());
+    deleteSearchChunks();
+    searching = false;
+    emit searchFinished(cancelled);
+}
+
+// Location of image base and relocation directory in PE or TE image
+struct RELOCATION_INFO {
+    UINT32  ImageBaseOffset;
+    BOOLEAN ImageBase64;
+    UINT32  RelocOffset;
+    UINT32  RelocSize;
+    UINT32  TeFixup; // Bytes removed form PE header for TE images
+};
+
+static UINT8 getRelocationInfo(const QByteArray & file, RELOCATION_INFO & info)
+{
+    info.TeFixup = 0;
+    if ((UINT32)file.size() < sizeof(EFI_IMAGE_DOS_HEADER))
+        return ERR_UNKNOWN_IMAGE_TYPE;
 
     // Populate DOS header
-    EFI_IMAGE_DOS_HEADER* dosHeader = (EFI_IMAGE_DOS_HEADER*)file.data();
+    const EFI_IMAGE_DOS_HEADER* dosHeader = (const EFI_IMAGE_DOS_HEADER*)file.constData();
 
     // Check signature
     if (dosHeader->e_magic == EFI_IMAGE_DOS_SIGNATURE){
         UINT32 offset = dosHeader->e_lfanew;
-        EFI_IMAGE_PE_HEADER* peHeader = (EFI_IMAGE_PE_HEADER*)(file.data() + offset);
+        if ((UINT64)offset + sizeof(EFI_IMAGE_PE_HEADER) + sizeof(EFI_IMAGE_FILE_HEADER) + sizeof(EFI_IMAGE_OPTIONAL_HEADER64) > (UINT64)file.size())
+            return ERR_UNKNOWN_IMAGE_TYPE;
+        const EFI_IMAGE_PE_HEADER* peHeader = (const EFI_IMAGE_PE_HEADER*)(file.constData() + offset);
         if (peHeader->Signature != EFI_IMAGE_PE_SIGNATURE)
             return ERR_UNKNOWN_IMAGE_TYPE;
         offset += sizeof(EFI_IMAGE_PE_HEADER);
         // Skip file header
         offset += sizeof(EFI_IMAGE_FILE_HEADER);
         // Check optional header magic
-        UINT16 magic = *(UINT16*)(file.data() + offset);
+        UINT16 magic = *(const UINT16*)(file.constData() + offset);
         if (magic == EFI_IMAGE_PE_OPTIONAL_HDR32_MAGIC) {
-            EFI_IMAGE_OPTIONAL_HEADER32* optHeader = (EFI_IMAGE_OPTIONAL_HEADER32*)(file.data() + offset);
-            delta = base - optHeader->ImageBase;
-            if (!delta)
-                // No need to rebase
-                return ERR_SUCCESS;
-            relocOffset = optHeader->DataDirectory[EFI_IMAGE_DIRECTORY_ENTRY_BASERELOC].VirtualAddress;
-            relocSize = optHeader->DataDirectory[EFI_IMAGE_DIRECTORY_ENTRY_BASERELOC].Size;
-            // Set new base
-            optHeader->ImageBase = base;
+            const EFI_IMAGE_OPTIONAL_HEADER32* optHeader = (const EFI_IMAGE_OPTIONAL_HEADER32*)(file.constData() + offset);
+            info.ImageBaseOffset = offset + ((const UINT8*)&optHeader->ImageBase - (const UINT8*)optHeader);
+            info.ImageBase64 = FALSE;
+            info.RelocOffset = optHeader->DataDirectory[EFI_IMAGE_DIRECTORY_ENTRY_BASERELOC].VirtualAddress;
+            info.RelocSize = optHeader->DataDirectory[EFI_IMAGE_DIRECTORY_ENTRY_BASERELOC].Size;
         }
         else if (magic == EFI_IMAGE_PE_OPTIONAL_HDR64_MAGIC) {
-            EFI_IMAGE_OPTIONAL_HEADER64* optHeader = (EFI_IMAGE_OPTIONAL_HEADER64*)(file.data() + offset);
-            delta = base - optHeader->ImageBase;
-            if (!delta)
-                // No need to rebase
-                return ERR_SUCCESS;
-            relocOffset = optHeader->DataDirectory[EFI_IMAGE_DIRECTORY_ENTRY_BASERELOC].VirtualAddress;
-            relocSize = optHeader->DataDirectory[EFI_IMAGE_DIRECTORY_ENTRY_BASERELOC].Size;
-            // Set new base
-            optHeader->ImageBase = base;
+            const EFI_IMAGE_OPTIONAL_HEADER64* optHeader = (const EFI_IMAGE_OPTIONAL_HEADER64*)(file.constData() + offset);
+            info.ImageBaseOffset = offset + ((const UINT8*)&optHeader->ImageBase - (const UINT8*)optHeader);
+            info.ImageBase64 = TRUE;
+            info.RelocOffset = optHeader->DataDirectory[EFI_IMAGE_DIRECTORY_ENTRY_BASERELOC].VirtualAddress;
+            info.RelocSize = optHeader->DataDirectory[EFI_IMAGE_DIRECTORY_ENTRY_BASERELOC].Size;
         }
         else
             return ERR_UNKNOWN_PE_OPTIONAL_HEADER_TYPE;
     }
     else if (dosHeader->e_magic == EFI_IMAGE_TE_SIGNATURE){
+        if ((UINT32)file.size() < sizeof(EFI_IMAGE_TE_HEADER))
+            return ERR_UNKNOWN_IMAGE_TYPE;
         // Populate TE header
-        EFI_IMAGE_TE_HEADER* teHeader = (EFI_IMAGE_TE_HEADER*)file.data();
-        delta = base - teHeader->ImageBase;
-        if (!delta)
-            // No need to rebase
-            return ERR_SUCCESS;
-        relocOffset = teHeader->DataDirectory[EFI_IMAGE_TE_DIRECTORY_ENTRY_BASERELOC].VirtualAddress;
-        teFixup = teHeader->StrippedSize - sizeof(EFI_IMAGE_TE_HEADER);
-        relocSize = teHeader->DataDirectory[EFI_IMAGE_TE_DIRECTORY_ENTRY_BASERELOC].Size;
-        // Set new base
-        teHeader->ImageBase = base;
+        const EFI_IMAGE_TE_HEADER* teHeader = (const EFI_IMAGE_TE_HEADER*)file.constData();
+        info.ImageBaseOffset = (const UINT8*)&teHeader->ImageBase - (const UINT8*)teHeader;
+        info.ImageBase64 = TRUE;
+        info.RelocOffset = teHeader->DataDirectory[EFI_IMAGE_TE_DIRECTORY_ENTRY_BASERELOC].VirtualAddress;
+        info.TeFixup = teHeader->StrippedSize - sizeof(EFI_IMAGE_TE_HEADER);
+        info.RelocSize = teHeader->DataDirectory[EFI_IMAGE_TE_DIRECTORY_ENTRY_BASERELOC].Size;
     }
     else
         return ERR_UNKNOWN_IMAGE_TYPE;
 
+    return ERR_SUCCESS;
+}
+
+// Difference between old and new base addresses
+static UINT32 getRelocationDelta(const QByteArray & file, const RELOCATION_INFO & info, const UINT32 base)
+{
+    if (info.ImageBase64)
+        return base - (UINT32)*(const UINT64*)(file.constData() + info.ImageBaseOffset);
+    return base - *(const UINT32*)(file.constData() + info.ImageBaseOffset);
+}
+
+UINT8 FfsEngine::getRelocations(const QByteArray & executable, QVector<UINT32> & relocations)
+{
+    RELOCATION_INFO info;
+    UINT8 result = getRelocationInfo(executable, info);
+    if (result)
+        return result;
+
+    relocations.clear();
+
     // No relocations
-    if (relocOffset == 0) {
-        // No need to fix relocations
-        executable = file;
+    if (info.RelocOffset == 0)
         return ERR_SUCCESS;
-    }
 
-    EFI_IMAGE_BASE_RELOCATION   *RelocBase;
-    EFI_IMAGE_BASE_RELOCATION   *RelocBaseEnd;
-    UINT16                      *Reloc;
-    UINT16                      *RelocEnd;
-    UINT16                      *F16;
-    UINT32                      *F32;
-    UINT64                      *F64;
+    // Check relocation directory to be inside of the image
+    UINT64 relocBegin = (UINT64)info.RelocOffset - info.TeFixup;
+    UINT64 relocEnd = relocBegin + info.RelocSize;
+    if (info.RelocOffset < info.TeFixup || relocEnd > (UINT64)executable.size())
+        return ERR_INVALID_PARAMETER;
 
     // Run the whole relocation block
-    RelocBase = (EFI_IMAGE_BASE_RELOCATION*)(file.data() + relocOffset - teFixup);
-    RelocBaseEnd = (EFI_IMAGE_BASE_RELOCATION*)(file.data() + relocOffset - teFixup + relocSize);
-
-    while (RelocBase < RelocBaseEnd) {
-        Reloc = (UINT16*)((UINT8*)RelocBase + sizeof(EFI_IMAGE_BASE_RELOCATION));
-        RelocEnd = (UINT16*)((UINT8*)RelocBase + RelocBase->SizeOfBlock);
+    const UINT8* data = (const UINT8*)executable.constData();
+    UINT32 blockOffset = (UINT32)relocBegin;
+    while (blockOffset + sizeof(EFI_IMAGE_BASE_RELOCATION) <= relocEnd) {
+        const EFI_IMAGE_BASE_RELOCATION* relocBase = (const EFI_IMAGE_BASE_RELOCATION*)(data + blockOffset);
+        if (relocBase->SizeOfBlock < sizeof(EFI_IMAGE_BASE_RELOCATION) || blockOffset + relocBase->SizeOfBlock > relocEnd)
+            return ERR_INVALID_PARAMETER;
+        const UINT16* reloc = (const UINT16*)(relocBase + 1);
+        const UINT16* relocEndPtr = (const UINT16*)((const UINT8*)relocBase + relocBase->SizeOfBlock);
 
         // Run this relocation record
-        while (Reloc < RelocEnd) {
-            UINT8* data = (UINT8*)(file.data() + RelocBase->VirtualAddress - teFixup + (*Reloc & 0x0FFF));
-            switch ((*Reloc) >> 12) {
+        while (reloc < relocEndPtr) {
+            UINT8 type = (*reloc) >> 12;
+            UINT64 offset = (UINT64)relocBase->VirtualAddress - info.TeFixup + (*reloc & 0x0FFF);
+            UINT32 size;
+            switch (type) {
             case EFI_IMAGE_REL_BASED_ABSOLUTE:
-                // Do nothing
+                // Nothing to fix
+                size = 0;
                 break;
-
             case EFI_IMAGE_REL_BASED_HIGH:
-                // Add second 16 bits of delta
-                F16 = (UINT16*)data;
-                *F16 = (UINT16)(*F16 + (UINT16)(((UINT32)delta) >> 16));
-                break;
-
             case EFI_IMAGE_REL_BASED_LOW:
-                // Add first 16 bits of delta
-                F16 = (UINT16*)data;
-                *F16 = (UINT16)(*F16 + (UINT16)delta);
+                size = sizeof(UINT16);
                 break;
-
             case EFI_IMAGE_REL_BASED_HIGHLOW:
-                // Add first 32 bits of delta
-                F32 = (UINT32*)data;
-                *F32 = *F32 + (UINT32)delta;
+                size = sizeof(UINT32);
                 break;
-
             case EFI_IMAGE_REL_BASED_DIR64:
-                // Add all 64 bits of delta
-                F64 = (UINT64*)data;
-                *F64 = *F64 + (UINT64)delta;
+                size = sizeof(UINT64);
                 break;
-
             default:
                 return ERR_UNKNOWN_RELOCATION_TYPE;
             }
 
+            if (size) {
+                if (offset + size > (UINT64)executable.size() || offset > RELOCATION_OFFSET_MASK)
+                    return ERR_INVALID_PARAMETER;
+                relocations.append(((UINT32)type << RELOCATION_TYPE_SHIFT) | (UINT32)offset);
+            }
+
             // Next relocation record
-            Reloc += 1;
+            reloc += 1;
         }
 
         // Next relocation block
-        RelocBase = (EFI_IMAGE_BASE_RELOCATION*)RelocEnd;
+        blockOffset += relocBase->SizeOfBlock;
+    }
+
+    return ERR_SUCCESS;
+}
+
+UINT8 FfsEngine::rebase(QByteArray &executable, const UINT32 base)
+{
+    RELOCATION_INFO info;
+    UINT8 result = getRelocationInfo(executable, info);
+    if (result)
+        return result;
+    if (!getRelocationDelta(executable, info, base))
+        // No need to rebase, relocations are not even checked
+        return ERR_SUCCESS;
+
+    QVector<UINT32> relocations;
+    result = getRelocations(executable, relocations);
+    if (result)
+        return result;
+
+    return rebase(executable, base, relocations);
+}
+
+UINT8 FfsEngine::rebase(QByteArray &executable, const UINT32 base, const QVector<UINT32> & relocations)
+{
+    RELOCATION_INFO info;
+    UINT8 result = getRelocationInfo(executable, info);
+    if (result)
+        return result;
+
+    UINT32 delta = getRelocationDelta(executable, info, base);
+    if (!delta)
+        // No need to rebase
+        return ERR_SUCCESS;
+
+    // Set new base
+    UINT8* data = (UINT8*)executable.data();
+    if (info.ImageBase64)
+        *(UINT64*)(data + info.ImageBaseOffset) = base;
+    else
+        *(UINT32*)(data + info.ImageBaseOffset) = base;
+
+    // Apply all fixups
+    const UINT32* relocation = relocations.constData();
+    const UINT32* relocationEnd = relocation + relocations.size();
+    for (; relocation < relocationEnd; relocation++) {
+        UINT8* fixup = data + (*relocation & RELOCATION_OFFSET_MASK);
+        switch (*relocation >> RELOCATION_TYPE_SHIFT) {
+        case EFI_IMAGE_REL_BASED_HIGH:
+            // Add second 16 bits of delta
+            *(UINT16*)fixup = (UINT16)(*(UINT16*)fixup + (UINT16)(delta >> 16));
+            break;
+        case EFI_IMAGE_REL_BASED_LOW:
+            // Add first 16 bits of delta
+            *(UINT16*)fixup = (UINT16)(*(UINT16*)fixup + (UINT16)delta);
+            break;
+        case EFI_IMAGE_REL_BASED_HIGHLOW:
+            // Add first 32 bits of delta
+            *(UINT32*)fixup += delta;
+            break;
+        case EFI_IMAGE_REL_BASED_DIR64:
+            // Add all 64 bits of delta
+            *(UINT64*)fixup += (UINT64)delta;
+            break;
+        }
     }
 
-    executable = file;
     return ERR_SUCCESS;
 }
 
@@ -3409,51 +4545,83 @@ UINT32 FfsEngine::crc32(UINT32 initial, const UINT8* buffer, UINT32 length)
     return(crc32 ^ 0xFFFFFFFF);
 }
 
-UINT8 FfsEngine::dump(const QModelIndex & index, const QString path)
+UINT8 FfsEngine::dump(const QModelIndex & index, const QString path, const UINT8 layout, const ItemFilter & filter)
 {
     if (!index.isValid())
         return ERR_INVALID_PARAMETER;
-    
-    QDir dir;
-    if (dir.cd(path))
-        return ERR_DIR_ALREADY_EXIST;
 
-    if (!dir.mkpath(path))
-        return ERR_DIR_CREATE;
+    // Dump directory or archive is not created if nothing is selected
+    if (!filter.isEmpty() && !containsSelected(filter, index))
+        return ERR_ITEM_NOT_FOUND;
 
-    QFile file;
-    if (!model->header(index).isEmpty()) {
-        file.setFileName(tr("%1/header.bin").arg(path));
-        if (!file.open(QFile::WriteOnly))
-            return ERR_FILE_OPEN;
-        file.write(model->header(index));
-        file.close();
+    // Tree is walked here, directories and files are created by I/O threads
+    DumpWriter writer(dumpWriters);
+    UINT8 result = writer.open(path, layout);
+    if (result)
+        return result;
+
+    UINT32 dumped = 0;
+    result = dumpItem(index, QString(), writer, filter.isEmpty() ? NULL : &filter, dumped);
+    UINT8 writeResult = writer.close();
+    if (result)
+        return result;
+    if (writeResult)
+        return writeResult;
+    if (!dumped)
+        return ERR_ITEM_NOT_FOUND;
+
+    return ERR_SUCCESS;
+}
+
+bool FfsEngine::containsSelected(const ItemFilter & filter, const QModelIndex & index)
+{
+    // Walks the tree the same way as dumpItem does
+    if (isSelected(filter, index))
+        return true;
+    if (model->type(index) == Types::File && !mayContainSelected(filter, index))
+        return false;
+
+    for (int i = 0; i < model->rowCount(index); i++) {
+        if (containsSelected(filter, index.child(i, 0)))
+            return true;
     }
-    
-    if (!model->body(index).isEmpty()) {
-        file.setFileName(tr("%1/body.bin").arg(path));
-        if (!file.open(QFile::WriteOnly))
-            return ERR_FILE_OPEN;
-        file.write(model->body(index));
-        file.close();
-    }
-
-    QString info = tr("Type: %1\nSubtype: %2\n%3%4")
-        .arg(model->typeString(index))
-        .arg(model->subtypeString(index))
-        .arg(model->textString(index).isEmpty() ? "" : tr("Text: %1\n").arg(model->textString(index)))
-        .arg(model->info(index));
-    file.setFileName(tr("%1/info.txt").arg(path));
-    if (!file.open(QFile::Text | QFile::WriteOnly))
-        return ERR_FILE_OPEN;
-    file.write(info.toLatin1());
-    file.close();
+    return false;
+}
+
+UINT8 FfsEngine::dumpItem(const QModelIndex & index, const QString & path, DumpWriter & writer, const ItemFilter* filter, UINT32 & dumped)
+{
+    // Items outside of selected ones are only walked through, their children are dumped to the same paths as without filter
+    if (filter && isSelected(*filter, index))
+        filter = NULL;
+    else if (filter && model->type(index) == Types::File && !mayContainSelected(*filter, index))
+        return ERR_SUCCESS;
 
     UINT8 result;
+    if (!filter) {
+        DumpEntry entry;
+        entry.path = path;
+        entry.header = model->header(index);
+        entry.body = model->body(index);
+
+        QString location = provenanceString(index);
+        QString info = tr("Type: %1\nSubtype: %2\n%3%4%5")
+            .arg(model->typeString(index))
+            .arg(model->subtypeString(index))
+            .arg(model->textString(index).isEmpty() ? "" : tr("Text: %1\n").arg(model->textString(index)))
+            .arg(location.isEmpty() ? "" : tr("Location: %1\n").arg(location))
+            .arg(model->info(index));
+        entry.info = info.toLatin1();
+
+        result = writer.write(entry);
+        if (result)
+            return result;
+        dumped++;
+    }
+
     for (int i = 0; i < model->rowCount(index); i++) {
         QModelIndex childIndex = index.child(i, 0);
-        QString childPath = tr("%1/%2 %3").arg(path).arg(i).arg(model->textString(childIndex).isEmpty() ? model->nameString(childIndex) : model->textString(childIndex));
-        result = dump(childIndex, childPath);
+        QString childName = tr("%1 %2").arg(i).arg(model->textString(childIndex).isEmpty() ? model->nameString(childIndex) : model->textString(childIndex));
+        result = dumpItem(childIndex, path.isEmpty() ? childName : tr("%1/%2").arg(path).arg(childName), writer, filter, dumped);
         if (result)
             return result;
     }
@@ -3461,126 +4629,121 @@ UINT8 FfsEngine::dump(const QModelIndex & index, const QString path)
     return ERR_SUCCESS;
 }
 
-UINT8 FfsEngine::patch(const QModelIndex & index, const QVector<PatchData> & patches)
+bool FfsEngine::isSelected(const ItemFilter & filter, const QModelIndex & index)
 {
-    if (!index.isValid() || patches.isEmpty() || model->rowCount(index))
-        return ERR_INVALID_PARAMETER;
+    UINT8 type = model->type(index);
+    if (type == Types::File)
+        return filter.sectionTypes.isEmpty() && fileMatches(filter, index, true);
+
+    if (type == Types::Section && filter.sectionTypes.contains(model->subtype(index))) {
+        // Sections outside of files are selected only without file criteria
+        QModelIndex file = model->findParentOfType(index, Types::File);
+        if (!file.isValid())
+            return filter.guids.isEmpty() && filter.fileTypes.isEmpty() && filter.names.isEmpty();
+        return fileMatches(filter, file, true);
+    }
 
-    // Skip removed items
-    if (model->action(index) == Actions::Remove)
-        return ERR_NOTHING_TO_PATCH;
+    return false;
+}
 
-    UINT8 result;
-    
-    // Apply patches to item's body
-    QByteArray body = model->body(index);
-    PatchData current;
-    Q_FOREACH(current, patches)
-    {
-        if (current.type == PATCH_TYPE_OFFSET) {
-            result = patchViaOffset(body, current.offset, current.hexReplacePattern);
-            if (result)
-                return result;
-        }
-        else if (current.type == PATCH_TYPE_PATTERN) {
-            result = patchViaPattern(body, current.hexFindPattern, current.hexReplacePattern);
-            if (result)
-                return result;
-        }
-        else 
-            return ERR_UNKNOWN_PATCH_TYPE;
+bool FfsEngine::fileMatches(const ItemFilter & filter, const QModelIndex & file, const bool checkNames)
+{
+    QByteArray header = model->header(file);
+    if ((UINT32)header.size() < sizeof(EFI_FFS_FILE_HEADER))
+        return false;
+    const EFI_FFS_FILE_HEADER* fileHeader = (const EFI_FFS_FILE_HEADER*)header.constData();
+
+    if (!filter.guids.isEmpty() && !filter.guids.contains(QByteArray((const char*)&fileHeader->Name, sizeof(EFI_GUID))))
+        return false;
+    if (!filter.fileTypes.isEmpty() && !filter.fileTypes.contains(fileHeader->Type))
+        return false;
+    if (!checkNames || filter.names.isEmpty())
+        return true;
+
+    QString text = model->textString(file);
+    QString guid = guidToQString(fileHeader->Name);
+    for (int i = 0; i < filter.names.size(); i++) {
+        QRegExp wildcard(filter.names.at(i), Qt::CaseInsensitive, QRegExp::Wildcard);
+        if (wildcard.exactMatch(text) || wildcard.exactMatch(guid))
+            return true;
     }
+    return false;
+}
 
-    if (body != model->body(index)) {
-        QByteArray patched = model->header(index);
-        patched.append(body);
-        return replace(index, patched, REPLACE_MODE_AS_IS);
+bool FfsEngine::mayContainSelected(const ItemFilter & filter, const QModelIndex & file)
+{
+    if (!file.isValid())
+        return true;
+
+    // File text can be in compressed data, so only GUID and type are checked
+    if (fileMatches(filter, file, false))
+        return true;
+
+    // Nested volumes with other files can be only in files of these types
+    switch (model->subtype(file)) {
+    case EFI_FV_FILETYPE_SECURITY_CORE:
+    case EFI_FV_FILETYPE_PEI_CORE:
+    case EFI_FV_FILETYPE_DXE_CORE:
+    case EFI_FV_FILETYPE_PEIM:
+    case EFI_FV_FILETYPE_DRIVER:
+    case EFI_FV_FILETYPE_COMBINED_PEIM_DRIVER:
+    case EFI_FV_FILETYPE_APPLICATION:
+    case EFI_FV_FILETYPE_SMM:
+    case EFI_FV_FILETYPE_COMBINED_SMM_DXE:
+    case EFI_FV_FILETYPE_SMM_CORE:
+        return false;
+    default:
+        return true;
     }
-    
-    return ERR_NOTHING_TO_PATCH;
 }
 
-UINT8 FfsEngine::patchViaOffset(QByteArray & data, const UINT32 offset, const QByteArray & hexReplacePattern)
+UINT8 FfsEngine::patch(const QModelIndex & index, const QVector<PatchData> & patches)
 {
-    QByteArray body = data;
-    
-    // Skip patterns with odd length
-    if (hexReplacePattern.length() % 2 > 0) 
+    if (patches.isEmpty())
         return ERR_INVALID_PARAMETER;
-    
-    // Check offset bounds
-    if (offset > (UINT32)(body.length() - hexReplacePattern.length() / 2))
-        return ERR_PATCH_OFFSET_OUT_OF_BOUNDS;
-
-    // Parse replace pattern
-    QByteArray replacePattern;
-    bool converted;
-    for (int i = 0; i < hexReplacePattern.length() / 2; i++) {
-        QByteArray hex = hexReplacePattern.mid(2 * i, 2);
-        UINT8 value = 0;
-
-        if (!hex.contains('.')) { // Normal byte pattern 
-            value = (UINT8)hex.toUShort(&converted, 16);
-            if (!converted)
-                return ERR_INVALID_SYMBOL;
-        }
-        else { // Placeholder byte pattern
-            if (hex[0] == '.' && hex[1] == '.') { // Full byte placeholder
-                value = body.at(offset + i);
-            }
-            else if (hex[0] == '.') {// Upper byte part placeholder
-                hex[0] = '0';
-                value =  (UINT8)(body.at(offset + i) & 0xF0);
-                value += (UINT8)hex.toUShort(&converted, 16);
-                if (!converted)
-                    return ERR_INVALID_SYMBOL;
-            }
-            else if (hex[1] == '.') { // Lower byte part placeholder
-                hex[1] = '0';
-                value = (UINT8)(body.at(offset + i) & 0x0F);
-                value += (UINT8)hex.toUShort(&converted, 16);
-                if (!converted)
-                    return ERR_INVALID_SYMBOL;
-            }
-            else
-                return ERR_INVALID_SYMBOL;
-        }
 
-        // Append calculated value to real pattern
-        replacePattern.append(value);
-    }
+    PatchProgram program;
+    UINT8 result = program.compile(patches);
+    if (result)
+        return result;
 
-    body.replace(offset, replacePattern.length(), replacePattern);
-    msg(tr("patch: replaced %1 bytes at offset 0x%2 %3 -> %4")
-        .arg(replacePattern.length())
-        .arg(offset, 8, 16, QChar('0'))
-        .arg(QString(data.mid(offset, replacePattern.length()).toHex()))
-        .arg(QString(replacePattern.toHex())));
-    data = body;
-    return ERR_SUCCESS;
+    return patch(index, program);
 }
 
-UINT8 FfsEngine::patchViaPattern(QByteArray & data, const QByteArray & hexFindPattern, const QByteArray & hexReplacePattern)
+UINT8 FfsEngine::patch(const QModelIndex & index, const PatchProgram & program, QVector<PatchReplacement>* replacements)
 {
-    QByteArray body = data;
-
-    // Skip patterns with odd length
-    if (hexFindPattern.length() % 2 > 0 || hexReplacePattern.length() % 2 > 0)
+    if (!index.isValid() || program.isEmpty() || model->rowCount(index))
         return ERR_INVALID_PARAMETER;
 
-    // Convert file body to hex;
-    QString hexBody = QString(body.toHex());
-    QRegExp regexp = QRegExp(QString(hexFindPattern), Qt::CaseInsensitive);
-    INT32 offset = regexp.indexIn(hexBody);
-    while (offset >= 0) {
-        if (offset % 2 == 0) {
-            UINT8 result = patchViaOffset(body, offset/2, hexReplacePattern);
-            if (result)
-                return result;
-        }
-        offset = regexp.indexIn(hexBody, offset + 1);
+    // Skip removed items
+    if (model->action(index) == Actions::Remove)
+        return ERR_NOTHING_TO_PATCH;
+
+    // Apply patches to item's body
+    QByteArray body = model->body(index);
+    QVector<PatchReplacement> applied;
+    UINT8 result = program.apply(body, applied);
+    if (result)
+        return result;
+    if (replacements)
+        *replacements = applied;
+
+    for (int i = 0; i < applied.size(); i++) {
+        const PatchReplacement & replacement = applied.at(i);
+        QString location = provenanceString(index, model->header(index).size() + replacement.offset);
+        msg(tr("patch: replaced %1 bytes at offset 0x%2 %3 -> %4%5")
+            .arg(replacement.after.size())
+            .arg(replacement.offset, 8, 16, QChar('0'))
+            .arg(QString(replacement.before.toHex()))
+            .arg(QString(replacement.after.toHex()))
+            .arg(location.isEmpty() ? QString() : tr(", %1").arg(location)), index);
     }
 
-    data = body;
-    return ERR_SUCCESS;
+    if (body != model->body(index)) {
+        QByteArray patched = model->header(index);
+        patched.append(body);
+        return replace(index, patched, REPLACE_MODE_AS_IS);
+    }
+    
+    return ERR_NOTHING_TO_PATCH;
 }
\ No newline at end of file
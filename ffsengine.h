@@ -16,14 +16,24 @@ WITHWARRANTIES OR REPRESENTATIONS OF ANY KIND, EITHER EXPRESS OR IMPLIED.
 #include <QDir>
 #include <QFile>
 #include <QFileInfo>
+#include <QAtomicInt>
 #include <QObject>
 #include <QModelIndex>
 #include <QByteArray>
+#include <QHash>
+#include <QMutex>
 #include <QQueue>
+#include <QStringList>
+#include <QThreadPool>
 #include <QVector>
 
 #include "basetypes.h"
 #include "treemodel.h"
+#include "bytepattern.h"
+#include "dumpwriter.h"
+#include "imagebuilder.h"
+#include "patchprogram.h"
+#include "patternset.h"
 #include "peimage.h"
 
 #ifndef _CONSOLE
@@ -31,14 +41,52 @@ WITHWARRANTIES OR REPRESENTATIONS OF ANY KIND, EITHER EXPRESS OR IMPLIED.
 #endif
 
 class TreeModel;
+class SearchChunk;
 
 QString errorMessage(UINT8 errorCode);
 
-struct PatchData {
-    UINT8 type;
+// Item data taken from the tree before searching it on worker threads
+// Searched header, body and tail are shared with the tree and matched as one piece of data,
+// parts that are not searched are empty
+#define SEARCH_ITEM_PARTS 3
+struct SearchItem {
+    QModelIndex index;
+    QByteArray parts[SEARCH_ITEM_PARTS];
+};
+
+struct SearchResult {
+    QModelIndex index;
+    int pattern;
+    UINT8 mode; // SEARCH_MODE_BODY for offsets in body, SEARCH_MODE_HEADER otherwise
+    UINT32 offset;
+    UINT32 itemOffset; // Offset from item start, tail offsets of header search are after the body
+};
+
+// Offset of item in image or in decompressed data of compressed section
+struct ItemLocation {
+    void* space; // Compressed section item, NULL for opened image
     UINT32 offset;
-    QByteArray hexFindPattern;
-    QByteArray hexReplacePattern;
+};
+
+// Items selected for dumping, empty lists don't limit the selection
+// Files are selected by GUID, type and wildcards matched against their text or GUID,
+// sections are selected by type in files matching other criteria
+struct ItemFilter {
+    QList<QByteArray> guids;
+    QVector<UINT8> fileTypes;
+    QVector<UINT8> sectionTypes;
+    QStringList names;
+
+    bool isEmpty() const { return guids.isEmpty() && fileTypes.isEmpty() && sectionTypes.isEmpty() && names.isEmpty(); }
+};
+
+struct CompressionPlanItem {
+    QModelIndex index;
+    UINT8 oldAlgorithm;
+    UINT8 newAlgorithm;
+    UINT32 oldSize;
+    UINT32 newSize;
+    qint64 time; // Compression time in microseconds
 };
 
 class FfsEngine : public QObject
@@ -53,7 +101,16 @@ public:
     // Returns model for Qt view classes
     TreeModel* treeModel() const;
 
-#ifndef _CONSOLE
+    // Transactions, changes made to the tree after parsing are journaled
+    // Restoring a snapshot rolls back all changes made after it was taken
+    UINT32 snapshot() const;
+    UINT8 restore(const UINT32 snapshot);
+
+#ifdef _CONSOLE
+    // Messages are kept instead of printing them, so tools can print them later with other output
+    void setCollectMessages(const bool collect);
+    QStringList collectedMessages() const;
+#else
     // Returns message items queue
     QQueue<MessageListItem> messages() const;
     // Clears message items queue
@@ -77,16 +134,41 @@ public:
     UINT8 decompress(const QByteArray & compressed, const UINT8 compressionType, QByteArray & decompressedData, UINT8 * algorithm = NULL);
     UINT8 compress(const QByteArray & data, const UINT8 algorithm, QByteArray & compressedData);
 
+    // Compressed sections of files that can't contain selected items are not decompressed by parsing
+    void setParseFilter(const ItemFilter & filter);
+
+    // Decompression memory budgets, in bytes
+    void setDecompressionBudget(const UINT32 perImage, const UINT32 perSection);
+    UINT32 imageDecompressionBudget() const;
+    UINT32 sectionDecompressionBudget() const;
+
+    // Compression optimizer for volumes without free space
+    // Empty algorithms list means algorithms already used in the opened image
+    void setCompressionOptimization(const bool enabled, const QVector<UINT8> & algorithms = QVector<UINT8>());
+    UINT8 optimizeCompression(const QModelIndex & volumeIndex, const UINT32 requiredSpace, QVector<CompressionPlanItem> & plan);
+
     // Construction routines
     UINT8 reconstructImageFile(QByteArray &reconstructed);
+    UINT8 reconstructImageFile(ImageBuilder & reconstructed);
     UINT8 reconstruct(const QModelIndex &index, QByteArray & reconstructed);
-    UINT8 reconstructIntelImage(const QModelIndex& index, QByteArray & reconstructed);
-    UINT8 reconstructRegion(const QModelIndex& index, QByteArray & reconstructed);
+    UINT8 reconstruct(const QModelIndex &index, ImageBuilder & reconstructed);
+    UINT8 reconstructIntelImage(const QModelIndex& index, ImageBuilder & reconstructed);
+    UINT8 reconstructRegion(const QModelIndex& index, ImageBuilder & reconstructed);
     UINT8 reconstructBios(const QModelIndex& index, QByteArray & reconstructed);
     UINT8 reconstructVolume(const QModelIndex& index, QByteArray & reconstructed);
     UINT8 reconstructFile(const QModelIndex& index, const UINT8 revision, const UINT8 erasePolarity, const UINT32 base, QByteArray& reconstructed);
     UINT8 reconstructSection(const QModelIndex& index, const UINT32 base, QByteArray & reconstructed);
 
+    // Offset of item in opened image file, fails for items in decompressed data and for new items
+    UINT8 getImageOffset(const QModelIndex & index, UINT32 & offset);
+    // Location of offset from item start, either in image or in decompressed data of compressed sections,
+    // like "image+0x007a0000 -> LZMA section -> decompressed+0x00001234", or in new inserted or replacing item
+    QString provenanceString(const QModelIndex & index, const UINT32 offset = 0);
+    // Memory address of item, known for items in volumes with known base
+    UINT8 getAddress(const QModelIndex & index, UINT32 & address);
+    // Items with given GUID, from the index filled during parsing
+    UINT8 findItemsByGuid(const QByteArray & guid, QModelIndexList & indexes);
+
     // Operations on tree items
     UINT8 extract(const QModelIndex & index, QByteArray & extracted, const UINT8 mode);
     UINT8 create(const QModelIndex & index, const UINT8 type, const QByteArray & header, const QByteArray & body, const UINT8 mode, const UINT8 action, const UINT8 algorithm = COMPRESSION_ALGORITHM_NONE);
@@ -94,45 +176,150 @@ public:
     UINT8 replace(const QModelIndex & index, const QByteArray & object, const UINT8 mode);
     UINT8 remove(const QModelIndex & index);
     UINT8 rebuild(const QModelIndex & index);
-    UINT8 dump(const QModelIndex & index, const QString path);
+    // Only selected items are dumped with all their children, fails if nothing is selected
+    UINT8 dump(const QModelIndex & index, const QString path, const UINT8 layout = DUMP_LAYOUT_TREE, const ItemFilter & filter = ItemFilter());
+    // Number of I/O threads writing dumped files
+    void setDumpWriters(const int writers);
     UINT8 patch(const QModelIndex & index, const QVector<PatchData> & patches);
+    UINT8 patch(const QModelIndex & index, const PatchProgram & program, QVector<PatchReplacement>* replacements = NULL);
 
     // Search routines
     UINT8 findHexPattern(const QModelIndex & index, const QByteArray & hexPattern, const UINT8 mode);
     UINT8 findGuidPattern(const QModelIndex & index, const QByteArray & guidPattern, const UINT8 mode);
     UINT8 findTextPattern(const QModelIndex & index, const QString & pattern, const bool unicode, const Qt::CaseSensitivity caseSensitive);
+    // Search for all patterns of the set in one pass over each item
+    UINT8 findPatterns(const QModelIndex & index, const PatternSet & patterns, const UINT8 mode, QVector<SearchResult> & results);
+
+    // Background search routines, items are searched by worker threads
+    // Matches are reported as messages in tree order, starting a new search cancels the current one
+    UINT8 startHexSearch(const QModelIndex & index, const QByteArray & hexPattern, const UINT8 mode, const bool notify = true);
+    UINT8 startGuidSearch(const QModelIndex & index, const QByteArray & guidPattern, const UINT8 mode, const bool notify = true);
+    UINT8 startTextSearch(const QModelIndex & index, const QString & pattern, const bool unicode, const Qt::CaseSensitivity caseSensitive, const bool notify = true);
+    void cancelSearch();
+    bool isSearching() const;
+
+signals:
+    void searchProgress(int searched, int total);
+    void searchFinished(bool cancelled);
+
+private slots:
+    void reportSearchResults();
 
 private:
     TreeModel *model;
 
+    // Opened image file, unmodified items are referenced from it during reconstruction
+    QByteArray openedImage;
+
     // PEI Core entry point
     UINT32 oldPeiCoreEntryPoint;
     UINT32 newPeiCoreEntryPoint;
 
+    // Decompression memory budgets and amount of memory already used for current image
+    // Per-image budget is charged only while the image is being parsed
+    UINT32 imageBudget;
+    UINT32 sectionBudget;
+    UINT32 imageBudgetUsed;
+    bool parsingImage;
+
+    // Number of dump I/O threads
+    int dumpWriters;
+
+    // Items needed after parsing
+    ItemFilter parseFilter;
+
+    // Compression optimizer settings and state
+    bool compressionOptimization;
+    QVector<UINT8> optimizationAlgorithms;
+    UINT32 usedAlgorithms;
+    QHash<void*, UINT8> optimizationAttempts;
+
+    // Locations of items and volume bases, calculated during parsing
+    // Location chains of compressed sections end with their decompressed data
+    QHash<void*, ItemLocation> itemLocations;
+    QHash<void*, QString> spaceProvenance;
+    QHash<void*, UINT32> volumeBases;
+
+    // Relocation fixups of PEI images, see getRelocations
+    QHash<void*, QVector<UINT32> > relocationIndex;
+
+    // Compressed sections rebuilt in parallel before sequential reconstruction
+    // Written only between parallel passes, so workers read it without locking
+    QHash<void*, QByteArray> reconstructedSections;
+
+    // Messages can be added from reconstruction threads
+    QMutex messageMutex;
+
+    // Background search state, chunks are reported in order of their creation
+    QThreadPool searchPool;
+    QAtomicInt searchCancelled;
+    QVector<SearchChunk*> searchChunks;
+    int searchChunksReported;
+    bool searching;
+    UINT8 searchType;
+    UINT8 searchMode;
+    BytePattern searchPattern;
+    QString searchText;
+    bool searchUnicode;
+    QString searchDescription;
+
     // Parsing helpers
     UINT8 findNextVolume(const QByteArray & bios, const UINT32 volumeOffset, UINT32 & nextVolumeOffset);
     UINT8 getVolumeSize(const QByteArray & bios, const UINT32 volumeOffset, UINT32 & volumeSize);
     UINT8 getFileSize(const QByteArray & volume, const UINT32 fileOffset, UINT32 & fileSize);
     UINT8 getSectionSize(const QByteArray & file, const UINT32 sectionOffset, UINT32 & sectionSize);
+    UINT32 calculateVolumeBase(const QModelIndex & index);
+    void updateItemLocations();
+    void updateItemLocations(const QModelIndex & index, void* space, const UINT32 offset);
+    void updateNewItemLocations(const QModelIndex & index);
 
     // Reconstruction helpers
     UINT8 constructPadFile(const QByteArray &guid, const UINT32 size, const UINT8 revision, const UINT8 erasePolarity, QByteArray & pad);
     UINT8 growVolume(QByteArray & header, const UINT32 size, UINT32 & newSize);
+    UINT8 reconstructSectionBody(const QModelIndex& index, QByteArray & reconstructed);
+    QByteArray unmodifiedItem(const QModelIndex & index);
+    void appendUnmodifiedItem(ImageBuilder & builder, const QModelIndex & index);
+
+    // Compression optimizer helpers
+    void findCompressionSections(const QModelIndex & index, const QModelIndex & volumeIndex, QVector<QModelIndex> & sections);
+    UINT8 freeVolumeSpace(const QModelIndex & volumeIndex, const UINT32 requiredSpace);
+
+    // Parallel reconstruction helpers, new PEI core entry point is returned by workers
+    friend class SectionReconstruction;
+    UINT8 reconstructSection(const QModelIndex& index, const UINT32 base, QByteArray & reconstructed, UINT32 & peiCoreEntryPoint);
+    bool containsVolumes(const QModelIndex & index);
+    void findRebuiltCompressedSections(const QModelIndex & index, const int depth, QVector<QVector<QModelIndex> > & levels);
+    UINT8 reconstructCompressedSections(const QModelIndex & index);
 
     // Rebase routines
     UINT8 getBase(const QByteArray& file, UINT32& base);
     UINT8 getEntryPoint(const QByteArray& file, UINT32 &entryPoint);
     UINT8 rebase(QByteArray & executable, const UINT32 base);
+    UINT8 rebase(QByteArray & executable, const UINT32 base, const QVector<UINT32> & relocations);
+    UINT8 getRelocations(const QByteArray & executable, QVector<UINT32> & relocations);
     void rebasePeiFiles(const QModelIndex & index);
 
     // Patch routines
     UINT8 patchVtf(QByteArray &vtf);
 
-    // Patch helpers
-    UINT8 patchViaOffset(QByteArray & data, const UINT32 offset, const QByteArray & hexReplacePattern);
-    UINT8 patchViaPattern(QByteArray & data, const QByteArray & hexFindPattern, const QByteArray & hexReplacePattern);
+    // Dump helpers
+    UINT8 dumpItem(const QModelIndex & index, const QString & path, DumpWriter & writer, const ItemFilter* filter, UINT32 & dumped);
+    bool isSelected(const ItemFilter & filter, const QModelIndex & index);
+    bool fileMatches(const ItemFilter & filter, const QModelIndex & file, const bool checkNames);
+    bool mayContainSelected(const ItemFilter & filter, const QModelIndex & file);
+    bool containsSelected(const ItemFilter & filter, const QModelIndex & index);
 
-#ifndef _CONSOLE
+    // Search helpers
+    UINT32 searchItemOffset(const QModelIndex & index, const UINT8 mode, const UINT32 offset);
+    void collectSearchItems(const QModelIndex & index, QVector<SearchItem> & items);
+    UINT8 startSearch(const QModelIndex & index, const bool notify);
+    void waitForSearch();
+    void deleteSearchChunks();
+
+#ifdef _CONSOLE
+    bool collectMessages;
+    QStringList messageLines;
+#else
     QQueue<MessageListItem> messageItems;
 #endif
     // Message helper
@@ -0,0 +1,156 @@
+/* imagebuilder.cpp
+
+Copyright (c) 2014, Nikolaj Schlej. All rights reserved.
+This program and the accompanying materials
+are licensed and made available under the terms and conditions of the BSD License
+which accompanies this distribution.  The full text of the license may be found at
+http://opensource.org/licenses/bsd-license.php
+
+THE PROGRAM IS DISTRIBUTED UNDER THE BSD LICENSE ON AN "AS IS" BASIS,
+WITHOUT WARRANTIES OR REPRESENTATIONS OF ANY KIND, EITHER EXPRESS OR IMPLIED.
+
+*/
+
+#include <QFile>
+#include <string.h>
+
+#include "imagebuilder.h"
+
+ImageBuilder::ImageBuilder()
+    : totalSize(0)
+{
+}
+
+void ImageBuilder::append(const QByteArray & data)
+{
+    append(data, 0, data.size());
+}
+
+void ImageBuilder::append(const QByteArray & data, const UINT32 offset, const UINT32 size)
+{
+    if (!size)
+        return;
+
+    // Merge adjacent ranges of the same data into one piece
+    if (!pieces.isEmpty()) {
+        Piece & last = pieces.last();
+        if (last.data.constData() == data.constData() && last.offset + last.size == offset) {
+            last.size += size;
+            totalSize += size;
+            return;
+        }
+    }
+
+    Piece piece;
+    piece.data = data;
+    piece.offset = offset;
+    piece.size = size;
+    pieces.append(piece);
+    totalSize += size;
+}
+
+void ImageBuilder::append(const ImageBuilder & other)
+{
+    for (int i = 0; i < other.pieces.size(); i++)
+        append(other.pieces[i].data, other.pieces[i].offset, other.pieces[i].size);
+}
+
+void ImageBuilder::prepend(const QByteArray & data)
+{
+    if (data.isEmpty())
+        return;
+
+    Piece piece;
+    piece.data = data;
+    piece.offset = 0;
+    piece.size = data.size();
+    pieces.prepend(piece);
+    totalSize += piece.size;
+}
+
+void ImageBuilder::clear()
+{
+    pieces.clear();
+    totalSize = 0;
+}
+
+UINT32 ImageBuilder::size() const
+{
+    return totalSize;
+}
+
+bool ImageBuilder::isEmpty() const
+{
+    return totalSize == 0;
+}
+
+int ImageBuilder::pieceCount() const
+{
+    return pieces.size();
+}
+
+bool ImageBuilder::equals(const QByteArray & data) const
+{
+    if ((UINT32)data.size() != totalSize)
+        return false;
+
+    UINT32 position = 0;
+    for (int i = 0; i < pieces.size(); i++) {
+        const char* piece = pieces[i].data.constData() + pieces[i].offset;
+        if (piece != data.constData() + position && memcmp(piece, data.constData() + position, pieces[i].size))
+            return false;
+        position += pieces[i].size;
+    }
+
+    return true;
+}
+
+QByteArray ImageBuilder::toByteArray() const
+{
+    // Single piece needs no copy if it covers all of its data
+    if (pieces.size() == 1)
+        return pieces[0].data.mid(pieces[0].offset, pieces[0].size);
+
+    QByteArray result;
+    result.resize(totalSize);
+    char* destination = result.data();
+    for (int i = 0; i < pieces.size(); i++) {
+        memcpy(destination, pieces[i].data.constData() + pieces[i].offset, pieces[i].size);
+        destination += pieces[i].size;
+    }
+
+    return result;
+}
+
+UINT8 ImageBuilder::write(const QString & path) const
+{
+    QFile file(path);
+    if (!file.open(QFile::ReadWrite | QFile::Truncate))
+        return ERR_FILE_OPEN;
+
+    // Preallocate output file and copy all pieces into its mapping
+    if (totalSize && file.resize(totalSize)) {
+        uchar* destination = file.map(0, totalSize);
+        if (destination) {
+            uchar* current = destination;
+            for (int i = 0; i < pieces.size(); i++) {
+                memcpy(current, pieces[i].data.constData() + pieces[i].offset, pieces[i].size);
+                current += pieces[i].size;
+            }
+            if (!file.unmap(destination))
+                return ERR_FILE_WRITE;
+            file.close();
+            return ERR_SUCCESS;
+        }
+    }
+
+    // Mapping is not available, write pieces one by one
+    file.resize(0);
+    for (int i = 0; i < pieces.size(); i++) {
+        if (file.write(pieces[i].data.constData() + pieces[i].offset, pieces[i].size) != (qint64)pieces[i].size)
+            return ERR_FILE_WRITE;
+    }
+    file.close();
+
+    return ERR_SUCCESS;
+}
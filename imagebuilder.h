@@ -0,0 +1,57 @@
+/* imagebuilder.h
+
+Copyright (c) 2014, Nikolaj Schlej. All rights reserved.
+This program and the accompanying materials
+are licensed and made available under the terms and conditions of the BSD License
+which accompanies this distribution.  The full text of the license may be found at
+http://opensource.org/licenses/bsd-license.php
+
+THE PROGRAM IS DISTRIBUTED UNDER THE BSD LICENSE ON AN "AS IS" BASIS,
+WITHOUT WARRANTIES OR REPRESENTATIONS OF ANY KIND, EITHER EXPRESS OR IMPLIED.
+
+*/
+
+#ifndef __IMAGEBUILDER_H__
+#define __IMAGEBUILDER_H__
+
+#include <QByteArray>
+#include <QString>
+#include <QVector>
+
+#include "basetypes.h"
+
+// Output image built from references to pieces of data
+// Pieces are not copied until the image is flattened or written
+class ImageBuilder
+{
+public:
+    ImageBuilder();
+
+    // Adding pieces
+    void append(const QByteArray & data);
+    void append(const QByteArray & data, const UINT32 offset, const UINT32 size);
+    void append(const ImageBuilder & other);
+    void prepend(const QByteArray & data);
+    void clear();
+
+    // Reading operations
+    UINT32 size() const;
+    bool isEmpty() const;
+    int pieceCount() const;
+    bool equals(const QByteArray & data) const;
+    QByteArray toByteArray() const;
+
+    // Write all pieces to file at once
+    UINT8 write(const QString & path) const;
+
+private:
+    struct Piece {
+        QByteArray data;
+        UINT32 offset;
+        UINT32 size;
+    };
+    QVector<Piece> pieces;
+    UINT32 totalSize;
+};
+
+#endif
@@ -0,0 +1,328 @@
+/* patchprogram.cpp
+
+Copyright (c) 2014, Nikolaj Schlej. All rights reserved.
+This program and the accompanying materials
+are licensed and made available under the terms and conditions of the BSD License
+which accompanies this distribution.  The full text of the license may be found at
+http://opensource.org/licenses/bsd-license.php
+
+THE PROGRAM IS DISTRIBUTED UNDER THE BSD LICENSE ON AN "AS IS" BASIS,
+WITHOUT WARRANTIES OR REPRESENTATIONS OF ANY KIND, EITHER EXPRESS OR IMPLIED.
+
+*/
+
+#include <QtAlgorithms>
+
+#include "patchprogram.h"
+
+// Header of every step in binary form, find and replace values and masks follow
+#pragma pack(push,1)
+typedef struct _PATCH_PROGRAM_STEP {
+    UINT32 Index;
+    UINT8  Type;
+    UINT32 Offset;
+    UINT32 FindSize;
+    UINT32 ReplaceSize;
+} PATCH_PROGRAM_STEP;
+#pragma pack(pop)
+
+PatchProgram::PatchProgram()
+{
+}
+
+UINT8 PatchProgram::compile(const QVector<PatchData> & patches)
+{
+    steps.clear();
+    findPatterns.clear();
+
+    for (int i = 0; i < patches.size(); i++) {
+        const PatchData & patch = patches.at(i);
+        Step step;
+        step.index = i;
+        step.type = patch.type;
+        step.offset = patch.offset;
+        step.pattern = -1;
+
+        if (patch.type == PATCH_TYPE_PATTERN) {
+            // Skip patterns with odd length
+            if (patch.hexFindPattern.length() % 2 > 0 || step.find.compile(patch.hexFindPattern))
+                return ERR_INVALID_PARAMETER;
+            if (findPatterns.addPattern(patch.hexFindPattern))
+                return ERR_INVALID_PARAMETER;
+            step.pattern = findPatterns.count() - 1;
+        }
+        else if (patch.type != PATCH_TYPE_OFFSET)
+            return ERR_UNKNOWN_PATCH_TYPE;
+
+        // Replace pattern has the same syntax, dots keep nibbles of patched data
+        if (patch.hexReplacePattern.length() % 2 > 0)
+            return ERR_INVALID_PARAMETER;
+        if (!patch.hexReplacePattern.isEmpty()) {
+            BytePattern replacement;
+            if (replacement.compile(patch.hexReplacePattern))
+                return ERR_INVALID_SYMBOL;
+            step.values = replacement.values();
+            step.masks = replacement.masks();
+        }
+
+        steps.append(step);
+    }
+
+    findPatterns.build();
+    return ERR_SUCCESS;
+}
+
+bool PatchProgram::isEmpty() const
+{
+    return steps.isEmpty();
+}
+
+int PatchProgram::count() const
+{
+    return steps.size();
+}
+
+PatchProgram PatchProgram::select(const QVector<bool> & selected) const
+{
+    PatchProgram program;
+    for (int i = 0; i < steps.size(); i++) {
+        if (!selected.value(i))
+            continue;
+        Step step = steps.at(i);
+        if (step.type == PATCH_TYPE_PATTERN) {
+            program.findPatterns.addPattern(step.find);
+            step.pattern = program.findPatterns.count() - 1;
+        }
+        program.steps.append(step);
+    }
+
+    program.findPatterns.build();
+    return program;
+}
+
+QByteArray PatchProgram::toBinary() const
+{
+    QByteArray binary;
+    UINT32 count = steps.size();
+    binary.append((const char*)&count, sizeof(count));
+    for (int i = 0; i < steps.size(); i++) {
+        const Step & step = steps.at(i);
+        PATCH_PROGRAM_STEP header;
+        header.Index = step.index;
+        header.Type = step.type;
+        header.Offset = step.offset;
+        header.FindSize = step.find.size();
+        header.ReplaceSize = step.values.size();
+        binary.append((const char*)&header, sizeof(header));
+        binary.append(step.find.values());
+        binary.append(step.find.masks());
+        binary.append(step.values);
+        binary.append(step.masks);
+    }
+    return binary;
+}
+
+UINT8 PatchProgram::fromBinary(const QByteArray & binary)
+{
+    steps.clear();
+    findPatterns.clear();
+
+    UINT32 count;
+    if ((UINT32)binary.size() < sizeof(count))
+        return ERR_INVALID_FILE;
+    count = *(const UINT32*)binary.constData();
+
+    // Every step must be at least a header, so the count can't exceed the data size
+    UINT32 offset = sizeof(count);
+    if (count > ((UINT32)binary.size() - offset) / sizeof(PATCH_PROGRAM_STEP))
+        return ERR_INVALID_FILE;
+
+    // Indexes are used to find patch lines of replacements, so they must be unique and less than count
+    QVector<bool> indexUsed(count, false);
+    for (UINT32 i = 0; i < count; i++) {
+        if ((UINT32)binary.size() - offset < sizeof(PATCH_PROGRAM_STEP))
+            return clearInvalid();
+        const PATCH_PROGRAM_STEP* header = (const PATCH_PROGRAM_STEP*)(binary.constData() + offset);
+        offset += sizeof(PATCH_PROGRAM_STEP);
+        if ((UINT64)binary.size() - offset < 2 * ((UINT64)header->FindSize + header->ReplaceSize))
+            return clearInvalid();
+        if (header->Index >= count || indexUsed.at(header->Index))
+            return clearInvalid();
+        indexUsed[header->Index] = true;
+
+        // Only pattern patches have find pattern
+        if ((header->Type == PATCH_TYPE_PATTERN && !header->FindSize)
+            || (header->Type == PATCH_TYPE_OFFSET && header->FindSize)
+            || (header->Type != PATCH_TYPE_PATTERN && header->Type != PATCH_TYPE_OFFSET))
+            return clearInvalid();
+
+        Step step;
+        step.index = header->Index;
+        step.type = header->Type;
+        step.offset = header->Offset;
+        step.pattern = -1;
+        if (step.type == PATCH_TYPE_PATTERN) {
+            if (step.find.compile(binary.mid(offset, header->FindSize), binary.mid(offset + header->FindSize, header->FindSize)))
+                return clearInvalid();
+            findPatterns.addPattern(step.find);
+            step.pattern = findPatterns.count() - 1;
+        }
+        offset += 2 * header->FindSize;
+        step.values = binary.mid(offset, header->ReplaceSize);
+        step.masks = binary.mid(offset + header->ReplaceSize, header->ReplaceSize);
+        offset += 2 * header->ReplaceSize;
+
+        // Replacement values are always within their masks
+        for (UINT32 j = 0; j < header->ReplaceSize; j++)
+            if ((UINT8)step.values.at(j) & ~(UINT8)step.masks.at(j))
+                return clearInvalid();
+
+        steps.append(step);
+    }
+    if (offset != (UINT32)binary.size())
+        return clearInvalid();
+
+    findPatterns.build();
+    return ERR_SUCCESS;
+}
+
+UINT8 PatchProgram::clearInvalid()
+{
+    steps.clear();
+    findPatterns.clear();
+    return ERR_INVALID_FILE;
+}
+
+// Range of bytes written by patches
+struct WrittenRange {
+    UINT32 begin;
+    UINT32 end;
+};
+
+// Both lists are sorted, so they are merged in one pass with overlapping and adjacent ranges joined
+static void addWrittenRanges(QVector<WrittenRange> & ranges, const QVector<WrittenRange> & added)
+{
+    if (added.isEmpty())
+        return;
+
+    QVector<WrittenRange> merged;
+    merged.reserve(ranges.size() + added.size());
+    int i = 0;
+    int j = 0;
+    while (i < ranges.size() || j < added.size()) {
+        WrittenRange next;
+        if (j == added.size() || (i < ranges.size() && ranges.at(i).begin <= added.at(j).begin))
+            next = ranges.at(i++);
+        else
+            next = added.at(j++);
+        if (!merged.isEmpty() && next.begin <= merged.last().end) {
+            if (next.end > merged.last().end)
+                merged.last().end = next.end;
+        }
+        else
+            merged.append(next);
+    }
+    ranges = merged;
+}
+
+UINT8 PatchProgram::apply(QByteArray & data, QVector<PatchReplacement> & replacements) const
+{
+    // Find all patterns in unpatched data at once
+    QVector<QVector<UINT32> > matches(findPatterns.count());
+    if (!findPatterns.isEmpty()) {
+        QVector<PatternMatch> found;
+        findPatterns.search(data, found);
+        for (int i = 0; i < found.size(); i++)
+            matches[found.at(i).pattern].append(found.at(i).offset);
+        for (int i = 0; i < matches.size(); i++)
+            qSort(matches[i]);
+    }
+
+    // Bytes written by previous patches, only matches over them must be checked again
+    QVector<WrittenRange> written;
+    UINT8 result;
+    for (int i = 0; i < steps.size(); i++) {
+        const Step & step = steps.at(i);
+        int first = replacements.size();
+        if (step.type == PATCH_TYPE_OFFSET) {
+            result = replace(data, step.offset, step, replacements);
+            if (result)
+                return result;
+        }
+        else {
+            const QVector<UINT32> & previous = matches.at(step.pattern);
+            QVector<UINT32> offsets;
+            if (written.isEmpty())
+                offsets = previous;
+            else {
+                // Windows of start offsets with written bytes are searched again, other matches are still valid
+                // Windows and previous matches are both sorted, so offsets are sorted too
+                UINT32 size = step.find.size();
+                UINT64 dataSize = data.size();
+                UINT32 checked = 0;
+                int j = 0;
+                for (int k = 0; k < written.size(); k++) {
+                    UINT32 begin = written.at(k).begin >= size - 1 ? written.at(k).begin - size + 1 : 0;
+                    UINT32 end = written.at(k).end;
+                    if (begin < checked)
+                        begin = checked;
+                    for (; j < previous.size() && previous.at(j) < begin; j++)
+                        offsets.append(previous.at(j));
+                    for (; j < previous.size() && previous.at(j) < end; j++)
+                        ;
+                    for (UINT32 offset = begin; offset < end && (UINT64)offset + size <= dataSize; offset++)
+                        if (step.find.matchesAt(data.constData() + offset))
+                            offsets.append(offset);
+                    if (end > checked)
+                        checked = end;
+                }
+                for (; j < previous.size(); j++)
+                    offsets.append(previous.at(j));
+            }
+
+            // Matches are searched before this patch changes data
+            for (int j = 0; j < offsets.size(); j++) {
+                result = replace(data, offsets.at(j), step, replacements);
+                if (result)
+                    return result;
+            }
+        }
+
+        // Remember bytes written by this patch, its replacements are in order of offsets
+        QVector<WrittenRange> added;
+        for (int j = first; j < replacements.size(); j++) {
+            WrittenRange range;
+            range.begin = replacements.at(j).offset;
+            range.end = range.begin + replacements.at(j).after.size();
+            added.append(range);
+        }
+        addWrittenRanges(written, added);
+    }
+
+    return ERR_SUCCESS;
+}
+
+UINT8 PatchProgram::replace(QByteArray & data, const UINT32 offset, const Step & step, QVector<PatchReplacement> & replacements) const
+{
+    UINT32 length = step.values.size();
+    if ((UINT64)offset + length > (UINT64)data.size())
+        return ERR_PATCH_OFFSET_OUT_OF_BOUNDS;
+    if (!length)
+        return ERR_SUCCESS;
+
+    PatchReplacement replacement;
+    replacement.patch = step.index;
+    replacement.offset = offset;
+    replacement.before = data.mid(offset, length);
+
+    // Data is patched in place
+    char* bytes = data.data() + offset;
+    const char* values = step.values.constData();
+    const char* masks = step.masks.constData();
+    for (UINT32 i = 0; i < length; i++)
+        bytes[i] = (char)(((UINT8)bytes[i] & ~(UINT8)masks[i]) | (UINT8)values[i]);
+
+    replacement.after = data.mid(offset, length);
+    replacements.append(replacement);
+    return ERR_SUCCESS;
+}
@@ -0,0 +1,83 @@
+/* patchprogram.h
+
+Copyright (c) 2014, Nikolaj Schlej. All rights reserved.
+This program and the accompanying materials
+are licensed and made available under the terms and conditions of the BSD License
+which accompanies this distribution.  The full text of the license may be found at
+http://opensource.org/licenses/bsd-license.php
+
+THE PROGRAM IS DISTRIBUTED UNDER THE BSD LICENSE ON AN "AS IS" BASIS,
+WITHOUT WARRANTIES OR REPRESENTATIONS OF ANY KIND, EITHER EXPRESS OR IMPLIED.
+
+*/
+
+#ifndef __PATCHPROGRAM_H__
+#define __PATCHPROGRAM_H__
+
+#include <QByteArray>
+#include <QVector>
+
+#include "basetypes.h"
+#include "bytepattern.h"
+#include "patternset.h"
+
+struct PatchData {
+    UINT8 type;
+    UINT32 offset;
+    QByteArray hexFindPattern;
+    QByteArray hexReplacePattern;
+};
+
+// Bytes changed by one replacement
+struct PatchReplacement {
+    int patch; // Index of patch in compiled list, kept by selection
+    UINT32 offset;
+    QByteArray before;
+    QByteArray after;
+};
+
+// Patches compiled to binary find patterns and replacements
+// All find patterns are searched in one pass over data, patches are applied in order
+class PatchProgram
+{
+public:
+    PatchProgram();
+
+    // Compile patches, hex patterns are parsed only here
+    UINT8 compile(const QVector<PatchData> & patches);
+
+    // Reading operations
+    bool isEmpty() const;
+    int count() const;
+
+    // Program with selected patches only, without compiling them again
+    PatchProgram select(const QVector<bool> & selected) const;
+
+    // Compiled program in binary form, hex patterns are not stored
+    // Binary of a compiled program is read back, not of a selected one, its patch indexes are not less than count
+    QByteArray toBinary() const;
+    UINT8 fromBinary(const QByteArray & binary);
+
+    // Apply all patches to data and append replacements made
+    // Result is the same as of applying patches one by one, each to the result of previous ones
+    UINT8 apply(QByteArray & data, QVector<PatchReplacement> & replacements) const;
+
+private:
+    struct Step {
+        int index;
+        UINT8 type;
+        UINT32 offset;
+        BytePattern find;
+        int pattern; // Index of find pattern in pattern set
+        // Replacement bits set in mask are taken from values, other bits are kept
+        QByteArray values;
+        QByteArray masks;
+    };
+    QVector<Step> steps;
+    PatternSet findPatterns;
+
+    UINT8 replace(QByteArray & data, const UINT32 offset, const Step & step, QVector<PatchReplacement> & replacements) const;
+    UINT8 clearInvalid();
+};
+
+#endif
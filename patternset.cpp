@@ -0,0 +1,216 @@
+/* patternset.cpp
+
+Copyright (c) 2014, Nikolaj Schlej. All rights reserved.
+This program and the accompanying materials
+are licensed and made available under the terms and conditions of the BSD License
+which accompanies this distribution.  The full text of the license may be found at
+http://opensource.org/licenses/bsd-license.php
+
+THE PROGRAM IS DISTRIBUTED UNDER THE BSD LICENSE ON AN "AS IS" BASIS,
+WITHOUT WARRANTIES OR REPRESENTATIONS OF ANY KIND, EITHER EXPRESS OR IMPLIED.
+
+*/
+
+#include <QFile>
+
+#include "patternset.h"
+
+PatternSet::PatternSet()
+    : built(false)
+{
+}
+
+UINT8 PatternSet::addPattern(const QByteArray & hexPattern, const QString & name)
+{
+    BytePattern pattern;
+    UINT8 result = pattern.compile(hexPattern);
+    if (result)
+        return result;
+
+    patterns.append(pattern);
+    hexPatterns.append(hexPattern);
+    names.append(name.isEmpty() ? QString(hexPattern) : name);
+    built = false;
+    return ERR_SUCCESS;
+}
+
+UINT8 PatternSet::addPattern(const BytePattern & pattern, const QString & name)
+{
+    if (pattern.isEmpty())
+        return ERR_INVALID_PARAMETER;
+
+    QByteArray hexPattern = pattern.hexPattern();
+    patterns.append(pattern);
+    hexPatterns.append(hexPattern);
+    names.append(name.isEmpty() ? QString(hexPattern) : name);
+    built = false;
+    return ERR_SUCCESS;
+}
+
+UINT8 PatternSet::loadFromFile(const QString & path)
+{
+    QFile file(path);
+    if (!file.open(QFile::ReadOnly | QFile::Text))
+        return ERR_INVALID_FILE;
+
+    while (!file.atEnd()) {
+        QByteArray line = file.readLine().trimmed();
+        // Use sharp sign as commentary
+        if (line.isEmpty() || line[0] == '#')
+            continue;
+
+        QList<QByteArray> list = line.simplified().split(' ');
+        QString name;
+        for (int i = 1; i < list.count(); i++)
+            name += (i > 1 ? " " : "") + QString(list.at(i));
+
+        if (addPattern(list.at(0), name))
+            return ERR_INVALID_SYMBOL;
+    }
+
+    build();
+    return ERR_SUCCESS;
+}
+
+void PatternSet::clear()
+{
+    patterns.clear();
+    hexPatterns.clear();
+    names.clear();
+    transitions.clear();
+    outputs.clear();
+    unanchored.clear();
+    anchorEnds.clear();
+    built = false;
+}
+
+void PatternSet::build()
+{
+    transitions.clear();
+    outputs.clear();
+    unanchored.clear();
+    anchorEnds.clear();
+
+    // Add anchors of all patterns to the trie
+    transitions.fill(-1, 256);
+    outputs.resize(1);
+    for (int i = 0; i < patterns.size(); i++) {
+        QByteArray anchor = patterns.at(i).anchor();
+        anchorEnds.append(patterns.at(i).anchorPosition() + anchor.size());
+        if (anchor.isEmpty()) {
+            unanchored.append(i);
+            continue;
+        }
+
+        INT32 state = 0;
+        for (int j = 0; j < anchor.size(); j++) {
+            int transition = state * 256 + (UINT8)anchor.at(j);
+            if (transitions.at(transition) < 0) {
+                transitions[transition] = outputs.size();
+                outputs.resize(outputs.size() + 1);
+                transitions.insert(transitions.size(), 256, -1);
+            }
+            state = transitions.at(transition);
+        }
+        outputs[state].append(i);
+    }
+
+    // Add failure transitions in breadth-first order
+    QVector<INT32> failures(outputs.size(), 0);
+    QVector<INT32> queue;
+    for (int c = 0; c < 256; c++) {
+        INT32 & next = transitions[c];
+        if (next < 0)
+            next = 0;
+        else
+            queue.append(next);
+    }
+    for (int i = 0; i < queue.size(); i++) {
+        INT32 state = queue.at(i);
+        // Failure state is less deep, so its outputs are already complete
+        outputs[state] += outputs.at(failures.at(state));
+        for (int c = 0; c < 256; c++) {
+            INT32 next = transitions.at(state * 256 + c);
+            INT32 failure = transitions.at(failures.at(state) * 256 + c);
+            if (next < 0)
+                transitions[state * 256 + c] = failure;
+            else {
+                failures[next] = failure;
+                queue.append(next);
+            }
+        }
+    }
+
+    built = true;
+}
+
+int PatternSet::count() const
+{
+    return patterns.size();
+}
+
+bool PatternSet::isEmpty() const
+{
+    return patterns.isEmpty();
+}
+
+QString PatternSet::name(const int pattern) const
+{
+    return names.value(pattern);
+}
+
+QByteArray PatternSet::hexPattern(const int pattern) const
+{
+    return hexPatterns.value(pattern);
+}
+
+int PatternSet::size(const int pattern) const
+{
+    if (pattern < 0 || pattern >= patterns.size())
+        return 0;
+    return patterns.at(pattern).size();
+}
+
+void PatternSet::search(const char* data, const UINT32 size, QVector<PatternMatch> & matches) const
+{
+    if (!built || !data || !size)
+        return;
+
+    // Scan data once for all anchors
+    const INT32* table = transitions.constData();
+    INT32 state = 0;
+    for (UINT32 i = 0; i < size; i++) {
+        state = table[state * 256 + (UINT8)data[i]];
+        const QVector<int> & found = outputs.at(state);
+        for (int j = 0; j < found.size(); j++) {
+            const BytePattern & pattern = patterns.at(found.at(j));
+            // Anchor ends at current byte
+            INT64 start = (INT64)i + 1 - anchorEnds.at(found.at(j));
+            if (start < 0 || start + pattern.size() > size)
+                continue;
+            if (pattern.matchesAt(data + start)) {
+                PatternMatch match;
+                match.pattern = found.at(j);
+                match.offset = (UINT32)start;
+                matches.append(match);
+            }
+        }
+    }
+
+    for (int i = 0; i < unanchored.size(); i++) {
+        const BytePattern & pattern = patterns.at(unanchored.at(i));
+        INT32 offset = pattern.indexIn(data, size);
+        while (offset >= 0) {
+            PatternMatch match;
+            match.pattern = unanchored.at(i);
+            match.offset = offset;
+            matches.append(match);
+            offset = pattern.indexIn(data, size, offset + 1);
+        }
+    }
+}
+
+void PatternSet::search(const QByteArray & data, QVector<PatternMatch> & matches) const
+{
+    search(data.constData(), data.size(), matches);
+}
@@ -0,0 +1,74 @@
+/* patternset.h
+
+Copyright (c) 2014, Nikolaj Schlej. All rights reserved.
+This program and the accompanying materials
+are licensed and made available under the terms and conditions of the BSD License
+which accompanies this distribution.  The full text of the license may be found at
+http://opensource.org/licenses/bsd-license.php
+
+THE PROGRAM IS DISTRIBUTED UNDER THE BSD LICENSE ON AN "AS IS" BASIS,
+WITHOUT WARRANTIES OR REPRESENTATIONS OF ANY KIND, EITHER EXPRESS OR IMPLIED.
+
+*/
+
+#ifndef __PATTERNSET_H__
+#define __PATTERNSET_H__
+
+#include <QByteArray>
+#include <QList>
+#include <QString>
+#include <QStringList>
+#include <QVector>
+
+#include "basetypes.h"
+#include "bytepattern.h"
+
+struct PatternMatch {
+    int pattern;
+    UINT32 offset;
+};
+
+// Set of hex patterns searched in one pass over data
+// Longest fixed runs of all patterns are matched by Aho-Corasick automaton,
+// full patterns with wildcards are checked at candidate offsets only
+class PatternSet
+{
+public:
+    PatternSet();
+
+    // Adding patterns, automaton must be built after that
+    UINT8 addPattern(const QByteArray & hexPattern, const QString & name = QString());
+    UINT8 addPattern(const BytePattern & pattern, const QString & name = QString());
+    // Pattern file has one hex pattern with optional name per line, '#' starts a comment
+    UINT8 loadFromFile(const QString & path);
+    void clear();
+    void build();
+
+    // Reading operations
+    int count() const;
+    bool isEmpty() const;
+    QString name(const int pattern) const;
+    QByteArray hexPattern(const int pattern) const;
+    int size(const int pattern) const;
+
+    // Append all matches in data to the list
+    void search(const char* data, const UINT32 size, QVector<PatternMatch> & matches) const;
+    void search(const QByteArray & data, QVector<PatternMatch> & matches) const;
+
+private:
+    QVector<BytePattern> patterns;
+    QList<QByteArray> hexPatterns;
+    QStringList names;
+
+    // Automaton with 256 transitions per state, state 0 is the root
+    QVector<INT32> transitions;
+    // Patterns which anchors end in state, including suffix states
+    QVector<QVector<int> > outputs;
+    // Patterns without fully defined bytes, searched one by one
+    QVector<int> unanchored;
+    // End positions of anchors in patterns
+    QVector<int> anchorEnds;
+    bool built;
+};
+
+#endif
@@ -27,6 +27,7 @@ TreeItem::TreeItem(const UINT8 type, const UINT8 subtype, const UINT8 compressio
     itemType = type;
     itemSubtype = subtype;
     itemCompression = compression;
+    itemOffset = OFFSET_UNKNOWN;
     itemName = name;
     itemText = text;
     itemInfo = info;
@@ -78,6 +79,20 @@ UINT8 TreeItem::insertChildAfter(TreeItem *item, TreeItem *newItem)
     return ERR_SUCCESS;
 }
 
+void TreeItem::insertChild(int row, TreeItem *item)
+{
+    childItems.insert(row, item);
+}
+
+UINT8 TreeItem::removeChild(TreeItem *item)
+{
+    int index = childItems.indexOf(item);
+    if (index == -1)
+        return ERR_ITEM_NOT_FOUND;
+    childItems.removeAt(index);
+    return ERR_SUCCESS;
+}
+
 TreeItem *TreeItem::child(int row)
 {
     return childItems.value(row, NULL);
@@ -165,6 +180,11 @@ UINT8 TreeItem::compression() const
     return itemCompression;
 }
 
+UINT32 TreeItem::offset() const
+{
+    return itemOffset;
+}
+
 QByteArray TreeItem::header() const
 {
     return itemHeader;
@@ -220,3 +240,51 @@ void TreeItem::setSubtype(const UINT8 subtype)
     itemSubtype = subtype;
     itemSubtypeName = itemSubtypeToQString(itemType, itemSubtype);
 }
+
+void TreeItem::setCompression(const UINT8 compression)
+{
+    itemCompression = compression;
+}
+
+void TreeItem::setOffset(const UINT32 offset)
+{
+    itemOffset = offset;
+}
+
+TreeItemState TreeItem::state() const
+{
+    TreeItemState state;
+    state.action = itemAction;
+    state.subtype = itemSubtype;
+    state.compression = itemCompression;
+    state.offset = itemOffset;
+    state.name = itemName;
+    state.typeName = itemTypeName;
+    state.subtypeName = itemSubtypeName;
+    state.text = itemText;
+    return state;
+}
+
+void TreeItem::setState(const TreeItemState & state)
+{
+    itemAction = state.action;
+    itemSubtype = state.subtype;
+    itemCompression = state.compression;
+    itemOffset = state.offset;
+    itemName = state.name;
+    itemTypeName = state.typeName;
+    itemSubtypeName = state.subtypeName;
+    itemText = state.text;
+}
+
+bool TreeItemState::operator==(const TreeItemState & other) const
+{
+    return action == other.action
+        && subtype == other.subtype
+        && compression == other.compression
+        && offset == other.offset
+        && name == other.name
+        && typeName == other.typeName
+        && subtypeName == other.subtypeName
+        && text == other.text;
+}
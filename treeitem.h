@@ -21,6 +21,22 @@ WITHOUT WARRANTIES OR REPRESENTATIONS OF ANY KIND, EITHER EXPRESS OR IMPLIED.
 
 #include "basetypes.h"
 
+// Values of item that can be changed after item construction
+// Header, body and tail are never changed, so states of an item share them
+struct TreeItemState {
+    UINT8 action;
+    UINT8 subtype;
+    UINT8 compression;
+    UINT32 offset;
+    QString name;
+    QString typeName;
+    QString subtypeName;
+    QString text;
+
+    bool operator==(const TreeItemState & other) const;
+    bool operator!=(const TreeItemState & other) const { return !(*this == other); }
+};
+
 class TreeItem
 {
 public:
@@ -35,6 +51,8 @@ public:
     void prependChild(TreeItem *item);
     UINT8 insertChildBefore(TreeItem *item, TreeItem *newItem);
     UINT8 insertChildAfter(TreeItem *item, TreeItem *newItem);
+    void insertChild(int row, TreeItem *item);
+    UINT8 removeChild(TreeItem *item);
 
     // Model support operations
     TreeItem *child(int row);
@@ -56,15 +74,22 @@ public:
     QString info() const;
     UINT8 action() const;
     UINT8 compression() const;
+    UINT32 offset() const;
 
     // Some values can be changed after item construction
     void setAction(const UINT8 action);
     void setSubtype(const UINT8 subtype);
+    void setCompression(const UINT8 compression);
+    void setOffset(const UINT32 offset);
     void setTypeName(const QString &text);
     void setSubtypeName(const QString &text);
     void setName(const QString &text);
     void setText(const QString &text);
 
+    // Whole changeable state, used by undo and redo
+    TreeItemState state() const;
+    void setState(const TreeItemState & state);
+
 private:
     // Set default names after construction
     // They can later be changed by set* methods
@@ -75,6 +100,7 @@ private:
     UINT8 itemType;
     UINT8 itemSubtype;
     UINT8 itemCompression;
+    UINT32 itemOffset;
     QByteArray itemHeader;
     QByteArray itemBody;
     QByteArray itemTail;
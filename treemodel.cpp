@@ -13,15 +13,20 @@ WITHOUT WARRANTIES OR REPRESENTATIONS OF ANY KIND, EITHER EXPRESS OR IMPLIED.
 
 #include "treeitem.h"
 #include "treemodel.h"
+#include "ffs.h"
 
 TreeModel::TreeModel(QObject *parent)
     : QAbstractItemModel(parent)
 {
     rootItem = new TreeItem(Types::Root);
+    journalEnabled = false;
+    journalPosition = 0;
 }
 
 TreeModel::~TreeModel()
 {
+    truncateJournal();
+    qDeleteAll(detachedItems);
     delete rootItem;
 }
 
@@ -218,23 +223,58 @@ UINT8 TreeModel::compression(const QModelIndex &index) const
     return item->compression();
 }
 
+UINT32 TreeModel::offset(const QModelIndex &index) const
+{
+    if(!index.isValid())
+        return OFFSET_UNKNOWN;
+    TreeItem *item = static_cast<TreeItem*>(index.internalPointer());
+    return item->offset();
+}
+
 void TreeModel::setSubtype(const QModelIndex & index, UINT8 subtype)
 {
     if(!index.isValid())
         return;
 
     TreeItem *item = static_cast<TreeItem*>(index.internalPointer());
+    TreeItemState state = item->state();
     item->setSubtype(subtype);
+    recordChange(item, state);
+    emit dataChanged(index, index);
+}
+
+void TreeModel::setCompression(const QModelIndex & index, UINT8 compression)
+{
+    if(!index.isValid())
+        return;
+
+    TreeItem *item = static_cast<TreeItem*>(index.internalPointer());
+    TreeItemState state = item->state();
+    item->setCompression(compression);
+    recordChange(item, state);
     emit dataChanged(index, index);
 }
 
+void TreeModel::setOffset(const QModelIndex & index, UINT32 offset)
+{
+    if(!index.isValid())
+        return;
+
+    TreeItem *item = static_cast<TreeItem*>(index.internalPointer());
+    TreeItemState state = item->state();
+    item->setOffset(offset);
+    recordChange(item, state);
+}
+
 void TreeModel::setNameString(const QModelIndex &index, const QString &data)
 {
     if(!index.isValid())
         return;
 
     TreeItem *item = static_cast<TreeItem*>(index.internalPointer());
+    TreeItemState state = item->state();
     item->setName(data);
+    recordChange(item, state);
     emit dataChanged(index, index);
 }
 
@@ -244,7 +284,9 @@ void TreeModel::setTypeString(const QModelIndex &index, const QString &data)
         return;
 
     TreeItem *item = static_cast<TreeItem*>(index.internalPointer());
+    TreeItemState state = item->state();
     item->setTypeName(data);
+    recordChange(item, state);
     emit dataChanged(index, index);
 }
 
@@ -254,7 +296,9 @@ void TreeModel::setSubtypeString(const QModelIndex &index, const QString &data)
         return;
 
     TreeItem *item = static_cast<TreeItem*>(index.internalPointer());
+    TreeItemState state = item->state();
     item->setSubtypeName(data);
+    recordChange(item, state);
     emit dataChanged(index, index);
 }
 
@@ -264,7 +308,9 @@ void TreeModel::setTextString(const QModelIndex &index, const QString &data)
         return;
 
     TreeItem *item = static_cast<TreeItem*>(index.internalPointer());
+    TreeItemState state = item->state();
     item->setText(data);
+    recordChange(item, state);
     emit dataChanged(index, index);
 }
 
@@ -319,7 +365,33 @@ void TreeModel::setAction(const QModelIndex &index, const UINT8 action)
         return;
 
     TreeItem *item = static_cast<TreeItem*>(index.internalPointer());
+    if (!journalEnabled) {
+        item->setAction(action);
+        emit dataChanged(this->index(0,0), index);
+        return;
+    }
+
+    // Action is propagated to parents and, on insert, to all children
+    QList<TreeItem*> items;
+    for (TreeItem *current = item; current && current != rootItem; current = current->parent())
+        items.append(current);
+    if (action == Actions::Insert) {
+        QList<TreeItem*> children;
+        children.append(item);
+        for (int i = 0; i < children.size(); i++)
+            for (int j = 0; j < children.at(i)->childCount(); j++)
+                children.append(children.at(i)->child(j));
+        children.removeFirst();
+        items.append(children);
+    }
+    QVector<TreeItemState> states;
+    for (int i = 0; i < items.size(); i++)
+        states.append(items.at(i)->state());
+
     item->setAction(action);
+
+    for (int i = 0; i < items.size(); i++)
+        recordChange(items.at(i), states.at(i));
     emit dataChanged(this->index(0,0), index);
 }
 
@@ -371,6 +443,9 @@ QModelIndex TreeModel::addItem(const UINT8 type, const UINT8 subtype, const UINT
 
     emit layoutChanged();
 
+    addToGuidIndex(newItem);
+    recordInsertion(newItem);
+
     return createIndex(newItem->row(), parentColumn, newItem);
 }
 
@@ -391,3 +466,174 @@ QModelIndex TreeModel::findParentOfType(const QModelIndex& index, UINT8 type) co
 
     return QModelIndex();
 }
+
+static QByteArray itemGuid(const TreeItem *item)
+{
+    QByteArray header = item->header();
+    switch (item->type()) {
+    case Types::Volume:
+        if ((UINT32)header.size() >= sizeof(EFI_FIRMWARE_VOLUME_HEADER))
+            return header.mid(sizeof(((EFI_FIRMWARE_VOLUME_HEADER*)0)->ZeroVector), sizeof(EFI_GUID));
+        break;
+    case Types::File:
+        if ((UINT32)header.size() >= sizeof(EFI_FFS_FILE_HEADER))
+            return header.left(sizeof(EFI_GUID));
+        break;
+    case Types::Section:
+        if (item->subtype() == EFI_SECTION_GUID_DEFINED && (UINT32)header.size() >= sizeof(EFI_GUID_DEFINED_SECTION))
+            return header.mid(sizeof(EFI_COMMON_SECTION_HEADER), sizeof(EFI_GUID));
+        if (item->subtype() == EFI_SECTION_FREEFORM_SUBTYPE_GUID && (UINT32)header.size() >= sizeof(EFI_FREEFORM_SUBTYPE_GUID_SECTION))
+            return header.mid(sizeof(EFI_COMMON_SECTION_HEADER), sizeof(EFI_GUID));
+        break;
+    }
+    return QByteArray();
+}
+
+void TreeModel::addToGuidIndex(TreeItem *item)
+{
+    QByteArray guid = itemGuid(item);
+    if (!guid.isEmpty())
+        guidIndex.insert(guid, item);
+}
+
+void TreeModel::removeFromGuidIndex(TreeItem *item)
+{
+    QByteArray guid = itemGuid(item);
+    if (!guid.isEmpty())
+        guidIndex.remove(guid, item);
+}
+
+QModelIndexList TreeModel::findByGuid(const QByteArray & guid) const
+{
+    QModelIndexList indexes;
+    // Values are returned starting from the most recently added one
+    QList<TreeItem*> items = guidIndex.values(guid);
+    for (int i = items.size() - 1; i >= 0; i--) {
+        TreeItem *item = items.at(i);
+        bool removed = false;
+        for (TreeItem *current = item; current && current != rootItem; current = current->parent())
+            if (current->action() == Actions::Remove) {
+                removed = true;
+                break;
+            }
+        if (!removed)
+            indexes.append(createIndex(item->row(), 0, item));
+    }
+    return indexes;
+}
+
+void TreeModel::setJournalEnabled(const bool enabled)
+{
+    journalEnabled = enabled;
+}
+
+bool TreeModel::isJournalEnabled() const
+{
+    return journalEnabled;
+}
+
+UINT32 TreeModel::snapshot() const
+{
+    return journalPosition;
+}
+
+UINT32 TreeModel::journalSize() const
+{
+    return journal.size();
+}
+
+void TreeModel::recordChange(TreeItem *item, const TreeItemState & before)
+{
+    if (!journalEnabled)
+        return;
+
+    TreeChange change;
+    change.item = item;
+    change.parent = NULL;
+    change.row = 0;
+    change.before = before;
+    change.after = item->state();
+    if (change.after == change.before)
+        return;
+
+    truncateJournal();
+    journal.append(change);
+    journalPosition++;
+}
+
+void TreeModel::recordInsertion(TreeItem *item)
+{
+    if (!journalEnabled)
+        return;
+
+    TreeChange change;
+    change.item = item;
+    change.parent = item->parent();
+    change.row = item->row();
+    change.before = change.after = item->state();
+
+    truncateJournal();
+    journal.append(change);
+    journalPosition++;
+}
+
+void TreeModel::truncateJournal()
+{
+    // Undone changes can't be redone after a new change
+    for (int i = journalPosition; i < journal.size(); i++)
+        if (journal.at(i).parent)
+            detachedItems.append(journal.at(i).item);
+    journal.resize(journalPosition);
+}
+
+void TreeModel::applyChange(const TreeChange & change, const bool undo)
+{
+    if (change.parent) {
+        if (undo) {
+            change.parent->removeChild(change.item);
+            removeFromGuidIndex(change.item);
+        }
+        else {
+            change.parent->insertChild(change.row, change.item);
+            addToGuidIndex(change.item);
+        }
+    }
+    else
+        change.item->setState(undo ? change.before : change.after);
+}
+
+bool TreeModel::isAttached(TreeItem *item) const
+{
+    for (; item && item != rootItem; item = item->parent())
+        if (item->row() < 0)
+            return false;
+    return item == rootItem;
+}
+
+UINT8 TreeModel::restore(const UINT32 snapshot)
+{
+    if (snapshot > (UINT32)journal.size())
+        return ERR_INVALID_PARAMETER;
+    if (snapshot == journalPosition)
+        return ERR_SUCCESS;
+
+    emit layoutAboutToBeChanged();
+
+    while (journalPosition > snapshot)
+        applyChange(journal.at(--journalPosition), true);
+    while (journalPosition < snapshot)
+        applyChange(journal.at(journalPosition++), false);
+
+    // Update indexes of views, items removed from tree become invalid
+    QModelIndexList indexes = persistentIndexList();
+    for (int i = 0; i < indexes.size(); i++) {
+        TreeItem *item = static_cast<TreeItem*>(indexes.at(i).internalPointer());
+        if (isAttached(item))
+            changePersistentIndex(indexes.at(i), createIndex(item->row(), indexes.at(i).column(), item));
+        else
+            changePersistentIndex(indexes.at(i), QModelIndex());
+    }
+
+    emit layoutChanged();
+    return ERR_SUCCESS;
+}
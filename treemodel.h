@@ -15,15 +15,18 @@ WITHOUT WARRANTIES OR REPRESENTATIONS OF ANY KIND, EITHER EXPRESS OR IMPLIED.
 #define __TREEMODEL_H__
 
 #include <QAbstractItemModel>
+#include <QByteArray>
+#include <QList>
 #include <QModelIndex>
+#include <QMultiHash>
 #include <QString>
 #include <QVariant>
+#include <QVector>
 
 #include "basetypes.h"
+#include "treeitem.h"
 #include "types.h"
 
-class TreeItem;
-
 class TreeModel : public QAbstractItemModel
 {
     Q_OBJECT
@@ -55,6 +58,8 @@ public:
     void setTextString(const QModelIndex &index, const QString &text);
 
     void setSubtype(const QModelIndex & index, UINT8 subtype);
+    void setCompression(const QModelIndex & index, UINT8 compression);
+    void setOffset(const QModelIndex & index, UINT32 offset);
 
     UINT8 type(const QModelIndex &index) const;
     UINT8 subtype(const QModelIndex &index) const;
@@ -67,6 +72,7 @@ public:
     QString info(const QModelIndex &index) const;
     UINT8 action(const QModelIndex &index) const;
     UINT8 compression(const QModelIndex &index) const;
+    UINT32 offset(const QModelIndex &index) const;
 
     QModelIndex addItem(const UINT8 type, const UINT8 subtype = 0, const UINT8 compression = COMPRESSION_ALGORITHM_NONE,
                         const QString & name = QString(), const QString & text = QString(), const QString & info = QString(),
@@ -75,8 +81,43 @@ public:
 
     QModelIndex findParentOfType(const QModelIndex & index, UINT8 type) const;
 
+    // Items with file GUID, volume file system GUID, GUID-defined section GUID or freeform subtype GUID
+    // Removed items are skipped, other items are returned in order of addition
+    QModelIndexList findByGuid(const QByteArray & guid) const;
+
+    // Journal of item changes, snapshot is a position in it
+    // Restoring to an earlier snapshot undoes changes, to a later one redoes them
+    void setJournalEnabled(const bool enabled);
+    bool isJournalEnabled() const;
+    UINT32 snapshot() const;
+    UINT32 journalSize() const;
+    UINT8 restore(const UINT32 snapshot);
+
 private:
+    // Item state change or, if parent is set, item insertion at row
+    struct TreeChange {
+        TreeItem *item;
+        TreeItem *parent;
+        int row;
+        TreeItemState before;
+        TreeItemState after;
+    };
+
+    void recordChange(TreeItem *item, const TreeItemState & before);
+    void recordInsertion(TreeItem *item);
+    void truncateJournal();
+    void applyChange(const TreeChange & change, const bool undo);
+    bool isAttached(TreeItem *item) const;
+    void addToGuidIndex(TreeItem *item);
+    void removeFromGuidIndex(TreeItem *item);
+
     TreeItem *rootItem;
+    QMultiHash<QByteArray, TreeItem*> guidIndex;
+    bool journalEnabled;
+    QVector<TreeChange> journal;
+    UINT32 journalPosition;
+    // Items removed from tree by undo, kept alive until model destruction
+    QList<TreeItem*> detachedItems;
 };
 
 #endif
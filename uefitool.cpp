@@ -29,6 +29,9 @@ UEFITool::UEFITool(QWidget *parent) :
     connect(ui->actionOpenImageFile, SIGNAL(triggered()), this, SLOT(openImageFile()));
     connect(ui->actionSaveImageFile, SIGNAL(triggered()), this, SLOT(saveImageFile()));
     connect(ui->actionSearch, SIGNAL(triggered()), this, SLOT(search()));
+    connect(ui->actionStopSearch, SIGNAL(triggered()), this, SLOT(stopSearch()));
+    connect(ui->actionUndo, SIGNAL(triggered()), this, SLOT(undo()));
+    connect(ui->actionRedo, SIGNAL(triggered()), this, SLOT(redo()));
     connect(ui->actionExtract, SIGNAL(triggered()), this, SLOT(extractAsIs()));
     connect(ui->actionExtractBody, SIGNAL(triggered()), this, SLOT(extractBody()));
     connect(ui->actionInsertInto, SIGNAL(triggered()), this, SLOT(insertInto()));
@@ -83,6 +86,17 @@ void UEFITool::init()
         delete ffsEngine;
     ffsEngine = new FfsEngine(this);
     ui->structureTreeView->setModel(ffsEngine->treeModel());
+    connect(ffsEngine, SIGNAL(searchProgress(int, int)), this, SLOT(searchProgress(int, int)));
+    connect(ffsEngine, SIGNAL(searchFinished(bool)), this, SLOT(searchFinished(bool)));
+    ui->actionStopSearch->setEnabled(false);
+
+    // Clear undo history
+    undoSnapshots.clear();
+    redoSnapshots.clear();
+    savedSnapshot = ffsEngine->snapshot();
+    savedSnapshotValid = true;
+    updateUndoActions();
+    updateSaveAction();
 
     // Connect
     connect(ui->structureTreeView->selectionModel(), SIGNAL(currentChanged(const QModelIndex &, const QModelIndex &)),
@@ -101,7 +115,16 @@ void UEFITool::populateUi(const QModelIndex &current)
     UINT8 subtype =  model->subtype(current);
 
     // Set info text
-    ui->infoEdit->setPlainText(model->info(current));
+    QString info = model->info(current);
+    UINT32 offset;
+    if (!ffsEngine->getImageOffset(current, offset))
+        info += tr("\nOffset: %1").arg(offset, 8, 16, QChar('0'));
+    else if (!ffsEngine->provenanceString(current).isEmpty())
+        info += tr("\nLocation: %1").arg(ffsEngine->provenanceString(current));
+    UINT32 address;
+    if (!ffsEngine->getAddress(current, address))
+        info += tr("\nAddress: %1").arg(address, 8, 16, QChar('0'));
+    ui->infoEdit->setPlainText(info);
 
     // Enable menus
     ui->menuCapsuleActions->setEnabled(type == Types::Capsule);
@@ -147,8 +170,7 @@ void UEFITool::search()
             mode = SEARCH_MODE_BODY;
         else
             mode = SEARCH_MODE_ALL;
-        ffsEngine->findHexPattern(rootIndex, pattern, mode);
-        showMessages();
+        ffsEngine->startHexSearch(rootIndex, pattern, mode);
     }
     else if (index == 1) { // GUID
         searchDialog->ui->guidEdit->setFocus();
@@ -162,18 +184,93 @@ void UEFITool::search()
             mode = SEARCH_MODE_BODY;
         else
             mode = SEARCH_MODE_ALL;
-        ffsEngine->findGuidPattern(rootIndex, pattern, mode);
-        showMessages();
+        ffsEngine->startGuidSearch(rootIndex, pattern, mode);
     }
     else if (index == 2) { // Text string
         searchDialog->ui->textEdit->setFocus();
         QString pattern = searchDialog->ui->textEdit->text();
         if (pattern.isEmpty())
             return;
-        ffsEngine->findTextPattern(rootIndex, pattern, searchDialog->ui->textUnicodeCheckBox->isChecked(),
+        ffsEngine->startTextSearch(rootIndex, pattern, searchDialog->ui->textUnicodeCheckBox->isChecked(),
                                    (Qt::CaseSensitivity) searchDialog->ui->textCaseSensitiveCheckBox->isChecked());
-        showMessages();
     }
+
+    // Search runs in background until finished or stopped
+    if (ffsEngine->isSearching()) {
+        ui->actionSearch->setEnabled(false);
+        ui->actionStopSearch->setEnabled(true);
+        ui->statusBar->showMessage(tr("Searching..."));
+    }
+}
+
+void UEFITool::stopSearch()
+{
+    ffsEngine->cancelSearch();
+}
+
+void UEFITool::searchProgress(int searched, int total)
+{
+    showMessages();
+    ui->statusBar->showMessage(tr("Searching... %1%").arg(total ? searched * 100 / total : 100));
+}
+
+void UEFITool::searchFinished(bool cancelled)
+{
+    showMessages();
+    ui->statusBar->showMessage(cancelled ? tr("Search stopped") : tr("Search finished"));
+    ui->actionSearch->setEnabled(true);
+    ui->actionStopSearch->setEnabled(false);
+}
+
+void UEFITool::recordUndo(const UINT32 snapshot)
+{
+    // Operations that changed nothing are not added to history
+    if (ffsEngine->snapshot() == snapshot)
+        return;
+
+    // Changes after the saved snapshot are discarded from the journal, so it can't be reached again
+    if (savedSnapshotValid && savedSnapshot > snapshot)
+        savedSnapshotValid = false;
+
+    undoSnapshots.push(snapshot);
+    redoSnapshots.clear();
+    updateUndoActions();
+}
+
+void UEFITool::updateUndoActions()
+{
+    ui->actionUndo->setEnabled(!undoSnapshots.isEmpty());
+    ui->actionRedo->setEnabled(!redoSnapshots.isEmpty());
+}
+
+void UEFITool::updateSaveAction()
+{
+    // Image can be saved if it differs from the opened or last saved one
+    ui->actionSaveImageFile->setEnabled(!savedSnapshotValid || ffsEngine->snapshot() != savedSnapshot);
+}
+
+void UEFITool::undo()
+{
+    if (undoSnapshots.isEmpty())
+        return;
+
+    redoSnapshots.push(ffsEngine->snapshot());
+    ffsEngine->restore(undoSnapshots.pop());
+    updateUndoActions();
+    updateSaveAction();
+    populateUi(ui->structureTreeView->selectionModel()->currentIndex());
+}
+
+void UEFITool::redo()
+{
+    if (redoSnapshots.isEmpty())
+        return;
+
+    undoSnapshots.push(ffsEngine->snapshot());
+    ffsEngine->restore(redoSnapshots.pop());
+    updateUndoActions();
+    updateSaveAction();
+    populateUi(ui->structureTreeView->selectionModel()->currentIndex());
 }
 
 void UEFITool::rebuild()
@@ -182,7 +279,9 @@ void UEFITool::rebuild()
     if (!index.isValid())
         return;
 
+    UINT32 snapshot = ffsEngine->snapshot();
     UINT8 result = ffsEngine->rebuild(index);
+    recordUndo(snapshot);
 
     if (result == ERR_SUCCESS)
         ui->actionSaveImageFile->setEnabled(true);
@@ -194,7 +293,9 @@ void UEFITool::remove()
     if (!index.isValid())
         return;
 
+    UINT32 snapshot = ffsEngine->snapshot();
     UINT8 result = ffsEngine->remove(index);
+    recordUndo(snapshot);
 
     if (result == ERR_SUCCESS)
         ui->actionSaveImageFile->setEnabled(true);
@@ -247,7 +348,9 @@ void UEFITool::insert(const UINT8 mode)
     QByteArray buffer = inputFile.readAll();
     inputFile.close();
 
+    UINT32 snapshot = ffsEngine->snapshot();
     UINT8 result = ffsEngine->insert(index, buffer, mode);
+    recordUndo(snapshot);
     if (result) {
         QMessageBox::critical(this, tr("Insertion failed"), errorMessage(result), QMessageBox::Ok);
         return;
@@ -350,7 +453,9 @@ void UEFITool::replace(const UINT8 mode)
     QByteArray buffer = inputFile.readAll();
     inputFile.close();
 
+    UINT32 snapshot = ffsEngine->snapshot();
     UINT8 result = ffsEngine->replace(index, buffer, mode);
+    recordUndo(snapshot);
     if (result) {
         QMessageBox::critical(this, tr("Replacing failed"), errorMessage(result), QMessageBox::Ok);
         return;
@@ -485,7 +590,7 @@ void UEFITool::saveImageFile()
     if (path.isEmpty())
         return;
 
-    QByteArray reconstructed;
+    ImageBuilder reconstructed;
     UINT8 result = ffsEngine->reconstructImageFile(reconstructed);
     showMessages();
     if (result) {
@@ -493,16 +598,19 @@ void UEFITool::saveImageFile()
         return;
     }
 
-    QFile outputFile;
-    outputFile.setFileName(path);
-    if (!outputFile.open(QFile::WriteOnly)) {
+    result = reconstructed.write(path);
+    if (result == ERR_FILE_OPEN) {
         QMessageBox::critical(this, tr("Image reconstruction failed"), tr("Can't open output file for rewriting"), QMessageBox::Ok);
         return;
     }
+    else if (result) {
+        QMessageBox::critical(this, tr("Image reconstruction failed"), errorMessage(result), QMessageBox::Ok);
+        return;
+    }
+    savedSnapshot = ffsEngine->snapshot();
+    savedSnapshotValid = true;
+    updateSaveAction();
 
-    outputFile.resize(0);
-    outputFile.write(reconstructed);
-    outputFile.close();
     if (QMessageBox::information(this, tr("Image reconstruction successful"), tr("Open reconstructed file?"), QMessageBox::Yes, QMessageBox::No)
         == QMessageBox::Yes)
         openImageFile(path);
@@ -29,6 +29,7 @@
 #include <QPlainTextEdit>
 #include <QSettings>
 #include <QSplitter>
+#include <QStack>
 #include <QString>
 #include <QTreeView>
 #include <QUrl>
@@ -60,6 +61,12 @@ private slots:
     void openImageFile();
     void saveImageFile();
     void search();
+    void stopSearch();
+    void searchProgress(int searched, int total);
+    void searchFinished(bool cancelled);
+
+    void undo();
+    void redo();
 
     void extract(const UINT8 mode);
     void extractAsIs();
@@ -94,8 +101,16 @@ private:
     SearchDialog* searchDialog;
     QClipboard* clipboard;
     QQueue<MessageListItem> messageItems;
+    QStack<UINT32> undoSnapshots;
+    QStack<UINT32> redoSnapshots;
+    // Snapshot of opened or last saved image, invalid after it was discarded from the journal
+    UINT32 savedSnapshot;
+    bool savedSnapshotValid;
 
     void showMessages();
+    void recordUndo(const UINT32 snapshot);
+    void updateUndoActions();
+    void updateSaveAction();
     
     void dragEnterEvent(QDragEnterEvent* event);
     void dropEvent(QDropEvent* event);
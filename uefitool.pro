@@ -11,6 +11,11 @@ SOURCES  += uefitool_main.cpp \
  descriptor.cpp \
  ffs.cpp \
  ffsengine.cpp \
+ bytepattern.cpp \
+ dumpwriter.cpp \
+ imagebuilder.cpp \
+ patchprogram.cpp \
+ patternset.cpp \
  treeitem.cpp \
  treemodel.cpp \
  messagelistitem.cpp \
@@ -32,6 +37,11 @@ HEADERS  += uefitool.h \
  peimage.h \
  types.h \
  ffsengine.h \
+ bytepattern.h \
+ dumpwriter.h \
+ imagebuilder.h \
+ patchprogram.h \
+ patternset.h \
  treeitem.h \
  treemodel.h \
  messagelistitem.h \